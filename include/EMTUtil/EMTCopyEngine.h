@@ -0,0 +1 @@
+#include "../../src/EMTUtil/EMTCopyEngine.h"
@@ -0,0 +1 @@
+#include "../../src/EMTUtil/EMTMultiPoolCache.h"
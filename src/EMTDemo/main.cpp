@@ -1,11 +1,18 @@
 #include <EMTUtil/EMTThread.h>
 #include <EMTIPC/EMTIPCWin.h>
 #include <EMTUtil/EMTPool.h>
+#include <EMTUtil/EMTCore.h>
+#include <EMTUtil/EMTMultiPoolCache.h>
+#include <EMTUtil/EMTMultiPoolT.h>
+#include <EMTUtil/EMTShareMemory.h>
 
 #include <process.h>
 #include <windows.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <vector>
 
 enum
 {
@@ -333,6 +340,9 @@ static void test_pool_entry(void * arg)
 static int test_pool()
 {
 	EMTPOOL pool;
+	pool.uMode = kEMTPoolModeScan;
+	pool.uNumaNodeMask = 0;
+	pool.pStats = 0;
 	uint32_t metaLen, memLen;
 	EMTPool_calcMetaSize(1024 * 1024, kTestBufferSize, &metaLen, &memLen);
 	metaLen = (metaLen + (4096 - 1)) & ~(4096 - 1);
@@ -358,10 +368,1001 @@ static int test_pool()
 	return 0;
 }
 
+enum
+{
+	kTestFragmentBlockCount = 64 * 1024,
+	kTestFragmentBlockLength = 32,
+	kTestFragmentBlockLimit = 4,
+};
+
+static void test_pool_fragment_mode(const uint32_t mode, const char * name)
+{
+	EMTPOOL pool;
+	uint32_t metaLen, memLen;
+	EMTPool_calcMetaSize(kTestFragmentBlockCount, kTestFragmentBlockLength, &metaLen, &memLen);
+	metaLen = (metaLen + (4096 - 1)) & ~(4096 - 1);
+	void * mem = malloc(metaLen + memLen);
+	memset(mem, 0, metaLen + memLen);
+	pool.uMode = mode;
+	pool.uNumaNodeMask = 0;
+	pool.pStats = 0;
+	EMTPool_construct(&pool, 1, kTestFragmentBlockCount, kTestFragmentBlockLength, 1, mem, (uint8_t *)mem + metaLen);
+
+	// Fill the pool with single blocks, then punch holes of 1 to kTestFragmentBlockLimit blocks
+	std::vector<void *> blocks;
+	for (void * p = EMTPool_alloc(&pool, kTestFragmentBlockLength); p; p = EMTPool_alloc(&pool, kTestFragmentBlockLength))
+		blocks.push_back(p);
+
+	for (size_t i = 0; i < blocks.size(); i += kTestFragmentBlockLimit + 1)
+	{
+		const size_t hole = 1 + (i / (kTestFragmentBlockLimit + 1)) % kTestFragmentBlockLimit;
+		for (size_t j = i; j < i + hole && j < blocks.size(); ++j)
+		{
+			EMTPool_free(&pool, blocks[j]);
+			blocks[j] = 0;
+		}
+	}
+
+	uint32_t failed = 0;
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (int i = 0; i < kTestCount; ++i)
+	{
+		void * p = EMTPool_alloc(&pool, kTestFragmentBlockLength * kTestFragmentBlockLimit);
+		if (p)
+			EMTPool_free(&pool, p);
+		else
+			++failed;
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	printf("%s: %u of %u allocations failed, ", name, failed, kTestCount);
+	timeUsage("total: %llu\n", s_start, s_end);
+
+	free(mem);
+}
+
+static int test_pool_fragment()
+{
+	test_pool_fragment_mode(kEMTPoolModeScan, "scan");
+	test_pool_fragment_mode(kEMTPoolModeBitmap, "bitmap");
+	test_pool_fragment_mode(kEMTPoolModeBuddy, "buddy");
+
+	return 0;
+}
+
+enum
+{
+	kTestCacheThreadMax = 32,
+	kTestCacheHeld = 16,
+};
+
+struct TestMultiPool
+{
+	EMTMULTIPOOL pool;
+	EMTMULTIPOOLCONFIG config[3];
+};
+
+struct TestMultiPoolCache
+{
+	EMTMULTIPOOLCACHE cache;
+	EMTMULTIPOOLCACHEMAGAZINE magazine[3];
+};
+
+struct TestCacheContext
+{
+	HANDLE ev;
+	TestMultiPool * pool;
+	uint32_t count;
+	bool cached;
+};
+
+static unsigned __stdcall test_multipool_cache_entry(void * arg)
+{
+	TestCacheContext * ctx = (TestCacheContext *)arg;
+	TestMultiPoolCache cache;
+	void * held[kTestCacheHeld] = { 0 };
+
+	cache.cache.uMagazineCount = 3;
+	EMTMultiPoolCache_construct(&cache.cache, &ctx->pool->pool);
+	::WaitForSingleObject(ctx->ev, INFINITE);
+
+	for (uint32_t i = 0; i < ctx->count; ++i)
+	{
+		void *& slot = held[i % kTestCacheHeld];
+		if (slot)
+			ctx->cached ? EMTMultiPoolCache_free(&cache.cache, slot) : EMTMultiPool_free(&ctx->pool->pool, slot);
+		slot = ctx->cached ? EMTMultiPoolCache_alloc(&cache.cache, 32) : EMTMultiPool_alloc(&ctx->pool->pool, 32);
+	}
+
+	for (uint32_t i = 0; i < kTestCacheHeld; ++i)
+		ctx->cached ? EMTMultiPoolCache_free(&cache.cache, held[i]) : EMTMultiPool_free(&ctx->pool->pool, held[i]);
+
+	EMTMultiPoolCache_destruct(&cache.cache);
+	return 0;
+}
+
+static void test_multipool_cache_run(TestMultiPool * pool, const uint32_t threadCount, const bool cached)
+{
+	TestCacheContext ctx = { ::CreateEvent(NULL, TRUE, FALSE, NULL), pool, kTestCount / threadCount, cached };
+	HANDLE threads[kTestCacheThreadMax];
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+		threads[i] = (HANDLE)_beginthreadex(NULL, 0, test_multipool_cache_entry, &ctx, 0, NULL);
+
+	::Sleep(100);
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	::SetEvent(ctx.ev);
+
+	::WaitForMultipleObjects(threadCount, threads, TRUE, INFINITE);
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+		::CloseHandle(threads[i]);
+	::CloseHandle(ctx.ev);
+
+	printf("%2u threads, %s: ", threadCount, cached ? "cached" : "direct");
+	timeUsage("total: %llu\n", s_start, s_end);
+}
+
+static void * test_multipool_construct(TestMultiPool * pool)
+{
+	static const EMTMULTIPOOLCONFIG config[] =
+	{
+		{ 32, 32 * 1024, 4, kEMTPoolModeBitmap },
+		{ 4 * 1024, 256 * 6, 4, kEMTPoolModeBitmap },
+		{ 256 * 1024, 16, 4, kEMTPoolModeBitmap },
+	};
+
+	uint32_t metaLen, memLen;
+	pool->pool.uPoolCount = 3;
+	pool->pool.pSegmentOps = 0;
+	pool->pool.uSpillClasses = 0;
+	pool->pool.uRebalancePeriod = 0;
+	for (uint32_t i = 0; i < 3; ++i)
+		pool->config[i] = config[i];
+
+	EMTMultiPool_calcMetaSize(&pool->pool, &metaLen, &memLen);
+	metaLen = (metaLen + (4096 - 1)) & ~(4096 - 1);
+	void * mem = malloc(metaLen + memLen);
+	memset(mem, 0, metaLen + memLen);
+	EMTMultiPool_construct(&pool->pool, mem, (uint8_t *)mem + metaLen);
+
+	return mem;
+}
+
+static int test_multipool_cache()
+{
+	TestMultiPool pool;
+	void * mem = test_multipool_construct(&pool);
+
+	for (uint32_t threadCount = 1; threadCount <= kTestCacheThreadMax; threadCount *= 2)
+	{
+		test_multipool_cache_run(&pool, threadCount, false);
+		test_multipool_cache_run(&pool, threadCount, true);
+	}
+
+	EMTMultiPool_destruct(&pool.pool);
+	free(mem);
+
+	return 0;
+}
+
+static int test_batch()
+{
+	static const uint32_t batchSizes[] = { 1, 8, 64, 256 };
+
+	TestMultiPool pool;
+	void * mem = test_multipool_construct(&pool);
+	std::vector<void *> held(256);
+
+	for (uint32_t i = 0; i < _countof(batchSizes); ++i)
+	{
+		const uint32_t batchSize = batchSizes[i];
+		const uint32_t rounds = kTestCount / batchSize;
+
+		::GetSystemTimePreciseAsFileTime(&s_start);
+		for (uint32_t j = 0; j < rounds; ++j)
+		{
+			const uint32_t count = EMTMultiPool_allocBatch(&pool.pool, 32, held.data(), batchSize);
+			EMTMultiPool_freeBatch(&pool.pool, held.data(), count);
+		}
+		::GetSystemTimePreciseAsFileTime(&s_end);
+
+		const LONGLONG diffInTicks =
+			reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+			reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+		printf("batch %3u: ", batchSize);
+		timeUsage("total: %llu", s_start, s_end);
+		printf(", per message: %llu ns\n", diffInTicks * 100 / (rounds * batchSize));
+	}
+
+	EMTMultiPool_destruct(&pool.pool);
+	free(mem);
+
+	return 0;
+}
+
+typedef EMTMultiPoolT<
+	EMTPoolClassT<32, 32 * 1024>,
+	EMTPoolClassT<4 * 1024, 256 * 6>,
+	EMTPoolClassT<256 * 1024, 16>> TestMultiPoolT;
+
+template <class Pool, class Alloc, class Free, class Transfer, class Take, class Length>
+static void test_multipool_template_run(const char * name, Pool pool, Alloc alloc, Free free, Transfer transfer, Take take, Length length)
+{
+	uint32_t total = 0;
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < kTestCount; ++i)
+	{
+		void * mem = take(pool, transfer(pool, alloc(pool, 32 + (i & 3) * 1024)));
+		total += length(pool, mem);
+		free(pool, mem);
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	printf("%s: ", name);
+	timeUsage("total: %llu", s_start, s_end);
+	printf(", per message: %llu ns (%u)\n", diffInTicks * 100 / kTestCount, total);
+}
+
+static int test_multipool_template()
+{
+	TestMultiPoolT poolT;
+	uint32_t metaLen, memLen;
+
+	poolT.calcMetaSize(&metaLen, &memLen);
+	metaLen = (metaLen + (4096 - 1)) & ~(4096 - 1);
+	void * mem = malloc(metaLen + memLen);
+	memset(mem, 0, metaLen + memLen);
+	poolT.construct(mem, (uint8_t *)mem + metaLen);
+
+	// A C view of the same segment, joined the way a C peer would
+	TestMultiPool pool;
+	pool.pool.uPoolCount = TestMultiPoolT::kPoolCount;
+	pool.pool.pSegmentOps = 0;
+	pool.pool.uSpillClasses = 0;
+	pool.pool.uRebalancePeriod = 0;
+	for (uint32_t i = 0; i < TestMultiPoolT::kPoolCount; ++i)
+		pool.config[i] = *poolT.config(i);
+	EMTMultiPool_construct(&pool.pool, mem, (uint8_t *)mem + metaLen);
+
+	test_multipool_template_run("c       ", &pool.pool,
+		[](PEMTMULTIPOOL p, uint32_t len) { return EMTMultiPool_alloc(p, len); },
+		[](PEMTMULTIPOOL p, void * m) { EMTMultiPool_free(p, m); },
+		[](PEMTMULTIPOOL p, void * m) { return EMTMultiPool_transfer(p, m, EMTMultiPool_id(p)); },
+		[](PEMTMULTIPOOL p, uint32_t token) { return EMTMultiPool_take(p, token); },
+		[](PEMTMULTIPOOL p, void * m) { return EMTMultiPool_length(p, m); });
+
+	test_multipool_template_run("template", &poolT,
+		[](TestMultiPoolT * p, uint32_t len) { return p->alloc(len); },
+		[](TestMultiPoolT * p, void * m) { p->free(m); },
+		[](TestMultiPoolT * p, void * m) { return p->transfer(m, p->id()); },
+		[](TestMultiPoolT * p, uint32_t token) { return p->take(token); },
+		[](TestMultiPoolT * p, void * m) { return p->length(m); });
+
+	EMTMultiPool_destruct(&pool.pool);
+	poolT.destruct();
+	free(mem);
+
+	return 0;
+}
+
+static void test_share_memory_warmup_run(const uint32_t options, const char * name)
+{
+	enum { kWarmupLength = 256 * 1024 * 1024 };
+
+	std::unique_ptr<IEMTShareMemory, IEMTUnknown_Delete> shareMemory(createEMTShareMemory(L"EMTDemoWarmup", options));
+	LARGE_INTEGER freq, start, end, prev;
+	LONGLONG worst = 0;
+
+	::QueryPerformanceFrequency(&freq);
+
+	::QueryPerformanceCounter(&start);
+	uint8_t * mem = (uint8_t *)shareMemory->open(kWarmupLength);
+	::QueryPerformanceCounter(&end);
+
+	if (mem == NULL)
+	{
+		printf("%-24s open failed\n", name);
+		return;
+	}
+
+	const LONGLONG openUs = (end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart;
+
+	// Stand-in for the first messages after connect: one write per page
+	::QueryPerformanceCounter(&start);
+	prev = start;
+	for (uint32_t offset = 0; offset < kWarmupLength; offset += 4096)
+	{
+		mem[offset] = 1;
+
+		::QueryPerformanceCounter(&end);
+		if (end.QuadPart - prev.QuadPart > worst)
+			worst = end.QuadPart - prev.QuadPart;
+		prev = end;
+	}
+
+	const LONGLONG touchUs = (end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart;
+
+	printf("%-24s obtained 0x%x, open: %lld us, first touch: %lld us, worst page: %lld us\n",
+		name, shareMemory->options(), openUs, touchUs, worst * 1000000 / freq.QuadPart);
+
+	shareMemory->close();
+}
+
+static int test_share_memory_warmup()
+{
+	test_share_memory_warmup_run(kEMTShareMemoryDefault, "default");
+	test_share_memory_warmup_run(kEMTShareMemoryPrefault, "prefault");
+	test_share_memory_warmup_run(kEMTShareMemoryPrefault | kEMTShareMemoryLock, "prefault+lock");
+	test_share_memory_warmup_run(kEMTShareMemoryLargePage | kEMTShareMemoryPrefault | kEMTShareMemoryLock, "largepage+prefault+lock");
+
+	return 0;
+}
+
+enum
+{
+	kTestNumaRing = 1024,
+	kTestNumaLength = 4 * 1024,
+};
+
+struct TestNumaContext
+{
+	HANDLE ev;
+	TestMultiPool * pool;
+	std::atomic<void *> * ring;
+	uint32_t node;
+	bool sender;
+};
+
+static void test_numa_pin(const uint32_t node)
+{
+	GROUP_AFFINITY affinity = { 0 };
+	if (::GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0)
+		::SetThreadGroupAffinity(::GetCurrentThread(), &affinity, NULL);
+}
+
+static unsigned __stdcall test_numa_entry(void * arg)
+{
+	TestNumaContext * ctx = (TestNumaContext *)arg;
+	uint32_t sum = 0;
+
+	test_numa_pin(ctx->node);
+	::WaitForSingleObject(ctx->ev, INFINITE);
+
+	for (uint32_t i = 0; i < kTestCount; ++i)
+	{
+		std::atomic<void *> & slot = ctx->ring[i % kTestNumaRing];
+		void * mem;
+
+		if (ctx->sender)
+		{
+			while (slot.load() != nullptr || (mem = EMTMultiPool_alloc(&ctx->pool->pool, kTestNumaLength)) == nullptr)
+				YieldProcessor();
+
+			memset(mem, (int)i, kTestNumaLength);
+			slot.store(mem);
+		}
+		else
+		{
+			while ((mem = slot.load()) == nullptr)
+				YieldProcessor();
+
+			for (uint32_t j = 0; j < kTestNumaLength; j += 64)
+				sum += ((uint8_t *)mem)[j];
+
+			slot.store(nullptr);
+			EMTMultiPool_free(&ctx->pool->pool, mem);
+		}
+	}
+
+	return sum;
+}
+
+static void test_numa_run(const uint32_t senderNode, const uint32_t receiverNode, const bool bound)
+{
+	static const EMTMULTIPOOLCONFIG config[] =
+	{
+		{ 32, 32 * 1024, 4, kEMTPoolModeBitmap },
+		{ 4 * 1024, 256 * 6, 4, kEMTPoolModeBitmap },
+		{ 256 * 1024, 16, 4, kEMTPoolModeBitmap },
+	};
+
+	TestMultiPool pool;
+	uint32_t metaLen, memLen;
+	pool.pool.uPoolCount = 3;
+	pool.pool.pSegmentOps = 0;
+	pool.pool.uSpillClasses = 0;
+	pool.pool.uRebalancePeriod = 0;
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		pool.config[i] = config[i];
+		pool.config[i].uNumaNodeMask = bound ? (1U << senderNode) | (1U << receiverNode) : 0;
+	}
+
+	EMTMultiPool_calcMetaSize(&pool.pool, &metaLen, &memLen);
+	metaLen = (metaLen + (4096 - 1)) & ~(4096 - 1);
+
+	// Fresh pages, so that placement is decided by who touches them first
+	uint8_t * mem = (uint8_t *)::VirtualAlloc(NULL, metaLen + memLen, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+	// Without binding, stand in for a segment prefaulted by the receiving side
+	test_numa_pin(receiverNode);
+	if (!bound)
+	{
+		for (uint32_t offset = 0; offset < metaLen + memLen; offset += 4096)
+			mem[offset] = 0;
+	}
+	EMTMultiPool_construct(&pool.pool, mem, mem + metaLen);
+
+	std::vector<std::atomic<void *>> ring(kTestNumaRing);
+	for (auto & slot : ring)
+		slot.store(nullptr);
+
+	TestNumaContext sender = { ::CreateEvent(NULL, TRUE, FALSE, NULL), &pool, ring.data(), senderNode, true };
+	TestNumaContext receiver = sender;
+	receiver.node = receiverNode;
+	receiver.sender = false;
+
+	HANDLE threads[2] =
+	{
+		(HANDLE)_beginthreadex(NULL, 0, test_numa_entry, &sender, 0, NULL),
+		(HANDLE)_beginthreadex(NULL, 0, test_numa_entry, &receiver, 0, NULL),
+	};
+
+	::Sleep(100);
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	::SetEvent(sender.ev);
+
+	::WaitForMultipleObjects(2, threads, TRUE, INFINITE);
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	::CloseHandle(threads[0]);
+	::CloseHandle(threads[1]);
+	::CloseHandle(sender.ev);
+
+	printf("node %u -> node %u, %s: ", senderNode, receiverNode, bound ? "bound" : "first touch");
+	timeUsage("total: %llu\n", s_start, s_end);
+
+	EMTMultiPool_destruct(&pool.pool);
+	::VirtualFree(mem, 0, MEM_RELEASE);
+}
+
+static int test_numa()
+{
+	ULONG highestNode = 0;
+	::GetNumaHighestNodeNumber(&highestNode);
+
+	// On a single node box both sides land on node 0 and the runs should match
+	const uint32_t receiverNode = highestNode > 0 ? 1 : 0;
+
+	test_numa_run(0, receiverNode, false);
+	test_numa_run(0, receiverNode, true);
+
+	return 0;
+}
+
+/* Two cores of one process on one segment, the sender's notify goes nowhere and the receiver is pumped by hand */
+struct TestCoreSide
+{
+	EMTCORE core;
+	uint32_t received;
+	uint32_t sum;
+};
+
+static void * s_coreMem;
+
+static void test_core_received(void * pThis, void * pMem)
+{
+	TestCoreSide * side = (TestCoreSide *)pThis;
+
+	++side->received;
+	side->sum += *(uint8_t *)pMem;
+	EMTCore_free(&side->core, pMem);
+}
+
+static EMTCORESINKOPS s_coreSinkOps =
+{
+	[](void * pThis, void * pMem, const uint64_t, const uint64_t) { test_core_received(pThis, pMem); },
+	[](void *, const uint32_t uLen) { if (s_coreMem == NULL) s_coreMem = ::VirtualAlloc(NULL, uLen, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE); return s_coreMem; },
+	[](void *, void *) {},
+	NULL,
+	NULL,
+	[](void *) {},
+	[](void * pThis, void * pMem) { EMTCore_queued(&((TestCoreSide *)pThis)->core, pMem); },
+	[](void *, const uint32_t uLen) { return malloc(uLen); },
+	[](void *, void * pMem) { free(pMem); },
+};
+
+static EMTCORESINKOPS s_coreBatchSinkOps;
+
+static void test_core_ring_run(const char * name, PEMTCORESINKOPS sinkOps, const uint32_t ring, const uint32_t batchSize)
+{
+	TestCoreSide sender = {}, receiver = {};
+	const uint32_t rounds = kTestCount / batchSize;
+
+	sender.core.uRing = ring;
+	EMTCore_construct(&sender.core, sinkOps, &sender);
+	EMTCore_construct(&receiver.core, sinkOps, &receiver);
+	EMTCore_connect(&receiver.core, EMTCore_connect(&sender.core, kEMTCoreInvalidConn));
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < rounds; ++i)
+	{
+		for (uint32_t j = 0; j < batchSize; ++j)
+		{
+			uint8_t * mem = (uint8_t *)EMTCore_alloc(&sender.core, 64);
+			mem[0] = (uint8_t)j;
+			EMTCore_send(&sender.core, mem, i, j);
+		}
+		EMTCore_notified(&receiver.core);
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	printf("%s batch %3u: ", name, batchSize);
+	timeUsage("total: %llu", s_start, s_end);
+	printf(", per message: %llu ns (%u)\n", diffInTicks * 100 / (rounds * batchSize), receiver.received);
+
+	EMTCore_disconnect(&receiver.core);
+	EMTCore_disconnect(&sender.core);
+	EMTCore_destruct(&receiver.core);
+	EMTCore_destruct(&sender.core);
+
+	::VirtualFree(s_coreMem, 0, MEM_RELEASE);
+	s_coreMem = NULL;
+}
+
+static int test_core_ring()
+{
+	// 256 overflows the ring, the rest spills to the list
+	static const uint32_t batchSizes[] = { 1, 64, 256 };
+
+	for (uint32_t i = 0; i < _countof(batchSizes); ++i)
+	{
+		test_core_ring_run("list", &s_coreSinkOps, 0, batchSizes[i]);
+		test_core_ring_run("ring", &s_coreSinkOps, 1, batchSizes[i]);
+	}
+
+	return 0;
+}
+
+static int test_core_batch()
+{
+	static const uint32_t batchSizes[] = { 1, 64, 256 };
+
+	s_coreBatchSinkOps = s_coreSinkOps;
+	s_coreBatchSinkOps.receivedBatch = [](void * pThis, PEMTCOREMESSAGE pMessage, const uint32_t uCount)
+	{
+		for (uint32_t i = 0; i < uCount; ++i)
+			test_core_received(pThis, pMessage[i].pMem);
+	};
+
+	for (uint32_t i = 0; i < _countof(batchSizes); ++i)
+	{
+		test_core_ring_run("list        ", &s_coreSinkOps, 0, batchSizes[i]);
+		test_core_ring_run("list batched", &s_coreBatchSinkOps, 0, batchSizes[i]);
+		test_core_ring_run("ring        ", &s_coreSinkOps, 1, batchSizes[i]);
+		test_core_ring_run("ring batched", &s_coreBatchSinkOps, 1, batchSizes[i]);
+	}
+
+	return 0;
+}
+
+/* Messages past the largest class stream through it in chunks, senders short of blocks wait in the queue */
+struct TestCorePartialSide : TestCoreSide
+{
+	std::vector<void *> queued;
+};
+
+static void test_core_partial_pump(TestCorePartialSide & side)
+{
+	std::vector<void *> queued;
+	queued.swap(side.queued);
+
+	EMTCore_notified(&side.core);
+	for (size_t i = 0; i < queued.size(); ++i)
+		EMTCore_queued(&side.core, queued[i]);
+}
+
+static void test_core_partial_run(const uint32_t window, const uint32_t length, const uint32_t rounds, const bool streamed)
+{
+	TestCorePartialSide sender{}, receiver{};
+	EMTCORESINKOPS sinkOps = s_coreSinkOps;
+
+	sinkOps.queue = [](void * pThis, void * pMem) { static_cast<TestCorePartialSide *>((TestCoreSide *)pThis)->queued.push_back(pMem); };
+
+	// Each chunk is looked at and dropped where it landed, nothing is assembled
+	if (streamed)
+	{
+		sinkOps.receivedChunk = [](void * pThis, const uint32_t, void * pMem, const uint32_t uOffset, const uint32_t uLength, const uint64_t, const uint64_t)
+		{
+			TestCoreSide * side = (TestCoreSide *)pThis;
+			const uint32_t chunkLength = EMTCore_length(&side->core, pMem);
+
+			side->sum += *(uint8_t *)pMem;
+			EMTCore_free(&side->core, pMem);
+
+			if (uOffset + chunkLength == uLength)
+				++side->received;
+		};
+	}
+
+	sender.core.uPartialWindow = window;
+	EMTCore_construct(&sender.core, &sinkOps, static_cast<TestCoreSide *>(&sender));
+	EMTCore_construct(&receiver.core, &sinkOps, static_cast<TestCoreSide *>(&receiver));
+	EMTCore_connect(&receiver.core, EMTCore_connect(&sender.core, kEMTCoreInvalidConn));
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < rounds; ++i)
+	{
+		uint8_t * mem = (uint8_t *)EMTCore_alloc(&sender.core, length);
+		mem[0] = (uint8_t)i;
+		EMTCore_send(&sender.core, mem, i, 0);
+
+		while (receiver.received == i)
+		{
+			test_core_partial_pump(receiver);
+			test_core_partial_pump(sender);
+		}
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	printf("%s window %2u, %4u MB: ", streamed ? "streamed" : "whole   ", window, length >> 20);
+	timeUsage("total: %llu", s_start, s_end);
+	printf(", %llu MB/s (%u)\n", diffInTicks ? (uint64_t)(length >> 20) * rounds * 10000000 / diffInTicks : 0, receiver.received);
+
+	EMTCore_disconnect(&receiver.core);
+	EMTCore_disconnect(&sender.core);
+	EMTCore_destruct(&receiver.core);
+	EMTCore_destruct(&sender.core);
+
+	::VirtualFree(s_coreMem, 0, MEM_RELEASE);
+	s_coreMem = NULL;
+}
+
+static int test_core_partial()
+{
+	// One chunk in flight is the old stop-and-wait, the largest class has room for four
+	static const uint32_t windows[] = { 1, 4, 10 };
+	static const uint32_t lengths[] = { 10 << 20, 100 << 20, 1 << 30, 2U << 30 };
+
+	for (uint32_t i = 0; i < _countof(lengths); ++i)
+	{
+		for (uint32_t j = 0; j < _countof(windows); ++j)
+		{
+			test_core_partial_run(windows[j], lengths[i], lengths[i] < (1 << 30) ? 10 : 2, false);
+			test_core_partial_run(windows[j], lengths[i], lengths[i] < (1 << 30) ? 10 : 2, true);
+		}
+	}
+
+	return 0;
+}
+
+/* Small messages stamped at send while large ones keep streaming, in one domain they wait for each large one to land */
+struct TestCoreDomainSide : TestCorePartialSide
+{
+	std::vector<uint64_t> latency;
+	uint32_t bulk;
+};
+
+static uint64_t test_core_domain_now()
+{
+	LARGE_INTEGER now;
+	::QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+/* uParam1 0 marks the stamped ones */
+static void test_core_domain_received(void * pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	TestCoreDomainSide * side = static_cast<TestCoreDomainSide *>((TestCoreSide *)pThis);
+
+	if (uParam1 == 0)
+		side->latency.push_back(test_core_domain_now() - uParam0);
+	else
+		++side->bulk;
+
+	test_core_received(pThis, pMem);
+}
+
+static void test_core_domain_print(const char * name, std::vector<uint64_t> & latency)
+{
+	LARGE_INTEGER frequency;
+	::QueryPerformanceFrequency(&frequency);
+
+	std::sort(latency.begin(), latency.end());
+	printf("%s: small p50 %6llu us, p99 %6llu us, max %6llu us", name,
+		latency[latency.size() / 2] * 1000000 / frequency.QuadPart,
+		latency[latency.size() * 99 / 100] * 1000000 / frequency.QuadPart,
+		latency.back() * 1000000 / frequency.QuadPart);
+}
+
+static void test_core_domain_run(const char * name, const uint32_t bulkDomains, const uint32_t length, const uint32_t count)
+{
+	TestCoreDomainSide sender{}, receiver{};
+	EMTCORESINKOPS sinkOps = s_coreSinkOps;
+	uint32_t bulkSent = 0;
+
+	sinkOps.received = test_core_domain_received;
+	sinkOps.queue = [](void * pThis, void * pMem) { static_cast<TestCorePartialSide *>((TestCoreSide *)pThis)->queued.push_back(pMem); };
+
+	EMTCore_construct(&sender.core, &sinkOps, static_cast<TestCoreSide *>(&sender));
+	EMTCore_construct(&receiver.core, &sinkOps, static_cast<TestCoreSide *>(&receiver));
+	EMTCore_connect(&receiver.core, EMTCore_connect(&sender.core, kEMTCoreInvalidConn));
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < count || receiver.latency.size() < count || receiver.bulk < bulkSent; ++i)
+	{
+		// Two large messages queued at any time, taking turns over the bulk domains
+		while (i < count && bulkSent - receiver.bulk < 2)
+		{
+			EMTCore_sendIn(&sender.core, bulkDomains ? 1 + bulkSent % bulkDomains : 0, EMTCore_alloc(&sender.core, length), bulkSent, 1);
+			++bulkSent;
+		}
+
+		if (i < count)
+		{
+			uint8_t * mem = (uint8_t *)EMTCore_alloc(&sender.core, 64);
+			mem[0] = (uint8_t)i;
+			EMTCore_sendIn(&sender.core, 0, mem, test_core_domain_now(), 0);
+		}
+
+		test_core_partial_pump(receiver);
+		test_core_partial_pump(sender);
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	test_core_domain_print(name, receiver.latency);
+	printf(", bulk %u MB/s (%u)\n", diffInTicks ? (uint32_t)((uint64_t)(length >> 20) * receiver.bulk * 10000000 / diffInTicks) : 0, receiver.bulk);
+
+	EMTCore_disconnect(&receiver.core);
+	EMTCore_disconnect(&sender.core);
+	EMTCore_destruct(&receiver.core);
+	EMTCore_destruct(&sender.core);
+
+	::VirtualFree(s_coreMem, 0, MEM_RELEASE);
+	s_coreMem = NULL;
+}
+
+static int test_core_domains()
+{
+	// All in domain 0 is the old single queue, two bulk domains keep two large messages streaming side by side
+	test_core_domain_run("one domain      ", 0, 32 << 20, 2000);
+	test_core_domain_run("bulk apart      ", 1, 32 << 20, 2000);
+	test_core_domain_run("bulk in two     ", 2, 32 << 20, 2000);
+
+	return 0;
+}
+
+/* Bursts of telemetry on lane 1 with a heartbeat in the middle of each, on one lane it waits for half the burst */
+static void test_core_lane_run(const char * name, const uint32_t lanes, const uint32_t * weight)
+{
+	TestCoreDomainSide sender{}, receiver{};
+	EMTCORESINKOPS sinkOps = s_coreSinkOps;
+	const uint32_t rounds = kTestCount / 256;
+
+	// Heartbeats carry the telemetry count of the bursts before theirs, what it grew by since went ahead of them
+	sinkOps.received = [](void * pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+	{
+		TestCoreDomainSide * side = static_cast<TestCoreDomainSide *>((TestCoreSide *)pThis);
+
+		if (uParam1 == 0)
+			side->latency.push_back(side->bulk - uParam0);
+		else
+			++side->bulk;
+
+		test_core_received(pThis, pMem);
+	};
+
+	sender.core.uLanes = lanes;
+	receiver.core.pLaneWeight = weight;
+	EMTCore_construct(&sender.core, &sinkOps, static_cast<TestCoreSide *>(&sender));
+	EMTCore_construct(&receiver.core, &sinkOps, static_cast<TestCoreSide *>(&receiver));
+	EMTCore_connect(&receiver.core, EMTCore_connect(&sender.core, kEMTCoreInvalidConn));
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < rounds; ++i)
+	{
+		for (uint32_t j = 0; j < 256; ++j)
+		{
+			uint8_t * mem = (uint8_t *)EMTCore_alloc(&sender.core, 1024);
+			mem[0] = (uint8_t)j;
+			EMTCore_sendOn(&sender.core, 1, 0, mem, i, 1);
+
+			if (j == 128)
+			{
+				mem = (uint8_t *)EMTCore_alloc(&sender.core, 64);
+				mem[0] = (uint8_t)i;
+				EMTCore_sendOn(&sender.core, 0, 0, mem, i * 256, 0);
+			}
+		}
+		EMTCore_notified(&receiver.core);
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	std::sort(receiver.latency.begin(), receiver.latency.end());
+	printf("%s: telemetry ahead of a heartbeat p50 %3llu, max %3llu, per message: %llu ns (%u)\n", name,
+		receiver.latency[receiver.latency.size() / 2], receiver.latency.back(),
+		diffInTicks * 100 / (rounds * 257), receiver.bulk + (uint32_t)receiver.latency.size());
+
+	EMTCore_disconnect(&receiver.core);
+	EMTCore_disconnect(&sender.core);
+	EMTCore_destruct(&receiver.core);
+	EMTCore_destruct(&sender.core);
+
+	::VirtualFree(s_coreMem, 0, MEM_RELEASE);
+	s_coreMem = NULL;
+}
+
+static int test_core_lanes()
+{
+	// Lane 0 one at a time against 16 of telemetry
+	static const uint32_t weights[] = { 1, 16 };
+
+	test_core_lane_run("one lane", 1, NULL);
+	test_core_lane_run("strict  ", 2, NULL);
+	test_core_lane_run("weighted", 2, weights);
+
+	return 0;
+}
+
+/* A hub server publishing 4KB blocks to every subscriber, against one copy sent to each */
+static void test_core_fanout_run(const uint32_t subscribers, const bool copied)
+{
+	TestCoreSide server = {};
+	std::vector<TestCoreSide> clients(subscribers);
+	const uint32_t rounds = kTestCount / 256;
+	const uint32_t length = 4096;
+
+	EMTCore_construct(&server.core, &s_coreSinkOps, &server);
+	const uint32_t hubId = EMTCore_listen(&server.core);
+	for (uint32_t i = 0; i < subscribers; ++i)
+	{
+		EMTCore_construct(&clients[i].core, &s_coreSinkOps, &clients[i]);
+		EMTCore_join(&clients[i].core, hubId);
+		EMTCore_subscribe(&clients[i].core, 0);
+	}
+
+	::GetSystemTimePreciseAsFileTime(&s_start);
+	for (uint32_t i = 0; i < rounds; ++i)
+	{
+		for (uint32_t j = 0; j < 16; ++j)
+		{
+			uint8_t * mem = (uint8_t *)EMTCore_alloc(&server.core, length);
+			memset(mem, (uint8_t)j, length);
+
+			if (!copied)
+			{
+				EMTCore_publish(&server.core, 0, mem, i, j);
+				continue;
+			}
+
+			for (uint32_t k = 0; k + 1 < subscribers; ++k)
+			{
+				uint8_t * copy = (uint8_t *)EMTCore_alloc(&server.core, length);
+				rt_memcpy(copy, mem, length);
+				EMTCore_sendTo(&server.core, EMTMultiPool_id(&clients[k].core.sMultiPool), copy, i, j);
+			}
+			EMTCore_sendTo(&server.core, EMTMultiPool_id(&clients[subscribers - 1].core.sMultiPool), mem, i, j);
+		}
+
+		for (uint32_t k = 0; k < subscribers; ++k)
+			EMTCore_notified(&clients[k].core);
+	}
+	::GetSystemTimePreciseAsFileTime(&s_end);
+
+	const LONGLONG diffInTicks =
+		reinterpret_cast<const LARGE_INTEGER *>(&s_end)->QuadPart -
+		reinterpret_cast<const LARGE_INTEGER *>(&s_start)->QuadPart;
+
+	uint32_t received = 0;
+	for (uint32_t i = 0; i < subscribers; ++i)
+		received += clients[i].received;
+
+	printf("%2u subscribers %s: per publish %6llu ns, delivered %6llu MB/s (%u)\n", subscribers, copied ? "copied" : "shared",
+		diffInTicks * 100 / (rounds * 16), diffInTicks ? (uint64_t)length * received * 10000000 / diffInTicks >> 20 : 0, received);
+
+	for (uint32_t i = 0; i < subscribers; ++i)
+	{
+		EMTCore_disconnect(&clients[i].core);
+		EMTCore_destruct(&clients[i].core);
+	}
+	EMTCore_destruct(&server.core);
+
+	::VirtualFree(s_coreMem, 0, MEM_RELEASE);
+	s_coreMem = NULL;
+}
+
+static int test_core_fanout()
+{
+	for (uint32_t subscribers = 1; subscribers <= 64; subscribers <<= 1)
+	{
+		test_core_fanout_run(subscribers, false);
+		test_core_fanout_run(subscribers, true);
+	}
+
+	return 0;
+}
+
+template <class Copy>
+static void test_memcpy_run(const char * name, Copy copy, uint8_t * dst, const uint8_t * src, const uint32_t size)
+{
+	const uint32_t rounds = (256 << 20) / size;
+	LARGE_INTEGER frequency, start, end;
+
+	::QueryPerformanceFrequency(&frequency);
+	::QueryPerformanceCounter(&start);
+	for (uint32_t i = 0; i < rounds; ++i)
+		copy(dst, src, size);
+	::QueryPerformanceCounter(&end);
+
+	const LONGLONG ticks = end.QuadPart - start.QuadPart;
+	printf(" %s %6llu MB/s", name, ticks ? (uint64_t)size * rounds * frequency.QuadPart / ticks >> 20 : 0);
+}
+
+/* Copies out of one buffer into another, both faulted in, 256MB moved per size */
+static int test_memcpy()
+{
+	const uint32_t maxSize = 64 << 20;
+	uint8_t * src = (uint8_t *)::VirtualAlloc(NULL, maxSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	uint8_t * dst = (uint8_t *)::VirtualAlloc(NULL, maxSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+	memset(src, 1, maxSize);
+	memset(dst, 2, maxSize);
+
+	for (uint32_t size = 64; size <= maxSize; size <<= 2)
+	{
+		printf("%9u bytes:", size);
+		test_memcpy_run("memcpy", [](uint8_t * d, const uint8_t * s, const uint32_t n) { memcpy(d, s, n); }, dst, src, size);
+		test_memcpy_run("rt_memcpy", [](uint8_t * d, const uint8_t * s, const uint32_t n) { rt_memcpy(d, s, n); }, dst, src, size);
+		printf("\n");
+	}
+
+	::VirtualFree(dst, 0, MEM_RELEASE);
+	::VirtualFree(src, 0, MEM_RELEASE);
+
+	return 0;
+}
+
 int main(int /*argc*/, char* /*argv*/[])
 {
 	return test_pipe();
 	//return test_queue();
 	//return test_semaphore();
 	//return test_pool();
+	//return test_pool_fragment();
+	//return test_multipool_cache();
+	//return test_batch();
+	//return test_multipool_template();
+	//return test_share_memory_warmup();
+	//return test_numa();
+	//return test_core_ring();
+	//return test_core_batch();
+	//return test_core_partial();
+	//return test_core_domains();
+	//return test_core_lanes();
+	//return test_core_fanout();
+	//return test_memcpy();
 }
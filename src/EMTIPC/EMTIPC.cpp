@@ -3,14 +3,21 @@
 #include "EMTIPCPrivate.h"
 
 #include <EMTUtil/EMTThread.h>
+#include <EMTUtil/EMTCopyEngine.h>
 #include <EMTUtil/EMTShareMemory.h>
 
 EMTIPCPrivate::EMTIPCPrivate()
+	: mShareSegment()
+	, mCopyEngine()
 {
 }
 
 EMTIPCPrivate::~EMTIPCPrivate()
 {
+	// Copies still running write into the pools and call back into the core
+	if (mCopyEngine)
+		mCopyEngine->cancel(this);
+
 	EMTCore_destruct(&mCore);
 
 	mShareMemory->destruct();
@@ -22,6 +29,14 @@ void EMTIPCPrivate::init(IEMTThread * pThread, IEMTShareMemory * pShareMemory, I
 	mShareMemory = pShareMemory;
 	mSink = pSink;
 
+	mCore.pPoolConfig = NULL;
+	mCore.uPoolConfigCount = 0;
+	mCore.uAutotune = 0;
+	mCore.uRing = 0;
+	mCore.uSpin = 0;
+	mCore.uPartialWindow = 0;
+	mCore.uLanes = 0;
+	mCore.pLaneWeight = NULL;
 	EMTCore_construct(&mCore, emtCoreSink(), this);
 }
 
@@ -45,6 +60,31 @@ void EMTIPCPrivate::received(EMTIPCPrivate * pThis, void * pMem, const uint64_t
 	pThis->mSink->received(pMem, uParam0, uParam1);
 }
 
+void EMTIPCPrivate::receivedFrom(EMTIPCPrivate * pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	pThis->mSink->receivedFrom(uPeer, pMem, uParam0, uParam1);
+}
+
+void EMTIPCPrivate::receivedBatch(EMTIPCPrivate * pThis, PEMTCOREMESSAGE pMessage, const uint32_t uCount)
+{
+	static_assert(sizeof(EMTIPCMessage) == sizeof(EMTCOREMESSAGE), "EMTIPCMessage mirrors EMTCOREMESSAGE");
+
+	pThis->mSink->receivedBatch(reinterpret_cast<const EMTIPCMessage *>(pMessage), uCount);
+}
+
+uint32_t EMTIPCPrivate::copy(EMTIPCPrivate * pThis, void * pDst, const void * pSrc, const uint32_t uLen, void * pJob)
+{
+	if (pThis->mCopyEngine == NULL)
+		return 0;
+
+	IEMTRunnable * done = createEMTRunnable(std::bind(EMTCore_copied, &pThis->mCore, pJob));
+	if (pThis->mCopyEngine->copy(pDst, pSrc, uLen, pThis->mThread, done, pThis))
+		return 1;
+
+	done->destruct();
+	return 0;
+}
+
 void * EMTIPCPrivate::getShareMemory(EMTIPCPrivate * pThis, uint32_t uLen)
 {
 	return pThis->mShareMemory->open(uLen);
@@ -55,11 +95,39 @@ void EMTIPCPrivate::releaseShareMemory(EMTIPCPrivate * pThis, void * pMem)
 	pThis->mShareMemory->close();
 }
 
+void * EMTIPCPrivate::getShareSegment(EMTIPCPrivate * pThis, const uint32_t uSegment, const uint32_t uLen)
+{
+	IEMTShareMemory * shareMemory = pThis->mShareMemory->segment(uSegment);
+	void * mem = shareMemory->open(uLen);
+
+	if (mem == NULL)
+	{
+		shareMemory->destruct();
+		return NULL;
+	}
+
+	pThis->mShareSegment[uSegment] = shareMemory;
+	return mem;
+}
+
+void EMTIPCPrivate::releaseShareSegment(EMTIPCPrivate * pThis, const uint32_t uSegment, void * pMem)
+{
+	IEMTShareMemory * shareMemory = pThis->mShareSegment[uSegment];
+	pThis->mShareSegment[uSegment] = NULL;
+
+	shareMemory->destruct();
+}
+
 void EMTIPCPrivate::notify(EMTIPCPrivate * pThis)
 {
 	pThis->sys_notify();
 }
 
+void EMTIPCPrivate::notifyPeer(EMTIPCPrivate * pThis, const uint32_t uPeer)
+{
+	pThis->sys_notifyPeer(uPeer);
+}
+
 void EMTIPCPrivate::queue(EMTIPCPrivate * pThis, void * pMem)
 {
 	pThis->mThread->queue(createEMTRunnable(std::bind(EMTCore_queued, &pThis->mCore, pMem)));
@@ -72,10 +140,17 @@ PEMTCORESINKOPS EMTIPCPrivate::emtCoreSink()
 		(void (*)(void * pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1))received,
 		(void * (*)(void * pThis, const uint32_t uLen))getShareMemory,
 		(void (*)(void * pThis, void * pMem))releaseShareMemory,
+		(void * (*)(void * pThis, const uint32_t uSegment, const uint32_t uLen))getShareSegment,
+		(void (*)(void * pThis, const uint32_t uSegment, void * pMem))releaseShareSegment,
 		(void (*)(void * pThis))notify,
 		(void (*)(void * pThis, void * pMem))queue,
 		(void * (*)(void * pThis, const uint32_t uLen))allocSys,
 		(void (*)(void * pThis, void * pMem))freeSys,
+		(void (*)(void * pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1))receivedFrom,
+		(void (*)(void * pThis, const uint32_t uPeer))notifyPeer,
+		(void (*)(void * pThis, PEMTCOREMESSAGE pMessage, const uint32_t uCount))receivedBatch,
+		NULL,
+		(uint32_t (*)(void * pThis, void * pDst, const void * pSrc, const uint32_t uLen, void * pJob))copy,
 	};
 
 	return &sOps;
@@ -142,6 +217,18 @@ uint32_t EMTIPC::length(void * pMem)
 	return EMTCore_length(&d->mCore, pMem);
 }
 
+uint32_t EMTIPC::allocBatch(const uint32_t uLen, void ** ppMem, const uint32_t uCount)
+{
+	EMT_D(EMTIPC);
+	return EMTCore_allocBatch(&d->mCore, uLen, ppMem, uCount);
+}
+
+void EMTIPC::freeBatch(void ** ppMem, const uint32_t uCount)
+{
+	EMT_D(EMTIPC);
+	EMTCore_freeBatch(&d->mCore, ppMem, uCount);
+}
+
 uint32_t EMTIPC::transfer(void * pMem)
 {
 	EMT_D(EMTIPC);
@@ -154,8 +241,57 @@ void * EMTIPC::take(const uint32_t uToken)
 	return EMTCore_take(&d->mCore, uToken);
 }
 
-void EMTIPC::send(void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+void EMTIPC::send(void * pMem, const uint64_t uParam0, const uint64_t uParam1, const uint32_t uLane)
+{
+	EMT_D(EMTIPC);
+	EMTCore_sendOn(&d->mCore, uLane, 0, pMem, uParam0, uParam1);
+}
+
+void EMTIPC::sendIn(const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1, const uint32_t uLane)
+{
+	EMT_D(EMTIPC);
+	EMTCore_sendOn(&d->mCore, uLane, uDomain, pMem, uParam0, uParam1);
+}
+
+void EMTIPC::sendTo(const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	EMT_D(EMTIPC);
+	EMTCore_sendTo(&d->mCore, uPeer, pMem, uParam0, uParam1);
+}
+
+bool EMTIPC::subscribe(const uint32_t uTopic)
+{
+	EMT_D(EMTIPC);
+	return EMTCore_subscribe(&d->mCore, uTopic) != 0;
+}
+
+bool EMTIPC::unsubscribe(const uint32_t uTopic)
+{
+	EMT_D(EMTIPC);
+	return EMTCore_unsubscribe(&d->mCore, uTopic) != 0;
+}
+
+uint32_t EMTIPC::publish(const uint32_t uTopic, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	EMT_D(EMTIPC);
+	return EMTCore_publish(&d->mCore, uTopic, pMem, uParam0, uParam1);
+}
+
+void EMTIPC::setSpin(const uint32_t uSpin)
+{
+	EMT_D(EMTIPC);
+	d->mCore.uSpin = uSpin;
+}
+
+void EMTIPC::setLanes(const uint32_t uLanes, const uint32_t * pLaneWeight)
+{
+	EMT_D(EMTIPC);
+	d->mCore.uLanes = uLanes;
+	d->mCore.pLaneWeight = pLaneWeight;
+}
+
+void EMTIPC::setCopyEngine(IEMTCopyEngine * pCopyEngine)
 {
 	EMT_D(EMTIPC);
-	EMTCore_send(&d->mCore, pMem, uParam0, uParam1);
+	d->mCopyEngine = pCopyEngine;
 }
@@ -10,16 +10,38 @@
 
 #include <EMTCommon.h>
 
+struct EMTIPCMessage
+{
+	void * pMem;
+	uint64_t uParam0;
+	uint64_t uParam1;
+	uint32_t uPeer;
+};
+
 struct DECLSPEC_NOVTABLE IEMTIPCSink : public IEMTUnknown
 {
 	virtual void connected() = 0;
 	virtual void disconnected() = 0;
 
 	virtual void received(void * pMem, const uint64_t uParam0, const uint64_t uParam1) = 0;
+
+	/* Hub servers get each message with the client that sent it, answer it with sendTo */
+	virtual void receivedFrom(const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+	{
+		received(pMem, uParam0, uParam1);
+	}
+
+	/* Bursts arrive here in order, override to take them with one call */
+	virtual void receivedBatch(const EMTIPCMessage * pMessages, const uint32_t uCount)
+	{
+		for (uint32_t i = 0; i < uCount; ++i)
+			received(pMessages[i].pMem, pMessages[i].uParam0, pMessages[i].uParam1);
+	}
 };
 
 struct IEMTThread;
 struct IEMTShareMemory;
+struct IEMTCopyEngine;
 class EMTIPCPrivate;
 class EMTIPC
 {
@@ -41,10 +63,36 @@ public:
 	void free(void * pMem);
 	uint32_t length(void * pMem);
 
+	uint32_t allocBatch(const uint32_t uLen, void ** ppMem, const uint32_t uCount);
+	void freeBatch(void ** ppMem, const uint32_t uCount);
+
 	uint32_t transfer(void * pMem);
 	void * take(const uint32_t uToken);
 
-	void send(void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	// Lane 0 is drained first, the last lane of the connection stands in for any above it
+	void send(void * pMem, const uint64_t uParam0, const uint64_t uParam1, const uint32_t uLane = 0);
+
+	// Ordered only against earlier messages of the same domain, small ones no longer wait behind a large one elsewhere, send is domain 0
+	void sendIn(const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1, const uint32_t uLane = 0);
+
+	// Hub servers only, to one client, a client that is gone gets nothing and the memory is freed
+	void sendTo(const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+
+	// Hub clients, what the server publishes on uTopic comes in like any other message, false for a bad topic or no hub
+	bool subscribe(const uint32_t uTopic);
+	bool unsubscribe(const uint32_t uTopic);
+
+	// Hub servers, every subscriber gets the same pool block and the last free releases it, returns the subscribers reached
+	uint32_t publish(const uint32_t uTopic, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+
+	// Lanes of connections made from here on, pLaneWeight holds descriptors taken from each lane in turn, NULL drains by strict priority, not owned
+	void setLanes(const uint32_t uLanes, const uint32_t * pLaneWeight = NULL);
+
+	// Pauses the receive thread polls for more before it blocks again, pays off when both sides have a core, 0 always blocks
+	void setSpin(const uint32_t uSpin);
+
+	// Large chunk copies of oversized messages run there instead of on the thread, NULL copies inline, not owned
+	void setCopyEngine(IEMTCopyEngine * pCopyEngine);
 
 protected:
 	explicit EMTIPC(EMTIPCPrivate & dd, IEMTThread * pThread, IEMTShareMemory * pShareMemory, IEMTIPCSink * pSink);
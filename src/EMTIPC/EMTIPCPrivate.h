@@ -9,6 +9,7 @@
 
 struct IEMTThread;
 struct IEMTShareMemory;
+struct IEMTCopyEngine;
 struct IEMTIPCSink;
 
 class EMTIPCPrivate
@@ -27,15 +28,22 @@ private: // EMTCORESINKOPS
 	static void received(EMTIPCPrivate * pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
 	static void * getShareMemory(EMTIPCPrivate * pThis, const uint32_t uLen);
 	static void releaseShareMemory(EMTIPCPrivate * pThis, void * pMem);
+	static void * getShareSegment(EMTIPCPrivate * pThis, const uint32_t uSegment, const uint32_t uLen);
+	static void releaseShareSegment(EMTIPCPrivate * pThis, const uint32_t uSegment, void * pMem);
 	static void notify(EMTIPCPrivate * pThis);
 	static void queue(EMTIPCPrivate * pThis, void * pMem);
 	static void * allocSys(EMTIPCPrivate * pThis, const uint32_t uLen);
 	static void freeSys(EMTIPCPrivate * pThis, void * pMem);
+	static void receivedFrom(EMTIPCPrivate * pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	static void notifyPeer(EMTIPCPrivate * pThis, const uint32_t uPeer);
+	static void receivedBatch(EMTIPCPrivate * pThis, PEMTCOREMESSAGE pMessage, const uint32_t uCount);
+	static uint32_t copy(EMTIPCPrivate * pThis, void * pDst, const void * pSrc, const uint32_t uLen, void * pJob);
 
 	static PEMTCORESINKOPS emtCoreSink();
 
 private:
 	void sys_notify();
+	void sys_notifyPeer(const uint32_t uPeer);
 
 protected:
 	friend class EMTIPC;
@@ -43,6 +51,8 @@ protected:
 
 	IEMTThread * mThread;
 	IEMTShareMemory * mShareMemory;
+	IEMTShareMemory * mShareSegment[kEMTMultiPoolSegments];
+	IEMTCopyEngine * mCopyEngine;
 	IEMTIPCSink * mSink;
 	EMTCORE mCore;
 };
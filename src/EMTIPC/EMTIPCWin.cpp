@@ -47,7 +47,27 @@ struct EMTIPCWinPacket_ConnectACK : public EMTIPCWinPacketT<EMTIPCWinPacket_Conn
 {
 	enum { uri = kEMTIPCWinPacket_ConnectACK };
 
+	uint32_t processId;
+	uint64_t eventHandle;
+};
+
+/* A hub has no pipe, its server and clients find each other in a small mapping named after the segment */
+struct EMTIPCWinHubPeer
+{
+	volatile uint32_t peerId; /* written last, 0 for a free slot */
+	uint32_t processId;
+	uint64_t eventHandle;
+};
+
+struct EMTIPCWinHub
+{
+	volatile uint32_t hubId; /* written last by the server */
+	uint32_t processId;
 	uint64_t eventHandle;
+	volatile LONG joins; /* bumped by every join, the server looks for new clients when it moves */
+	uint32_t reserved;
+
+	EMTIPCWinHubPeer peer[kEMTPoolOwnerSlots];
 };
 #pragma pack(pop)
 
@@ -107,6 +127,17 @@ public:
 private:
 	void sys_notified();
 
+	void watchPeer(const uint32_t processId);
+	void unwatchPeer();
+	void peerExited();
+
+	bool openHub();
+	void closeHub();
+	void watchClients();
+	void watchClient(const uint32_t slot, const uint32_t peerId);
+	void unwatchClient(const uint32_t slot);
+	void clientExited(const uint32_t slot);
+
 protected:
 	friend class EMTIPCWin;
 	friend class EMTIPCPrivate;
@@ -118,6 +149,23 @@ protected:
 
 	HANDLE mEventL;
 	HANDLE mEventR;
+
+	IEMTWaitable * mPeerWaitable;
+	HANDLE mPeerProcess;
+
+	std::unique_ptr<IEMTShareMemory, IEMTUnknown_Delete> mHubMemory;
+	EMTIPCWinHub * mHub;
+	bool mHubServer;
+	LONG mHubJoins;
+
+	/* Hub servers, each client by owner slot, watched like the peer of a pipe */
+	struct Client
+	{
+		uint32_t peerId;
+		HANDLE process;
+		HANDLE event;
+		IEMTWaitable * waitable;
+	} mClient[kEMTPoolOwnerSlots];
 };
 
 template <bool SERVER>
@@ -183,6 +231,8 @@ void EMTIPCWinPipe<SERVER>::send(void * buf, const uint32_t len)
 
 EMTIPCWinPrivate::~EMTIPCWinPrivate()
 {
+	unwatchPeer();
+	closeHub();
 	mThread->unregisterWaitable(mEventLWaitable.get());
 	::CloseHandle(mEventL);
 	if (mEventR != INVALID_HANDLE_VALUE)
@@ -194,6 +244,12 @@ void EMTIPCWinPrivate::init(const wchar_t * pName)
 	mName = _wcsdup(pName);
 	mEventL = ::CreateEventW(NULL, FALSE, FALSE, NULL);
 	mEventR = INVALID_HANDLE_VALUE;
+	mPeerWaitable = nullptr;
+	mPeerProcess = NULL;
+	mHub = nullptr;
+	mHubServer = false;
+	mHubJoins = 0;
+	memset(mClient, 0, sizeof(mClient));
 
 	mEventLWaitable.reset(createEMTWaitable(std::bind(&EMTIPCWinPrivate::sys_notified, this), mEventL));
 	mThread->registerWaitable(mEventLWaitable.get());
@@ -248,10 +304,12 @@ void EMTIPCWinPrivate::received(void * buf, const uint32_t len)
 		::DuplicateHandle(procL, mEventL, procR, &eventL2R, EVENT_MODIFY_STATE, FALSE, 0);
 		::CloseHandle(procR);
 
+		np->processId = ::GetCurrentProcessId();
 		np->eventHandle = (uintptr_t)eventL2R;
 		mPipe->send(np, sizeof(*np));
 
 		EMTCore_connect(&mCore, p->connId);
+		watchPeer(p->processId);
 
 		connected();
 		break;
@@ -260,6 +318,7 @@ void EMTIPCWinPrivate::received(void * buf, const uint32_t len)
 	{
 		EMTIPCWinPacket_ConnectACK * p = (EMTIPCWinPacket_ConnectACK *)buf;
 		mEventR = (HANDLE)p->eventHandle;
+		watchPeer(p->processId);
 
 		connected();
 		break;
@@ -269,9 +328,143 @@ void EMTIPCWinPrivate::received(void * buf, const uint32_t len)
 
 void EMTIPCWinPrivate::sys_notified()
 {
+	// Clients wake the server once they joined
+	if (mHubServer && mHub->joins != mHubJoins)
+		watchClients();
+
 	notified();
 }
 
+void EMTIPCWinPrivate::watchPeer(const uint32_t processId)
+{
+	unwatchPeer();
+
+	mPeerProcess = ::OpenProcess(SYNCHRONIZE, FALSE, processId);
+	if (mPeerProcess == NULL)
+		return;
+
+	// One shot, the thread drops it once the process handle is signaled
+	mPeerWaitable = createEMTWaitable(std::bind(&EMTIPCWinPrivate::peerExited, this), mPeerProcess, true);
+	mThread->registerWaitable(mPeerWaitable);
+}
+
+void EMTIPCWinPrivate::unwatchPeer()
+{
+	if (mPeerWaitable)
+	{
+		mThread->unregisterWaitable(mPeerWaitable);
+		mPeerWaitable->destruct();
+		mPeerWaitable = nullptr;
+	}
+
+	if (mPeerProcess != NULL)
+	{
+		::CloseHandle(mPeerProcess);
+		mPeerProcess = NULL;
+	}
+}
+
+void EMTIPCWinPrivate::peerExited()
+{
+	// Whatever the peer still held in the shared pools is ours to give back now
+	EMTCore_reclaim(&mCore);
+
+	mPeerWaitable = nullptr;
+	::CloseHandle(mPeerProcess);
+	mPeerProcess = NULL;
+}
+
+bool EMTIPCWinPrivate::openHub()
+{
+	wchar_t name[MAX_PATH];
+	swprintf_s(name, L"%s.hub", mName);
+
+	mHubMemory.reset(createEMTShareMemory(name));
+	mHub = (EMTIPCWinHub *)mHubMemory->open(sizeof(EMTIPCWinHub));
+	if (mHub == NULL)
+		mHubMemory.reset();
+
+	return mHub != NULL;
+}
+
+void EMTIPCWinPrivate::closeHub()
+{
+	for (uint32_t slot = 0; slot < kEMTPoolOwnerSlots; ++slot)
+		unwatchClient(slot);
+
+	// Clients that come later find no server
+	if (mHubServer)
+		::InterlockedExchange((volatile LONG *)&mHub->hubId, 0);
+
+	mHubMemory.reset();
+	mHub = nullptr;
+	mHubServer = false;
+}
+
+void EMTIPCWinPrivate::watchClients()
+{
+	mHubJoins = mHub->joins;
+
+	for (uint32_t slot = 1; slot < kEMTPoolOwnerSlots; ++slot)
+	{
+		const uint32_t peerId = mHub->peer[slot].peerId;
+		if (peerId != 0 && peerId != mClient[slot].peerId)
+			watchClient(slot, peerId);
+	}
+}
+
+void EMTIPCWinPrivate::watchClient(const uint32_t slot, const uint32_t peerId)
+{
+	Client & client = mClient[slot];
+	unwatchClient(slot);
+
+	// A client that is already gone is reclaimed right away
+	client.process = ::OpenProcess(SYNCHRONIZE | PROCESS_DUP_HANDLE, FALSE, mHub->peer[slot].processId);
+	if (client.process == NULL)
+	{
+		EMTCore_reclaimPeer(&mCore, peerId);
+		::InterlockedCompareExchange((volatile LONG *)&mHub->peer[slot].peerId, 0, peerId);
+		return;
+	}
+
+	::DuplicateHandle(client.process, (HANDLE)mHub->peer[slot].eventHandle, ::GetCurrentProcess(), &client.event, EVENT_MODIFY_STATE, FALSE, 0);
+	client.peerId = peerId;
+
+	// One shot, the thread drops it once the process handle is signaled
+	client.waitable = createEMTWaitable(std::bind(&EMTIPCWinPrivate::clientExited, this, slot), client.process, true);
+	mThread->registerWaitable(client.waitable);
+}
+
+void EMTIPCWinPrivate::unwatchClient(const uint32_t slot)
+{
+	Client & client = mClient[slot];
+
+	if (client.waitable)
+	{
+		mThread->unregisterWaitable(client.waitable);
+		client.waitable->destruct();
+	}
+
+	if (client.event != NULL)
+		::CloseHandle(client.event);
+	if (client.process != NULL)
+		::CloseHandle(client.process);
+
+	memset(&client, 0, sizeof(client));
+}
+
+void EMTIPCWinPrivate::clientExited(const uint32_t slot)
+{
+	Client & client = mClient[slot];
+
+	// Whatever the client still held, read or had queued is ours to give back now
+	EMTCore_reclaimPeer(&mCore, client.peerId);
+	::InterlockedCompareExchange((volatile LONG *)&mHub->peer[slot].peerId, 0, client.peerId);
+
+	client.waitable = nullptr;
+	unwatchClient(slot);
+}
+
 void * EMTIPCPrivate::allocSys(EMTIPCPrivate * pThis, const uint32_t uLen)
 {
 	return ::malloc(uLen);
@@ -289,8 +482,21 @@ void EMTIPCPrivate::sys_notify()
 	::SetEvent(sys->mEventR);
 }
 
-EMTIPCWin::EMTIPCWin(const wchar_t * pName, IEMTThread * pThread, IEMTIPCSink * pSink)
-	: EMTIPC(*new EMTIPCWinPrivate, pThread, createEMTShareMemory(pName), pSink)
+void EMTIPCPrivate::sys_notifyPeer(const uint32_t uPeer)
+{
+	EMTIPCWinPrivate * sys = (EMTIPCWinPrivate *)this;
+	const uint32_t slot = uPeer & kEMTPoolOwnerSlotMask;
+
+	// A client may talk before the server saw its join
+	if (sys->mClient[slot].peerId != uPeer)
+		sys->watchClients();
+
+	if (sys->mClient[slot].peerId == uPeer)
+		::SetEvent(sys->mClient[slot].event);
+}
+
+EMTIPCWin::EMTIPCWin(const wchar_t * pName, IEMTThread * pThread, IEMTIPCSink * pSink, const uint32_t uShareMemoryOptions)
+	: EMTIPC(*new EMTIPCWinPrivate, pThread, createEMTShareMemory(pName, uShareMemoryOptions), pSink)
 {
 	EMT_D(EMTIPCWin);
 
@@ -306,7 +512,7 @@ bool EMTIPCWin::connect(bool isServer)
 {
 	EMT_D(EMTIPCWin);
 
-	if (d->mPipe)
+	if (d->mPipe || d->mHub)
 		return false;
 
 	std::unique_ptr<IEMTIPCWinPipe> pipeHandler(isServer ? (IEMTIPCWinPipe *)new EMTIPCWinPipe<true>(d) : new EMTIPCWinPipe<false>(d));
@@ -322,8 +528,78 @@ void EMTIPCWin::disconnect()
 {
 	EMT_D(EMTIPCWin);
 
+	if (d->mHub)
+	{
+		d->disconnect();
+		d->closeHub();
+		return;
+	}
+
 	if (!d->mPipe)
 		return;
 
 	d->mPipe->disconnect();
 }
+
+bool EMTIPCWin::listen()
+{
+	EMT_D(EMTIPCWin);
+
+	if (d->mPipe || d->mHub || !d->openHub())
+		return false;
+
+	const uint32_t hubId = EMTCore_listen(&d->mCore);
+	if (hubId == kInvalidConn)
+	{
+		d->closeHub();
+		return false;
+	}
+
+	// Clients only look at the rest once the id is there
+	EMTIPCWinHub * hub = d->mHub;
+	hub->hubId = 0;
+	memset(hub->peer, 0, sizeof(hub->peer));
+	hub->processId = ::GetCurrentProcessId();
+	hub->eventHandle = (uintptr_t)d->mEventL;
+	d->mHubJoins = hub->joins;
+	d->mHubServer = true;
+	::InterlockedExchange((volatile LONG *)&hub->hubId, (LONG)hubId);
+
+	d->connected();
+	return true;
+}
+
+bool EMTIPCWin::join()
+{
+	EMT_D(EMTIPCWin);
+
+	if (d->mPipe || d->mHub || !d->openHub())
+		return false;
+
+	EMTIPCWinHub * hub = d->mHub;
+	const uint32_t hubId = hub->hubId;
+
+	HANDLE procR = hubId != 0 ? ::OpenProcess(PROCESS_DUP_HANDLE, FALSE, hub->processId) : NULL;
+	if (procR == NULL || !::DuplicateHandle(procR, (HANDLE)hub->eventHandle, ::GetCurrentProcess(), &d->mEventR, EVENT_MODIFY_STATE, FALSE, 0)
+		|| EMTCore_join(&d->mCore, hubId) == kInvalidConn)
+	{
+		if (procR != NULL)
+			::CloseHandle(procR);
+		d->mEventR = INVALID_HANDLE_VALUE;
+		d->closeHub();
+		return false;
+	}
+
+	::CloseHandle(procR);
+
+	// The id goes in last, the server watches the process and signals the event from then on
+	EMTIPCWinHubPeer & peer = hub->peer[EMTMultiPool_id(&d->mCore.sMultiPool) & kEMTPoolOwnerSlotMask];
+	peer.processId = ::GetCurrentProcessId();
+	peer.eventHandle = (uintptr_t)d->mEventL;
+	::InterlockedExchange((volatile LONG *)&peer.peerId, (LONG)EMTMultiPool_id(&d->mCore.sMultiPool));
+	::InterlockedIncrement(&hub->joins);
+	::SetEvent(d->mEventR);
+
+	d->connected();
+	return true;
+}
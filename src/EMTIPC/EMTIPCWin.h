@@ -11,12 +11,16 @@ class EMTIPCWinPrivate;
 class EMTIPCWin : public EMTIPC
 {
 public:
-	explicit EMTIPCWin(const wchar_t * pName, IEMTThread * pThread, IEMTIPCSink * pSink);
+	explicit EMTIPCWin(const wchar_t * pName, IEMTThread * pThread, IEMTIPCSink * pSink, const uint32_t uShareMemoryOptions = 0);
 	virtual ~EMTIPCWin();
 
 	bool connect(bool isServer);
 	void disconnect();
 
+	// A hub in place of connect, one server and many clients on the same name, the server answers each with sendTo
+	bool listen();
+	bool join();
+
 private:
 	friend class EMTIPCWinPrivate;
 };
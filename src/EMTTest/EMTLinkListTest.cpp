@@ -0,0 +1,122 @@
+#include "stable.h"
+#include "CppUnitTest.h"
+
+#include <EMTUtil/EMTLinkList.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace EMTTest
+{
+	/*
+	 * Few nodes and many threads popping and pushing them back, so a head keeps
+	 * coming back to the same node while other threads hold stale reads of it.
+	 * A node taken twice at once trips its busy flag.
+	 */
+	enum { kNodeCount = 4, kThreadCount = 8, kRoundCount = 1000000 };
+
+	struct Node
+	{
+		EMTLINKLISTNODE sNext;
+		std::atomic<uint32_t> uBusy;
+	};
+
+	struct Node2
+	{
+		EMTLINKLISTNODE2 sNext;
+		std::atomic<uint32_t> uBusy;
+	};
+
+	/* Offsets are relative, keep the head and the nodes together */
+	struct alignas(8) OffsetList
+	{
+		EMTLINKLISTHEAD sHead;
+		Node sNode[kNodeCount];
+	};
+
+	template <class Round>
+	static void runThreads(Round round)
+	{
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < kThreadCount; ++i)
+			threads.emplace_back([&round]() { for (uint32_t j = 0; j < kRoundCount; ++j) round(); });
+
+		for (auto & thread : threads)
+			thread.join();
+	}
+
+	TEST_CLASS(EMTLinkListTest)
+	{
+	public:
+
+		TEST_METHOD(TakeFirstPrependStress)
+		{
+			OffsetList list;
+			std::atomic<uint32_t> uTwice(0);
+
+			EMTLinkList_initHead(&list.sHead);
+			for (uint32_t i = 0; i < kNodeCount; ++i)
+			{
+				list.sNode[i].uBusy = 0;
+				EMTLinkList_prepend(&list.sHead, &list.sNode[i].sNext);
+			}
+
+			runThreads([&]()
+			{
+				Node * node = (Node *)EMTLinkList_takeFirst(&list.sHead);
+				if (node == 0)
+					return;
+
+				if (node->uBusy.exchange(1) != 0)
+					++uTwice;
+				node->uBusy = 0;
+				EMTLinkList_prepend(&list.sHead, &node->sNext);
+			});
+
+			uint32_t uLeft = 0;
+			while (EMTLinkList_takeFirst(&list.sHead))
+				++uLeft;
+
+			Assert::AreEqual(0u, uTwice.load());
+			Assert::AreEqual((uint32_t)kNodeCount, uLeft);
+		}
+
+		TEST_METHOD(TakeFirstPrependStress2)
+		{
+			EMTLINKLISTHEAD2 head;
+			Node2 nodes[kNodeCount];
+			std::atomic<uint32_t> uTwice(0);
+
+			EMTLinkList2_initHead(&head);
+			for (uint32_t i = 0; i < kNodeCount; ++i)
+			{
+				nodes[i].uBusy = 0;
+				EMTLinkList2_prepend(&head, &nodes[i].sNext);
+			}
+
+			runThreads([&]()
+			{
+				Node2 * node = (Node2 *)EMTLinkList2_takeFirst(&head);
+				if (node == 0)
+					return;
+
+				if (node->uBusy.exchange(1) != 0)
+					++uTwice;
+				node->uBusy = 0;
+				EMTLinkList2_prepend(&head, &node->sNext);
+			});
+
+			uint32_t uLeft = 0;
+			while (EMTLinkList2_takeFirst(&head))
+				++uLeft;
+
+			Assert::AreEqual(0u, uTwice.load());
+			Assert::AreEqual((uint32_t)kNodeCount, uLeft);
+		}
+
+	};
+}
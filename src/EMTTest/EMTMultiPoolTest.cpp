@@ -0,0 +1,131 @@
+#include "stable.h"
+#include "CppUnitTest.h"
+
+#include <EMTUtil/EMTMultiPool.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace EMTTest
+{
+	TEST_CLASS(EMTMultiPoolTest)
+	{
+		enum { kBlockCount = 16, kBlockLength = 64 };
+
+		struct MultiPool
+		{
+			EMTMULTIPOOL sPool;
+			EMTMULTIPOOLCONFIG sConfig[1];
+		};
+
+		/* Every peer gets the same buffer for the same index, as with a named mapping */
+		static void * segmentOpen(void * pCtx, const uint32_t uSegment, const uint32_t uLen)
+		{
+			std::vector<uint8_t> & mem = (*(std::vector<std::vector<uint8_t>> *)pCtx)[uSegment];
+
+			if (mem.empty())
+				mem.resize(uLen);
+
+			return mem.data();
+		}
+
+		static void segmentClose(void * pCtx, const uint32_t uSegment, void * pMem)
+		{
+		}
+
+		static void setUp(MultiPool & pool, const EMTMULTIPOOLSEGMENTOPS * pSegmentOps, void * pSegmentCtx)
+		{
+			pool.sConfig[0].uBlockLength = kBlockLength;
+			pool.sConfig[0].uBlockCount = kBlockCount;
+			pool.sConfig[0].uBlockLimit = 1;
+			pool.sConfig[0].uPoolMode = kEMTPoolModeBitmap;
+			pool.sPool.uPoolCount = 1;
+			pool.sPool.pSegmentOps = pSegmentOps;
+			pool.sPool.pSegmentCtx = pSegmentCtx;
+		}
+
+	public:
+
+		/*
+		 * One peer grows a segment and hands a block in it to the other, which
+		 * maps the segment on its first take. The block must still be the
+		 * taker's afterwards, not back on the free list.
+		 */
+		TEST_METHOD(TakeFromGrownSegment)
+		{
+			static const EMTMULTIPOOLSEGMENTOPS sSegmentOps = { segmentOpen, segmentClose };
+			std::vector<std::vector<uint8_t>> segments(kEMTMultiPoolSegments);
+			MultiPool pools[2] = {};
+
+			setUp(pools[0], &sSegmentOps, &segments);
+			setUp(pools[1], &sSegmentOps, &segments);
+
+			uint32_t uMetaLen, uMemLen;
+			EMTMultiPool_calcMetaSize(&pools[0].sPool, &uMetaLen, &uMemLen);
+
+			std::vector<uint8_t> mem(uMetaLen + uMemLen);
+			Assert::AreNotEqual(0u, EMTMultiPool_construct(&pools[0].sPool, mem.data(), mem.data() + uMetaLen));
+			Assert::AreNotEqual(0u, EMTMultiPool_construct(&pools[1].sPool, mem.data(), mem.data() + uMetaLen));
+
+			// The class runs dry and the next allocation comes from a new segment
+			std::vector<void *> held(kBlockCount + 1);
+			Assert::AreEqual((uint32_t)held.size(), EMTMultiPool_allocBatch(&pools[0].sPool, kBlockLength, held.data(), (uint32_t)held.size()));
+
+			void * pMem = held.back();
+			held.pop_back();
+
+			const uint32_t uToken = EMTMultiPool_transfer(&pools[0].sPool, pMem, EMTMultiPool_id(&pools[1].sPool));
+			Assert::AreEqual(1u, uToken >> kEMTMultiPoolPoolIdShift);
+			Assert::IsTrue(EMTMultiPool_take(&pools[1].sPool, uToken) == pMem);
+
+			std::vector<void *> rest(kBlockCount);
+			const uint32_t uRest = EMTMultiPool_allocBatch(&pools[0].sPool, kBlockLength, rest.data(), (uint32_t)rest.size());
+			Assert::IsTrue(std::find(rest.begin(), rest.begin() + uRest, pMem) == rest.begin() + uRest);
+
+			EMTMultiPool_free(&pools[1].sPool, pMem);
+			EMTMultiPool_freeBatch(&pools[0].sPool, rest.data(), uRest);
+			EMTMultiPool_freeBatch(&pools[0].sPool, held.data(), (uint32_t)held.size());
+
+			EMTMultiPool_destruct(&pools[1].sPool);
+			EMTMultiPool_destruct(&pools[0].sPool);
+		}
+
+		/*
+		 * A block sent to a peer that was reclaimed meanwhile has no live owner.
+		 * The next process to get the peer's slot frees it when it constructs.
+		 */
+		TEST_METHOD(RestartFreesStaleTransfers)
+		{
+			MultiPool pools[3] = {};
+
+			setUp(pools[0], 0, 0);
+			setUp(pools[1], 0, 0);
+			setUp(pools[2], 0, 0);
+
+			uint32_t uMetaLen, uMemLen;
+			EMTMultiPool_calcMetaSize(&pools[0].sPool, &uMetaLen, &uMemLen);
+
+			std::vector<uint8_t> mem(uMetaLen + uMemLen);
+			EMTMultiPool_construct(&pools[0].sPool, mem.data(), mem.data() + uMetaLen);
+			const uint32_t uDeadId = EMTMultiPool_construct(&pools[1].sPool, mem.data(), mem.data() + uMetaLen);
+
+			void * pMem = EMTMultiPool_alloc(&pools[0].sPool, kBlockLength);
+			Assert::AreEqual(1u, EMTMultiPool_reclaim(&pools[0].sPool, uDeadId));
+			EMTMultiPool_transfer(&pools[0].sPool, pMem, uDeadId);
+
+			const uint32_t uId = EMTMultiPool_construct(&pools[2].sPool, mem.data(), mem.data() + uMetaLen);
+			Assert::AreNotEqual(uDeadId, uId);
+			Assert::AreEqual(uDeadId & kEMTPoolOwnerSlotMask, uId & kEMTPoolOwnerSlotMask);
+
+			std::vector<void *> all(kBlockCount);
+			Assert::AreEqual((uint32_t)kBlockCount, EMTMultiPool_allocBatch(&pools[0].sPool, kBlockLength, all.data(), kBlockCount));
+
+			EMTMultiPool_freeBatch(&pools[0].sPool, all.data(), kBlockCount);
+			EMTMultiPool_destruct(&pools[2].sPool);
+			EMTMultiPool_destruct(&pools[0].sPool);
+		}
+
+	};
+}
@@ -0,0 +1,115 @@
+#include "stable.h"
+#include "CppUnitTest.h"
+
+#include <EMTUtil/EMTPool.h>
+
+#include <atomic>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace EMTTest
+{
+	TEST_CLASS(EMTPoolTest)
+	{
+	public:
+
+		/*
+		 * Two owners share one scan-mode pool with a handful of blocks, so the
+		 * cursor keeps wrapping back to blocks other threads just freed.
+		 */
+		TEST_METHOD(ScanCursorStress)
+		{
+			enum { kBlockCount = 64, kBlockLength = 64, kThreadCount = 8, kRoundCount = 250000 };
+
+			uint32_t uMetaLen, uMemLen;
+			EMTPool_calcMetaSize(kBlockCount, kBlockLength, &uMetaLen, &uMemLen);
+
+			std::vector<uint8_t> mem(uMetaLen + uMemLen);
+			EMTPOOL pools[2] = {};
+			std::atomic<uint32_t> uBad(0);
+
+			pools[0].uMode = kEMTPoolModeScan;
+			pools[1].uMode = kEMTPoolModeScan;
+			EMTPool_construct(&pools[0], 1, kBlockCount, kBlockLength, 1, mem.data(), mem.data() + uMetaLen);
+			EMTPool_construct(&pools[1], 2, kBlockCount, kBlockLength, 1, mem.data(), mem.data() + uMetaLen);
+
+			std::vector<std::thread> threads;
+			for (uint32_t i = 0; i < kThreadCount; ++i)
+			{
+				threads.emplace_back([&, i]()
+				{
+					EMTPOOL pool = pools[i & 1];
+					const uint8_t uFill = (uint8_t)(i + 1);
+
+					for (uint32_t j = 0; j < kRoundCount; ++j)
+					{
+						uint8_t * pMem = (uint8_t *)EMTPool_alloc(&pool, kBlockLength);
+						if (pMem == 0)
+							continue;
+
+						memset(pMem, uFill, kBlockLength);
+						for (uint32_t k = 0; k < kBlockLength; ++k)
+						{
+							if (pMem[k] != uFill)
+							{
+								++uBad;
+								break;
+							}
+						}
+						EMTPool_free(&pool, pMem);
+					}
+				});
+			}
+
+			for (auto & thread : threads)
+				thread.join();
+
+			Assert::AreEqual(0u, uBad.load());
+		}
+
+		/*
+		 * A block shared with three readers: a second free by the same reader and
+		 * a free by the owner are refused, and reclaiming the readers that died
+		 * holding it releases the block.
+		 */
+		TEST_METHOD(ShareReaders)
+		{
+			enum { kBlockCount = 64, kBlockLength = 64 };
+
+			uint32_t uMetaLen, uMemLen;
+			EMTPool_calcMetaSize(kBlockCount, kBlockLength, &uMetaLen, &uMemLen);
+
+			std::vector<uint8_t> mem(uMetaLen + uMemLen);
+			const uint32_t uReaders[] = { 2, 3, 4 };
+			EMTPOOL pools[2] = {};
+
+			pools[0].uMode = kEMTPoolModeBitmap;
+			pools[1].uMode = kEMTPoolModeBitmap;
+			EMTPool_construct(&pools[0], 1, kBlockCount, kBlockLength, 1, mem.data(), mem.data() + uMetaLen);
+			EMTPool_construct(&pools[1], 2, kBlockCount, kBlockLength, 1, mem.data(), mem.data() + uMetaLen);
+
+			void * pMem = EMTPool_alloc(&pools[0], kBlockLength);
+			Assert::AreEqual(3u, EMTPool_share(&pools[0], pMem, uReaders, 3));
+			Assert::AreEqual(0u, EMTPool_share(&pools[0], pMem, uReaders, 3));
+
+			EMTPool_free(&pools[1], pMem);
+			EMTPool_free(&pools[1], pMem);
+			EMTPool_free(&pools[0], pMem);
+			Assert::AreEqual(2u, EMTPool_readers(&pools[0], pMem));
+
+			EMTPool_reclaim(&pools[0], 3);
+			EMTPool_reclaim(&pools[0], 4);
+			Assert::AreEqual(0u, EMTPool_readers(&pools[0], pMem));
+
+			uint32_t uFree = 0;
+			while (EMTPool_alloc(&pools[0], kBlockLength))
+				++uFree;
+
+			Assert::AreEqual((uint32_t)kBlockCount, uFree);
+		}
+
+	};
+}
@@ -0,0 +1,237 @@
+#include "stable.h"
+
+#include "EMTCopyEngine.h"
+
+#include "EMTThread.h"
+
+#include <EMTUtil/EMTCore.h>
+
+#include <Windows.h>
+
+#include <deque>
+#include <vector>
+
+BEGIN_NAMESPACE_ANONYMOUS
+
+enum
+{
+	/* Piece boundaries fall on cache lines, two workers never write one line */
+	kEMTCopyEnginePieceAlign = 64,
+};
+
+class EMTCopyEngine : public IEMTCopyEngine
+{
+	EMTIMPL_IEMTUNKNOWN;
+
+	struct Job
+	{
+		uint8_t * dst;
+		const uint8_t * src;
+		uint32_t pending;
+		bool cancelled;
+		const void * owner;
+		IEMTThread * thread;
+		IEMTRunnable * done;
+	};
+
+	struct Piece
+	{
+		Job * job;
+		uint32_t offset;
+		uint32_t len;
+	};
+
+public:
+	explicit EMTCopyEngine(const uint32_t threadCount, const uint32_t pieceLength);
+	virtual ~EMTCopyEngine();
+
+protected: // IEMTCopyEngine
+	virtual bool copy(void * dst, const void * src, const uint32_t len, IEMTThread * thread, IEMTRunnable * done, const void * owner);
+	virtual void cancel(const void * owner);
+
+private:
+	void work();
+	void finish(Job * job);
+	bool busy(const void * owner) const;
+
+	static DWORD WINAPI work_entry(LPVOID lpParameter);
+
+private:
+	SRWLOCK mLock;
+	CONDITION_VARIABLE mReady;
+	CONDITION_VARIABLE mIdle;
+	std::deque<Piece> mPieces;
+	std::vector<Job *> mJobs;
+	bool mExit;
+
+	const uint32_t mPieceLength;
+	std::vector<HANDLE> mThreads;
+};
+
+EMTCopyEngine::EMTCopyEngine(const uint32_t threadCount, const uint32_t pieceLength)
+	: mExit(false)
+	, mPieceLength(pieceLength ? pieceLength : kEMTCopyEnginePieceLength)
+{
+	::InitializeSRWLock(&mLock);
+	::InitializeConditionVariable(&mReady);
+	::InitializeConditionVariable(&mIdle);
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		HANDLE thread = ::CreateThread(NULL, 0, EMTCopyEngine::work_entry, this, 0, NULL);
+		if (thread != NULL)
+			mThreads.push_back(thread);
+	}
+}
+
+EMTCopyEngine::~EMTCopyEngine()
+{
+	::AcquireSRWLockExclusive(&mLock);
+	mExit = true;
+	::ReleaseSRWLockExclusive(&mLock);
+	::WakeAllConditionVariable(&mReady);
+
+	// Workers finish what was handed out, so every done runnable still gets queued
+	for (size_t i = 0; i < mThreads.size(); ++i)
+	{
+		::WaitForSingleObject(mThreads[i], INFINITE);
+		::CloseHandle(mThreads[i]);
+	}
+}
+
+bool EMTCopyEngine::copy(void * dst, const void * src, const uint32_t len, IEMTThread * thread, IEMTRunnable * done, const void * owner)
+{
+	if (mThreads.empty() || len < mPieceLength)
+		return false;
+
+	// As many pieces as there are workers, none shorter than a piece length
+	const uint32_t count = len / mPieceLength < mThreads.size() ? len / mPieceLength : (uint32_t)mThreads.size();
+	const uint32_t pieceLen = (len / count + kEMTCopyEnginePieceAlign - 1) & ~(uint32_t)(kEMTCopyEnginePieceAlign - 1);
+
+	Job * job = new Job;
+	job->dst = (uint8_t *)dst;
+	job->src = (const uint8_t *)src;
+	job->pending = count;
+	job->cancelled = false;
+	job->owner = owner;
+	job->thread = thread;
+	job->done = done;
+
+	::AcquireSRWLockExclusive(&mLock);
+	mJobs.push_back(job);
+	for (uint32_t i = 0, offset = 0; i < count; ++i, offset += pieceLen)
+	{
+		const Piece piece = { job, offset, i + 1 == count ? len - offset : pieceLen };
+		mPieces.push_back(piece);
+	}
+	::ReleaseSRWLockExclusive(&mLock);
+
+	if (count == 1)
+		::WakeConditionVariable(&mReady);
+	else
+		::WakeAllConditionVariable(&mReady);
+
+	return true;
+}
+
+void EMTCopyEngine::cancel(const void * owner)
+{
+	::AcquireSRWLockExclusive(&mLock);
+	for (std::deque<Piece>::iterator it = mPieces.begin(); it != mPieces.end(); )
+	{
+		if (it->job->owner != owner)
+		{
+			++it;
+			continue;
+		}
+
+		Job * job = it->job;
+		it = mPieces.erase(it);
+
+		job->cancelled = true;
+		if (--job->pending == 0)
+			finish(job);
+	}
+
+	// Pieces a worker already took are copied out, the last of them drops done
+	while (busy(owner))
+		::SleepConditionVariableSRW(&mIdle, &mLock, INFINITE, 0);
+	::ReleaseSRWLockExclusive(&mLock);
+}
+
+/* Called under the lock once no piece of the job is left, so cancel never returns with done still to be queued */
+void EMTCopyEngine::finish(Job * job)
+{
+	for (size_t i = 0; i < mJobs.size(); ++i)
+	{
+		if (mJobs[i] == job)
+		{
+			mJobs[i] = mJobs.back();
+			mJobs.pop_back();
+			break;
+		}
+	}
+
+	if (job->cancelled)
+		job->done->destruct();
+	else
+		job->thread->queue(job->done);
+
+	delete job;
+	::WakeAllConditionVariable(&mIdle);
+}
+
+bool EMTCopyEngine::busy(const void * owner) const
+{
+	for (size_t i = 0; i < mJobs.size(); ++i)
+	{
+		if (mJobs[i]->owner == owner)
+			return true;
+	}
+
+	return false;
+}
+
+void EMTCopyEngine::work()
+{
+	for (;;)
+	{
+		::AcquireSRWLockExclusive(&mLock);
+		while (mPieces.empty() && !mExit)
+			::SleepConditionVariableSRW(&mReady, &mLock, INFINITE, 0);
+
+		if (mPieces.empty())
+		{
+			::ReleaseSRWLockExclusive(&mLock);
+			return;
+		}
+
+		const Piece piece = mPieces.front();
+		mPieces.pop_front();
+		::ReleaseSRWLockExclusive(&mLock);
+
+		rt_memcpy(piece.job->dst + piece.offset, piece.job->src + piece.offset, piece.len);
+
+		// The last piece hands the job back to the thread that owns it
+		::AcquireSRWLockExclusive(&mLock);
+		if (--piece.job->pending == 0)
+			finish(piece.job);
+		::ReleaseSRWLockExclusive(&mLock);
+	}
+}
+
+DWORD EMTCopyEngine::work_entry(LPVOID lpParameter)
+{
+	static_cast<EMTCopyEngine *>(lpParameter)->work();
+	return 0;
+}
+
+END_NAMESPACE_ANONYMOUS
+
+IEMTCopyEngine * createEMTCopyEngine(const uint32_t threadCount, const uint32_t pieceLength)
+{
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+
+	return new EMTCopyEngine(threadCount ? threadCount : info.dwNumberOfProcessors, pieceLength);
+}
@@ -0,0 +1,30 @@
+/*
+ * EMT - Enhanced Memory Transfer (not emiria-tan)
+ */
+
+#ifndef __EMTCOPYENGINE_H__
+#define __EMTCOPYENGINE_H__
+
+#include <EMTCommon.h>
+
+enum
+{
+	/* Copies are cut into pieces of at least this, shorter ones stay with the caller */
+	kEMTCopyEnginePieceLength = 256 * 1024,
+};
+
+struct IEMTThread;
+struct IEMTRunnable;
+
+struct DECLSPEC_NOVTABLE IEMTCopyEngine : public IEMTUnknown
+{
+	/* Splits the copy over the workers and queues done on thread after the last piece, false leaves the copy to the caller */
+	virtual bool copy(void * dst, const void * src, const uint32_t len, IEMTThread * thread, IEMTRunnable * done, const void * owner) = 0;
+	/* Drops the owner's pieces not started yet and waits for the rest, none of its done runnables is queued afterwards */
+	virtual void cancel(const void * owner) = 0;
+};
+
+/* threadCount 0 starts one worker per processor */
+IEMTCopyEngine * createEMTCopyEngine(const uint32_t threadCount = 0, const uint32_t pieceLength = kEMTCopyEnginePieceLength);
+
+#endif // __EMTCOPYENGINE_H__
@@ -3,17 +3,90 @@
 #include "EMTLinkList.h"
 
 typedef struct _EMTCOREPARTIALMETA EMTCOREPARTIALMETA, * PEMTCOREPARTIALMETA;
+typedef struct _EMTCOREDIRMETA EMTCOREDIRMETA, * PEMTCOREDIRMETA;
+typedef struct _EMTCORECLASSMETA EMTCORECLASSMETA, * PEMTCORECLASSMETA;
+typedef struct _EMTCORERINGSLOT EMTCORERINGSLOT, * PEMTCORERINGSLOT;
+typedef struct _EMTCOREHUBPEERMETA EMTCOREHUBPEERMETA, * PEMTCOREHUBPEERMETA;
 
 #pragma pack(push, 1)
+struct _EMTCORECLASSMETA
+{
+	uint32_t uBlockLength;
+	uint32_t uBlockCount;
+	uint32_t uBlockLimit;
+	uint32_t uPoolMode;
+};
+
 struct _EMTCOREMETA
 {
-	uint32_t dummy;
+	// Older layouts kept the multi pool id counter here, so they never match
+	uint32_t uReserved0;
+	volatile uint32_t uVersion;
+	uint32_t uPoolCount;
+	uint8_t uReserved1[kEMTPoolCacheLine - sizeof(uint32_t) * 3];
+
+	/* Size classes of whoever created the segment */
+	EMTCORECLASSMETA sClass[kEMTCorePoolMax + 1];
+};
+
+struct _EMTCOREDIRMETA
+{
+	EMTLINKLISTHEAD sHead[kEMTCoreLaneMax]; /* one per lane, uLanes of them in use */
+	volatile uint32_t uAwake; /* set by the receiver while it polls sHead */
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(EMTLINKLISTHEAD) * kEMTCoreLaneMax - sizeof(uint32_t)];
+};
+
+struct _EMTCORERINGSLOT
+{
+	uint32_t uToken;
+	uint32_t uFlags;
+	uint64_t uParam0;
+	uint64_t uParam1;
+	uint64_t uReserved;
+};
+
+/* Single producer, single consumer, the indexes run free and wrap through the slot mask */
+struct _EMTCORERINGMETA
+{
+	volatile uint32_t uHead;
+	uint8_t uReserved0[kEMTPoolCacheLine - sizeof(uint32_t)];
+	volatile uint32_t uTail;
+	uint8_t uReserved1[kEMTPoolCacheLine - sizeof(uint32_t)];
+
+	EMTCORERINGSLOT sSlot[kEMTCoreRingSlots];
 };
 
 struct _EMTCORECONNMETA
 {
-	EMTLINKLISTNODE sHead[2];
+	EMTCOREDIRMETA sDir[2];
 	volatile uint32_t uPeerId[2];
+	uint32_t uRing;
+	uint32_t uLanes;
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(uint32_t) * 4];
+
+	/* Only there when uRing is set */
+	EMTCORERINGMETA sRing[2];
+};
+
+struct _EMTCOREHUBPEERMETA
+{
+	EMTLINKLISTHEAD sHead;
+	volatile uint32_t uPeerId;
+	volatile uint32_t uAwake;
+	volatile uint64_t uTopics; /* one bit per topic, written by the client only */
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(EMTLINKLISTHEAD) - sizeof(uint32_t) * 2 - sizeof(uint64_t)];
+};
+
+/* Every client prepends to sIn, each reads its replies from the line of its owner slot */
+struct _EMTCOREHUBMETA
+{
+	// Owner slot 0 is never handed out, its line holds the server side
+	EMTLINKLISTHEAD sIn;
+	volatile uint32_t uServerId;
+	volatile uint32_t uServerAwake;
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(EMTLINKLISTHEAD) - sizeof(uint32_t) * 2];
+
+	EMTCOREHUBPEERMETA sPeer[kEMTPoolOwnerSlots - 1];
 };
 
 struct _EMTCOREBLOCKMETA
@@ -26,15 +99,23 @@ struct _EMTCOREBLOCKMETA
 	uint64_t uParam1;
 };
 
+/* Stays with the sender while chunks stream, it frees it once every chunk is credited back */
 struct _EMTCOREPARTIALMETA
 {
 	uint64_t pSend;
 	uint64_t pReceive;
 
-	uint32_t uStart;
+	uint32_t uLength;
 
-	uint32_t uTokenCount;
-	uint32_t uToken[10];
+	/* Sender side */
+	uint32_t uSent;
+	uint32_t uInFlight;
+	uint32_t uCopying; /* chunks still filled by the copy engine, pSend lives until they are done */
+
+	/* Receiver side */
+	uint64_t pPended; /* the descriptor at the head of its domain, it carries the params */
+	uint32_t uReceived;
+	uint32_t uStream; /* chunks go to receivedChunk, no pReceive */
 };
 #pragma pack(pop)
 
@@ -46,13 +127,35 @@ enum
 
 	kEMTCoreSend = 0,
 	kEMTCorePartial = 1,
-	kEMTCoreTypeMask = (1 << 2) - 1,
+	kEMTCorePartialChunk = 2, /* uParam0 the partial meta token, uParam1 the offset of the chunk */
+	kEMTCorePartialCredit = 3, /* uParam0 the partial meta token, uParam1 the chunks the receiver is done with */
+	kEMTCoreCopyOut = 4, /* never sent, a chunk waiting for its copy before it goes out like kEMTCorePartialChunk */
+	kEMTCoreTypeMask = (1 << 3) - 1,
+	kEMTCoreDomainShift = 3, /* the ordering domain of sends and partials above the type */
+	kEMTCoreLaneShift = 7, /* the lane above the domain, every answer to a descriptor takes its lane */
+	kEMTCoreRingShift = 32, /* list descriptors carry the ring head they were sent at above the type */
+	kEMTCorePeerShift = 32, /* or without rings the id of the sender, which hub servers route by */
 
 	kEMTCoreLargestBlockLength = 1024 * 256,
 	kEMTCoreLargestBlockCount = 4 * 4,
 	kEMTCoreLargestBlockLimit = 4,
 	KEMTCorePartialMemLength = kEMTCoreLargestBlockLength * kEMTCoreLargestBlockLimit,
-	kEMTCorePartialSlots = 10,
+	kEMTCorePartialWindow = 10,
+
+	kEMTCoreLayoutVersion = 0x454D5412,
+	kEMTCoreLayoutInit = ~0,
+
+	/* Bins holding less than 1/64 of the samples ride on the next larger class */
+	kEMTCoreAutotuneShareShift = 6,
+	kEMTCoreAutotuneMinLength = 32,
+	kEMTCoreAutotuneMinLargest = 256, /* the largest class also carries the core's own metadata */
+
+	/* A dry class borrows from the next two classes up, lending is reviewed every 4096 allocations */
+	kEMTCoreSpillClasses = 2,
+	kEMTCoreRebalancePeriod = 4096,
+
+	/* Messages per receivedBatch call */
+	kEMTCoreBatchMax = 32,
 };
 
 typedef struct _EMTCOREMEMMETA EMTCOREMEMMETA, * PEMTCOREMEMMETA;
@@ -61,81 +164,327 @@ struct _EMTCOREMEMMETA
 	uint32_t uLen;
 };
 
+typedef struct _EMTCOREBATCH EMTCOREBATCH, * PEMTCOREBATCH;
+struct _EMTCOREBATCH
+{
+	EMTCOREMESSAGE sMessage[kEMTCoreBatchMax];
+	void * pBlockMeta[kEMTCoreBatchMax];
+	uint32_t uCount;
+	uint32_t uBlockCount;
+};
+
 const EMTMULTIPOOLCONFIG sMultiPoolConfig[] =
 {
-	{ 32, 32 * 1024, 4 },
-	{ 4 * 1024, 256 * 6, 4 },
-	{ kEMTCoreLargestBlockLength, kEMTCoreLargestBlockCount, kEMTCoreLargestBlockLimit }
+	{ 32, 32 * 1024, 4, kEMTPoolModeBitmap },
+	{ 4 * 1024, 256 * 6, 4, kEMTPoolModeBitmap },
+	{ kEMTCoreLargestBlockLength, kEMTCoreLargestBlockCount, kEMTCoreLargestBlockLimit, kEMTPoolModeBitmap }
 };
 
+/* Table suggested once the autotune window of a core completed, used by later constructs in this process */
+static EMTMULTIPOOLCONFIG sTunedConfig[kEMTCorePoolMax];
+static volatile uint32_t uTunedCount;
+
 static uint32_t EMTCore_process(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta);
 
 static int32_t EMTCore_isSharedMemory(PEMTCORE pThis, void * pMem)
 {
-	return pMem >= pThis->pMem && pMem < pThis->pMemEnd;
+	if (pMem >= pThis->pMem && pMem < pThis->pMemEnd)
+		return 1;
+
+	return pThis->pMeta && pMem && EMTMultiPool_poolByMem(&pThis->sMultiPool, pMem) != 0;
 }
 
-static void EMTCore_sendAll(PEMTCORE pThis, void * pMem, const uint64_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+static void * EMTCore_openSegment(void * pCtx, const uint32_t uSegment, const uint32_t uLen)
+{
+	PEMTCORE pThis = (PEMTCORE)pCtx;
+	return pThis->pSinkOps->getShareSegment(pThis->pSinkCtx, uSegment, uLen);
+}
+
+static void EMTCore_closeSegment(void * pCtx, const uint32_t uSegment, void * pMem)
+{
+	PEMTCORE pThis = (PEMTCORE)pCtx;
+	pThis->pSinkOps->releaseShareSegment(pThis->pSinkCtx, uSegment, pMem);
+}
+
+static const EMTMULTIPOOLSEGMENTOPS sSegmentOps =
+{
+	EMTCore_openSegment,
+	EMTCore_closeSegment,
+};
+
+/* The receiver clears its awake flag with a fence and looks at the inbox again, so a send it may miss always notifies */
+static void EMTCore_notify(PEMTCORE pThis, volatile uint32_t * pAwake, const uint32_t uPeerId)
+{
+	if (pAwake && *pAwake)
+	{
+		if (pThis->pStats)
+			++pThis->pStats->uNotifyElided;
+		return;
+	}
+
+	if (pThis->pStats)
+		++pThis->pStats->uNotify;
+
+	if (pThis->uHubServer && pThis->pSinkOps->notifyPeer)
+		pThis->pSinkOps->notifyPeer(pThis->pSinkCtx, uPeerId);
+	else
+		pThis->pSinkOps->notify(pThis->pSinkCtx);
+}
+
+static void EMTCore_sendTokenTo(PEMTCORE pThis, PEMTLINKLISTHEAD pHead, volatile uint32_t * pAwake, const uint32_t uPeerId, const uint32_t uToken, const uint64_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
 {
 	PEMTCOREBLOCKMETA blockMeta = (PEMTCOREBLOCKMETA)EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCOREBLOCKMETA));
-	blockMeta->uToken = pMem ? EMTMultiPool_transfer(&pThis->sMultiPool, pMem, *pThis->pPeerIdR) : 0;
-	blockMeta->uFlags = uFlags;
+	blockMeta->uToken = uToken;
+	blockMeta->uFlags = uFlags | (pThis->pRingR ? (uint64_t)pThis->pRingR->uHead << kEMTCoreRingShift : (uint64_t)EMTMultiPool_id(&pThis->sMultiPool) << kEMTCorePeerShift);
 	blockMeta->uParam0 = uParam0;
 	blockMeta->uParam1 = uParam1;
 
-	if (EMTLinkList_prepend(pThis->pConnHeadR, &blockMeta->sNext) == 0)
-		pThis->pSinkOps->notify(pThis->pSinkCtx);
+	if (EMTLinkList_prepend(pHead, &blockMeta->sNext) == 0)
+		EMTCore_notify(pThis, pAwake, uPeerId);
+}
+
+static void EMTCore_sendAllTo(PEMTCORE pThis, PEMTLINKLISTHEAD pHead, volatile uint32_t * pAwake, const uint32_t uPeerId, void * pMem, const uint64_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+{
+	EMTCore_sendTokenTo(pThis, pHead, pAwake, uPeerId, pMem ? EMTMultiPool_transfer(&pThis->sMultiPool, pMem, uPeerId) : 0, uFlags, uParam0, uParam1);
+}
+
+static uint32_t EMTCore_lane(const uint64_t uFlags)
+{
+	return (uint32_t)(uFlags >> kEMTCoreLaneShift) & (kEMTCoreLaneMax - 1);
+}
+
+static void EMTCore_sendAll(PEMTCORE pThis, void * pMem, const uint64_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+{
+	EMTCore_sendAllTo(pThis, pThis->pConnHeadR + EMTCore_lane(uFlags), pThis->pAwakeR, *pThis->pPeerIdR, pMem, uFlags, uParam0, uParam1);
+}
+
+static PEMTCOREHUBPEERMETA EMTCore_hubPeer(PEMTCORE pThis, const uint32_t uPeer)
+{
+	const uint32_t slot = uPeer & kEMTPoolOwnerSlotMask;
+	return slot != 0 ? pThis->pHub->sPeer + slot - 1 : 0;
+}
+
+static uint32_t EMTCore_peerOf(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
+{
+	return pThis->uHubServer ? (uint32_t)(pBlockMeta->uFlags >> kEMTCorePeerShift) : *pThis->pPeerIdR;
+}
+
+/* Answers to a descriptor go back to whoever sent it, on a hub server that is one of many clients */
+static void EMTCore_sendBack(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, void * pMem, uint64_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+{
+	const uint32_t peer = EMTCore_peerOf(pThis, pBlockMeta);
+
+	uFlags |= (uint64_t)EMTCore_lane(pBlockMeta->uFlags) << kEMTCoreLaneShift;
+
+	PEMTCOREHUBPEERMETA peerMeta = pThis->uHubServer ? EMTCore_hubPeer(pThis, peer) : 0;
+
+	if (peerMeta)
+		EMTCore_sendAllTo(pThis, &peerMeta->sHead, &peerMeta->uAwake, peer, pMem, uFlags, uParam0, uParam1);
+	else
+		EMTCore_sendAll(pThis, pMem, uFlags, uParam0, uParam1);
+}
+
+static void EMTCore_deliver(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, void * pMem)
+{
+	if (pThis->uHubServer && pThis->pSinkOps->receivedFrom)
+		pThis->pSinkOps->receivedFrom(pThis->pSinkCtx, EMTCore_peerOf(pThis, pBlockMeta), pMem, pBlockMeta->uParam0, pBlockMeta->uParam1);
+	else
+		pThis->pSinkOps->received(pThis->pSinkCtx, pMem, pBlockMeta->uParam0, pBlockMeta->uParam1);
+}
+
+static uint32_t EMTCore_ringPush(PEMTCORE pThis, void * pMem, const uint32_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+{
+	PEMTCORERINGMETA ring = pThis->pRingR;
+	const uint32_t head = ring->uHead;
+	PEMTCORERINGSLOT slot;
+
+	// The consumer index is cached and only read again when the ring looks full
+	if (head - pThis->uRingTailR >= kEMTCoreRingSlots && head - (pThis->uRingTailR = ring->uTail) >= kEMTCoreRingSlots)
+		return 0;
+
+	slot = ring->sSlot + (head & (kEMTCoreRingSlots - 1));
+	slot->uToken = pMem ? EMTMultiPool_transfer(&pThis->sMultiPool, pMem, *pThis->pPeerIdR) : 0;
+	slot->uFlags = uFlags;
+	slot->uParam0 = uParam0;
+	slot->uParam1 = uParam1;
+
+	// Publish before looking at the consumer, it publishes its index before looking at ours
+	rt_xchg32(&ring->uHead, head + 1);
+
+	pThis->uRingTailR = ring->uTail;
+	if (pThis->uRingTailR == head)
+		EMTCore_notify(pThis, pThis->pAwakeR, *pThis->pPeerIdR);
+
+	return 1;
+}
+
+/* Sends whose order the receiver keeps, only the sending thread comes here */
+static void EMTCore_sendInOrder(PEMTCORE pThis, void * pMem, const uint32_t uFlags, const uint64_t uParam0, const uint64_t uParam1)
+{
+	if (pThis->pRingR == 0 || EMTCore_ringPush(pThis, pMem, uFlags, uParam0, uParam1) == 0)
+		EMTCore_sendAll(pThis, pMem, uFlags, uParam0, uParam1);
+}
+
+static void EMTCore_sample(PEMTCORE pThis, const uint32_t uLen, const uint32_t uCount)
+{
+	const uint32_t uBin = uLen > 1 ? rt_bitScanReverse32(uLen - 1) + 1 : 0;
+
+	pThis->uHistogram[uBin < kEMTCoreHistogramBins ? uBin : kEMTCoreHistogramBins - 1] += uCount;
+	pThis->uSampled += uCount;
+
+	if (pThis->uSampled >= pThis->uAutotune)
+		uTunedCount = EMTCore_suggest(pThis, sTunedConfig, kEMTCorePoolMax);
+}
+
+static const uint32_t EMTCore_statsLength(const uint32_t uPoolCount)
+{
+	return sizeof(EMTCORESTATSMETA) + sizeof(((PEMTCORESTATSMETA)0)->sPool[0]) * (uPoolCount - 1);
+}
+
+static void EMTCore_useClasses(PEMTCORE pThis, const EMTMULTIPOOLCONFIG * pConfig, const uint32_t uCount)
+{
+	PEMTMULTIPOOLCONFIG last;
+	uint32_t i;
+
+	pThis->sMultiPool.uPoolCount = uCount < kEMTCorePoolMax ? uCount : kEMTCorePoolMax;
+	for (i = 0; i < pThis->sMultiPool.uPoolCount; ++i)
+		pThis->sMultiPoolConfig[i] = pConfig[i];
+
+	// Partial transfers move chunks the largest class can hold
+	last = pThis->sMultiPoolConfig + pThis->sMultiPool.uPoolCount - 1;
+	pThis->uPartialLength = last->uBlockLength * last->uBlockLimit < KEMTCorePartialMemLength ? last->uBlockLength * last->uBlockLimit : KEMTCorePartialMemLength;
+}
+
+static uint32_t EMTCore_adoptClasses(PEMTCORE pThis)
+{
+	PEMTCORECLASSMETA classMeta = pThis->pMeta->sClass;
+	uint32_t bSame = pThis->pMeta->uPoolCount == pThis->sMultiPool.uPoolCount;
+	uint32_t i;
+
+	for (i = 0; bSame && i < pThis->sMultiPool.uPoolCount; ++i)
+	{
+		bSame = classMeta[i].uBlockLength == pThis->sMultiPoolConfig[i].uBlockLength
+			&& classMeta[i].uBlockCount == pThis->sMultiPoolConfig[i].uBlockCount
+			&& classMeta[i].uBlockLimit == pThis->sMultiPoolConfig[i].uBlockLimit
+			&& classMeta[i].uPoolMode == pThis->sMultiPoolConfig[i].uPoolMode;
+	}
+
+	if (bSame)
+		return 0;
+
+	for (i = 0; i < pThis->pMeta->uPoolCount; ++i)
+	{
+		pThis->sMultiPoolConfig[i].uBlockLength = classMeta[i].uBlockLength;
+		pThis->sMultiPoolConfig[i].uBlockCount = classMeta[i].uBlockCount;
+		pThis->sMultiPoolConfig[i].uBlockLimit = classMeta[i].uBlockLimit;
+		pThis->sMultiPoolConfig[i].uPoolMode = classMeta[i].uPoolMode;
+		pThis->sMultiPoolConfig[i].uNumaNodeMask = 0;
+	}
+
+	EMTCore_useClasses(pThis, pThis->sMultiPoolConfig, pThis->pMeta->uPoolCount);
+	return 1;
+}
+
+static void EMTCore_publishClasses(PEMTCORE pThis)
+{
+	uint32_t i;
+
+	for (i = 0; i < pThis->sMultiPool.uPoolCount; ++i)
+	{
+		pThis->pMeta->sClass[i].uBlockLength = pThis->sMultiPoolConfig[i].uBlockLength;
+		pThis->pMeta->sClass[i].uBlockCount = pThis->sMultiPoolConfig[i].uBlockCount;
+		pThis->pMeta->sClass[i].uBlockLimit = pThis->sMultiPoolConfig[i].uBlockLimit;
+		pThis->pMeta->sClass[i].uPoolMode = pThis->sMultiPoolConfig[i].uPoolMode;
+	}
+
+	pThis->pMeta->uPoolCount = pThis->sMultiPool.uPoolCount;
+	EMTCore_stats(pThis)->uPoolCount = pThis->sMultiPool.uPoolCount;
+}
+
+static uint32_t EMTCore_open(PEMTCORE pThis)
+{
+	uint32_t metaLen, memLen;
+
+	EMTMultiPool_calcMetaSize(&pThis->sMultiPool, &metaLen, &memLen);
+	metaLen = (metaLen + sizeof(EMTCOREMETA) + EMTCore_statsLength(pThis->sMultiPool.uPoolCount) + kPageMask) & ~kPageMask;
+
+	pThis->pMem = pThis->pSinkOps->getShareMemory(pThis->pSinkCtx, metaLen + memLen);
+	pThis->pMemEnd = (uint8_t *)pThis->pMem + metaLen + memLen;
+	pThis->pMeta = (PEMTCOREMETA)pThis->pMem;
+
+	return metaLen;
 }
 
 static void * EMTCore_allocSys(PEMTCORE pThis, const uint32_t uLen)
 {
 	PEMTCOREMEMMETA memMeta = (PEMTCOREMEMMETA)pThis->pSinkOps->allocSys(pThis->pSinkCtx, uLen + sizeof(EMTCOREMEMMETA));
 	memMeta->uLen = uLen;
+
+	if (pThis->pStats)
+	{
+		++pThis->pStats->uAllocSys;
+		pThis->pStats->uBytesSys += uLen;
+	}
+
 	return memMeta + 1;
 }
 
+/* Hub servers spread the same domain of different clients over the table, those were never ordered against each other */
+static uint32_t EMTCore_domain(PEMTCORE pThis, const uint64_t uFlags)
+{
+	uint32_t domain = (uint32_t)(uFlags >> kEMTCoreDomainShift);
+
+	if (pThis->uHubServer)
+		domain += (uint32_t)(uFlags >> kEMTCorePeerShift);
+
+	return domain & (kEMTCoreDomains - 1);
+}
+
 static uint32_t EMTCore_pend(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 {
-	if (pThis->pInTail == 0)
+	const uint32_t domain = EMTCore_domain(pThis, pBlockMeta->uFlags);
+
+	if (pThis->pInTail[domain] == 0)
 	{
-		pThis->pInHead = pBlockMeta;
-		pThis->pInTail = pBlockMeta;
+		pThis->pInHead[domain] = pBlockMeta;
+		pThis->pInTail[domain] = pBlockMeta;
 		EMTLinkList_init(&pBlockMeta->sNext);
 	}
-	else if (pThis->pInHead != pBlockMeta)
+	else if (pThis->pInHead[domain] != pBlockMeta)
 	{
-		EMTLinkList_prepend(&pThis->pInTail->sNext, &pBlockMeta->sNext);
-		pThis->pInTail = pBlockMeta;
+		EMTLinkList_insertAfter(&pThis->pInTail[domain]->sNext, &pBlockMeta->sNext);
+		pThis->pInTail[domain] = pBlockMeta;
 	}
 
-	return pThis->pInHead == pBlockMeta ? 1 : 0;
+	return pThis->pInHead[domain] == pBlockMeta ? 1 : 0;
 }
 
-static void EMTCore_popPended(PEMTCORE pThis)
+static void EMTCore_popPended(PEMTCORE pThis, const uint32_t uDomain)
 {
-	while (pThis->pInHead)
+	while (pThis->pInHead[uDomain])
 	{
-		PEMTCOREBLOCKMETA curr = pThis->pInHead;
+		PEMTCOREBLOCKMETA curr = pThis->pInHead[uDomain];
 
 		if (EMTCore_process(pThis, curr) != 0)
 		{
-			pThis->pInHead = (PEMTCOREBLOCKMETA)EMTLinkList_next(&curr->sNext);
+			pThis->pInHead[uDomain] = (PEMTCOREBLOCKMETA)EMTLinkList_next(&curr->sNext);
 			EMTCore_free(pThis, curr);
 		}
 		else
 			break;
 	}
 
-	if (!pThis->pInHead)
-		pThis->pInTail = 0;
+	if (!pThis->pInHead[uDomain])
+		pThis->pInTail[uDomain] = 0;
 }
 
 static uint32_t EMTCore_received(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 {
-	if (pThis->pInHead == 0 || pThis->pInHead == pBlockMeta)
+	PEMTCOREBLOCKMETA head = pThis->pInHead[EMTCore_domain(pThis, pBlockMeta->uFlags)];
+
+	if (head == 0 || head == pBlockMeta)
 	{
-		void * mem = EMTMultiPool_take(&pThis->sMultiPool, pBlockMeta->uToken);
-		pThis->pSinkOps->received(pThis->pSinkCtx, mem, pBlockMeta->uParam0, pBlockMeta->uParam1);
+		EMTCore_deliver(pThis, pBlockMeta, EMTMultiPool_take(&pThis->sMultiPool, pBlockMeta->uToken));
 		return 1;
 	}
 	else
@@ -144,105 +493,229 @@ static uint32_t EMTCore_received(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 	}
 }
 
-static void EMTCore_sendPartialStart(PEMTCORE pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+static PEMTCOREPARTIALMETA EMTCore_partialStart(PEMTCORE pThis, void * pMem)
 {
 	PEMTCOREPARTIALMETA partialMeta = EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCOREPARTIALMETA));
 	partialMeta->pSend = (uintptr_t)pMem;
 	partialMeta->pReceive = 0;
-	partialMeta->uStart = EMTCore_length(pThis, pMem);
-	partialMeta->uTokenCount = 0;
-
-	EMTCore_sendAll(pThis, partialMeta, kEMTCorePartial, uParam0, uParam1);
+	partialMeta->uLength = EMTCore_length(pThis, pMem);
+	partialMeta->uSent = 0;
+	partialMeta->uInFlight = 0;
+	partialMeta->uCopying = 0;
+	partialMeta->pPended = 0;
+	partialMeta->uReceived = 0;
+	partialMeta->uStream = 0;
+
+	if (pThis->pStats)
+		++pThis->pStats->uPartialSend;
+
+	return partialMeta;
 }
 
 static uint32_t EMTCore_receivedPartialStart(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, PEMTCOREPARTIALMETA pPartialMeta)
 {
-	pPartialMeta->pReceive = (uintptr_t)EMTCore_allocSys(pThis, pPartialMeta->uStart);
-	pPartialMeta->uStart = 0;
+	// A streaming sink takes the chunks themselves, nothing is assembled
+	if (pThis->pSinkOps->receivedChunk)
+		pPartialMeta->uStream = 1;
+	else
+		pPartialMeta->pReceive = (uintptr_t)EMTCore_allocSys(pThis, pPartialMeta->uLength);
+	pPartialMeta->pPended = (uintptr_t)pBlockMeta;
+	pPartialMeta->uReceived = 0;
+
+	EMTCore_sendBack(pThis, pBlockMeta, pPartialMeta, kEMTCorePartial, 0, 0);
+	return 0;
+}
+
+static uint32_t EMTCore_copyAsync(PEMTCORE pThis, void * pDst, const void * pSrc, const uint32_t uLen, PEMTCOREBLOCKMETA pJob)
+{
+	return pThis->pSinkOps->copy && pThis->pSinkOps->copy(pThis->pSinkCtx, pDst, pSrc, uLen, pJob) != 0;
+}
+
+/* Hands the fill of a chunk to the copy engine, it goes out from EMTCore_copied */
+static uint32_t EMTCore_sendChunkAsync(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, PEMTCOREPARTIALMETA pPartialMeta, const uint32_t uPartialToken, void * pMemSend, const uint32_t uStart, const uint32_t uLen)
+{
+	PEMTCOREBLOCKMETA job;
+
+	// Streaming receivers take the chunks in order, copies may finish out of it
+	if (pThis->pSinkOps->copy == 0 || pPartialMeta->uStream || (job = (PEMTCOREBLOCKMETA)EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCOREBLOCKMETA))) == 0)
+		return 0;
 
-	EMTCore_sendAll(pThis, pPartialMeta, kEMTCorePartial, 0, 0);
+	job->uToken = EMTMultiPool_transfer(&pThis->sMultiPool, pMemSend, EMTMultiPool_id(&pThis->sMultiPool));
+	job->uFlags = (pBlockMeta->uFlags & ~(uint64_t)kEMTCoreTypeMask) | kEMTCoreCopyOut;
+	job->uParam0 = uPartialToken;
+	job->uParam1 = uStart;
+
+	++pPartialMeta->uCopying;
+	if (EMTCore_copyAsync(pThis, pMemSend, (uint8_t *)pPartialMeta->pSend + uStart, uLen, job))
+		return 1;
+
+	--pPartialMeta->uCopying;
+	EMTMultiPool_free(&pThis->sMultiPool, job);
 	return 0;
 }
 
+static void EMTCore_park(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
+{
+	EMTLinkList_init(&pBlockMeta->sNext);
+	if (pThis->pParkedTail)
+		EMTLinkList_insertAfter(&pThis->pParkedTail->sNext, &pBlockMeta->sNext);
+	else
+		rt_cmpXchgPtr((void * volatile *)&pThis->pParkedHead, pBlockMeta, 0);
+	pThis->pParkedTail = pBlockMeta;
+}
+
+/* Frees on any thread may refill the pool a parked partial waits on, one resume at a time goes to the thread of the core */
+static void EMTCore_wake(PEMTCORE pThis)
+{
+	if (pThis->pParkedHead != 0 && pThis->uResuming == 0 && rt_cmpXchg32(&pThis->uResuming, 1, 0) == 0)
+		pThis->pSinkOps->queue(pThis->pSinkCtx, (void *)&pThis->uResuming);
+}
+
+/*
+ * Keeps up to uPartialWindow chunks on their way, each credit back refills.
+ * With nothing in flight and no block to copy into, the descriptor turns into
+ * an empty credit and is parked until the next notified finds blocks again.
+ */
 static uint32_t EMTCore_sendPartialData(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, PEMTCOREPARTIALMETA pPartialMeta)
 {
 	uint8_t * mem = (uint8_t *)pPartialMeta->pSend;
-	const uint32_t memLength = EMTCore_length(pThis, mem);
-	uint32_t start = pPartialMeta->uStart;
+	const uint32_t window = pThis->uPartialWindow ? pThis->uPartialWindow : kEMTCorePartialWindow;
+	const uint32_t partialToken = EMTMultiPool_transfer(&pThis->sMultiPool, pPartialMeta, EMTMultiPool_id(&pThis->sMultiPool));
+	uint32_t sent = 0;
+	void * memSend;
 
-	for (pPartialMeta->uTokenCount = 0; pPartialMeta->uTokenCount < kEMTCorePartialSlots && start < memLength; ++pPartialMeta->uTokenCount)
+	while (pPartialMeta->uInFlight < window && pPartialMeta->uSent < pPartialMeta->uLength)
 	{
-		const uint32_t memRemain = memLength - start;
-		const uint32_t memSendLength = memRemain > KEMTCorePartialMemLength ? KEMTCorePartialMemLength : memRemain;
-		void * memSend = EMTMultiPool_alloc(&pThis->sMultiPool, memSendLength);
+		const uint32_t memRemain = pPartialMeta->uLength - pPartialMeta->uSent;
+		const uint32_t memSendLength = memRemain > pThis->uPartialLength ? pThis->uPartialLength : memRemain;
+		const uint32_t start = pPartialMeta->uSent;
 
-		if (memSend == 0)
+		if ((memSend = EMTMultiPool_alloc(&pThis->sMultiPool, memSendLength)) == 0)
 			break;
 
+		pPartialMeta->uSent += memSendLength;
+		++pPartialMeta->uInFlight;
+		++sent;
+
+		if (EMTCore_sendChunkAsync(pThis, pBlockMeta, pPartialMeta, partialToken, memSend, start, memSendLength))
+			continue;
+
 		rt_memcpy(memSend, mem + start, memSendLength);
-		start += memSendLength;
-		pPartialMeta->uToken[pPartialMeta->uTokenCount] = EMTMultiPool_transfer(&pThis->sMultiPool, memSend, *pThis->pPeerIdR);
+		EMTCore_sendBack(pThis, pBlockMeta, memSend, kEMTCorePartialChunk, partialToken, start);
 	}
 
-	if (start == memLength)
+	if (sent != 0 && pPartialMeta->uSent == pPartialMeta->uLength && pPartialMeta->uCopying == 0)
 		EMTCore_free(pThis, mem);
 
-	if (pPartialMeta->uTokenCount != 0)
-		EMTCore_sendAll(pThis, pPartialMeta, kEMTCorePartial, 0, 0);
-	else
-		pThis->pSinkOps->queue(pThis->pSinkCtx, pBlockMeta);
+	if (pThis->pStats && sent != 0)
+		++pThis->pStats->uPartialRounds;
 
-	return pPartialMeta->uTokenCount;
-}
+	if (pPartialMeta->uInFlight != 0)
+		return 1;
 
-static uint32_t EMTCore_receivedPartialData(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta, PEMTCOREPARTIALMETA pPartialMeta)
-{
-	uint32_t i;
-	uint8_t * mem = (uint8_t *)pPartialMeta->pReceive;
-	const uint32_t memLen = EMTCore_length(pThis, mem);
+	if (pPartialMeta->uSent == pPartialMeta->uLength)
+	{
+		EMTMultiPool_free(&pThis->sMultiPool, pPartialMeta);
+		return 1;
+	}
+
+	// An empty credit is a partial back from the parking list, its stall is counted already
+	if (pThis->pStats && ((pBlockMeta->uFlags & kEMTCoreTypeMask) != kEMTCorePartialCredit || pBlockMeta->uParam1 != 0))
+		++pThis->pStats->uPartialStalls;
 
-	for (i = 0; i < pPartialMeta->uTokenCount; ++i)
+	pBlockMeta->uFlags = (pBlockMeta->uFlags & ~(uint64_t)kEMTCoreTypeMask) | kEMTCorePartialCredit;
+	pBlockMeta->uParam0 = partialToken;
+	pBlockMeta->uParam1 = 0;
+	EMTCore_park(pThis, pBlockMeta);
+
+	// A free that came in after the pool ran dry but before the list had the partial did not see it
+	if ((memSend = EMTMultiPool_alloc(&pThis->sMultiPool, pThis->uPartialLength)) != 0)
 	{
-		void * memReceive = EMTMultiPool_take(&pThis->sMultiPool, pPartialMeta->uToken[i]);
-		const uint32_t memReceiveLen = EMTMultiPool_length(&pThis->sMultiPool, memReceive);
+		EMTMultiPool_free(&pThis->sMultiPool, memSend);
+		EMTCore_wake(pThis);
+	}
 
-		rt_memcpy(mem + pPartialMeta->uStart, memReceive, memReceiveLen);
-		pPartialMeta->uStart += memReceiveLen;
+	return 0;
+}
 
+/* The chunk is in place, or with the sink when it streams */
+static void EMTCore_receivedPartialChunkDone(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
+{
+	PEMTCOREPARTIALMETA partialMeta = (PEMTCOREPARTIALMETA)EMTMultiPool_take(&pThis->sMultiPool, (uint32_t)pBlockMeta->uParam0);
+	void * memReceive = EMTMultiPool_take(&pThis->sMultiPool, pBlockMeta->uToken);
+	const uint32_t memReceiveLen = EMTMultiPool_length(&pThis->sMultiPool, memReceive);
+	const uint32_t length = partialMeta->uLength;
+	uint8_t * mem = (uint8_t *)partialMeta->pReceive;
+	PEMTCOREBLOCKMETA realBlockMeta = (PEMTCOREBLOCKMETA)partialMeta->pPended;
+	const uint32_t domain = EMTCore_domain(pThis, realBlockMeta->uFlags);
+	uint32_t done;
+
+	if (mem)
 		EMTMultiPool_free(&pThis->sMultiPool, memReceive);
-	}
 
-	if (pPartialMeta->uStart != memLen)
+	partialMeta->uReceived += memReceiveLen;
+	done = partialMeta->uReceived == length;
+
+	// The credit is our last look at the partial meta, the sender may free it right after
+	EMTCore_sendBack(pThis, pBlockMeta, 0, kEMTCorePartialCredit, pBlockMeta->uParam0, 1);
+
+	// Chunks come in the order they were sent, the one reaching the length is the last
+	if (mem == 0)
 	{
-		pPartialMeta->uTokenCount = 0;
-		EMTCore_sendAll(pThis, pPartialMeta, kEMTCorePartial, 0, 0);
+		pThis->pSinkOps->receivedChunk(pThis->pSinkCtx, pThis->uHubServer ? EMTCore_peerOf(pThis, realBlockMeta) : 0, memReceive,
+			(uint32_t)pBlockMeta->uParam1, length, realBlockMeta->uParam0, realBlockMeta->uParam1);
 	}
-	else
-	{
-		PEMTCOREBLOCKMETA realBlockMeta = pThis->pInHead;
 
-		EMTMultiPool_free(&pThis->sMultiPool, pPartialMeta);
-		pThis->pSinkOps->received(pThis->pSinkCtx, mem, realBlockMeta->uParam0, realBlockMeta->uParam1);
+	if (done)
+	{
+		if (mem)
+			EMTCore_deliver(pThis, realBlockMeta, mem);
 
-		// Loop thought pThis->pInHead;
-		pThis->pInHead = (PEMTCOREBLOCKMETA)EMTLinkList_next(&realBlockMeta->sNext);
+		// Loop thought pThis->pInHead of the domain;
+		pThis->pInHead[domain] = (PEMTCOREBLOCKMETA)EMTLinkList_next(&realBlockMeta->sNext);
 		EMTMultiPool_free(&pThis->sMultiPool, realBlockMeta);
-		EMTCore_popPended(pThis);
+		EMTCore_popPended(pThis, domain);
+	}
+}
+
+static uint32_t EMTCore_receivedPartialChunk(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
+{
+	PEMTCOREPARTIALMETA partialMeta = (PEMTCOREPARTIALMETA)EMTMultiPool_take(&pThis->sMultiPool, (uint32_t)pBlockMeta->uParam0);
+	void * memReceive = EMTMultiPool_take(&pThis->sMultiPool, pBlockMeta->uToken);
+	const uint32_t memReceiveLen = EMTMultiPool_length(&pThis->sMultiPool, memReceive);
+	uint8_t * mem = (uint8_t *)partialMeta->pReceive;
+
+	if (mem)
+	{
+		// Kept until EMTCore_copied when the copy engine takes the chunk
+		if (EMTCore_copyAsync(pThis, mem + pBlockMeta->uParam1, memReceive, memReceiveLen, pBlockMeta))
+			return 0;
+
+		rt_memcpy(mem + pBlockMeta->uParam1, memReceive, memReceiveLen);
 	}
 
+	EMTCore_receivedPartialChunkDone(pThis, pBlockMeta);
 	return 1;
 }
 
+static uint32_t EMTCore_receivedPartialCredit(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
+{
+	PEMTCOREPARTIALMETA partialMeta = (PEMTCOREPARTIALMETA)EMTMultiPool_take(&pThis->sMultiPool, (uint32_t)pBlockMeta->uParam0);
+
+	partialMeta->uInFlight -= (uint32_t)pBlockMeta->uParam1;
+	return EMTCore_sendPartialData(pThis, pBlockMeta, partialMeta);
+}
+
 static uint32_t EMTCore_receivedPartial(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 {
 	PEMTCOREPARTIALMETA partialMeta = (PEMTCOREPARTIALMETA)EMTMultiPool_take(&pThis->sMultiPool, pBlockMeta->uToken);
 
-	if (partialMeta->pReceive == 0)
+	if (partialMeta->pReceive == 0 && partialMeta->uStream == 0)
 	{
 		return EMTCore_pend(pThis, pBlockMeta) ? EMTCore_receivedPartialStart(pThis, pBlockMeta, partialMeta) : 0;
 	}
 
-	return partialMeta->uTokenCount != 0 ? EMTCore_receivedPartialData(pThis, pBlockMeta, partialMeta) : EMTCore_sendPartialData(pThis, pBlockMeta, partialMeta);
+	return EMTCore_sendPartialData(pThis, pBlockMeta, partialMeta);
 }
 
 static uint32_t EMTCore_process(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
@@ -253,93 +726,499 @@ static uint32_t EMTCore_process(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 		return EMTCore_received(pThis, pBlockMeta);
 	case kEMTCorePartial:
 		return EMTCore_receivedPartial(pThis, pBlockMeta);
+	case kEMTCorePartialChunk:
+		return EMTCore_receivedPartialChunk(pThis, pBlockMeta);
+	case kEMTCorePartialCredit:
+		return EMTCore_receivedPartialCredit(pThis, pBlockMeta);
 	default:
 		return 1;
 	}
 }
 
-void EMTCore_construct(PEMTCORE pThis, PEMTCORESINKOPS pSinkOps, void * pSinkCtx)
+static void EMTCore_ringProcess(PEMTCORE pThis, const EMTCORERINGSLOT * pSlot)
 {
-	uint32_t metaLen, memLen;
-	uint32_t i;
-	pThis->pSinkOps = pSinkOps;
-	pThis->pSinkCtx = pSinkCtx;
-	pThis->uConnId = kEMTCoreInvalidConn;
-
-	pThis->sMultiPool.uPoolCount = sizeof(pThis->sMultiPoolConfig) / sizeof(EMTMULTIPOOLCONFIG);
-	for (i = 0; i < pThis->sMultiPool.uPoolCount; ++i)
-		pThis->sMultiPoolConfig[i] = sMultiPoolConfig[i];
-
-	EMTMultiPool_calcMetaSize(&pThis->sMultiPool, &metaLen, &memLen);
-
-	metaLen = (metaLen + sizeof(EMTCOREMETA) + kPageMask) & ~kPageMask;
+	PEMTCOREBLOCKMETA blockMeta;
 
-	void * mem = pThis->pSinkOps->getShareMemory(pThis->pSinkCtx, metaLen + memLen);
-
-	pThis->pMem = mem;
-	pThis->pMemEnd = (uint8_t *)mem + metaLen + memLen;
-	pThis->pInHead = 0;
-	pThis->pInTail = 0;
+	// Plain sends with nothing pended go straight out, the rest needs a descriptor that can wait
+	if ((pSlot->uFlags & kEMTCoreTypeMask) == kEMTCoreSend && pThis->pInHead[EMTCore_domain(pThis, pSlot->uFlags)] == 0)
+	{
+		void * mem = EMTMultiPool_take(&pThis->sMultiPool, pSlot->uToken);
+		pThis->pSinkOps->received(pThis->pSinkCtx, mem, pSlot->uParam0, pSlot->uParam1);
+		return;
+	}
 
-	pThis->pMeta = (PEMTCOREMETA)mem;
-	mem = pThis->pMeta + 1;
+	blockMeta = (PEMTCOREBLOCKMETA)EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCOREBLOCKMETA));
+	blockMeta->uToken = pSlot->uToken;
+	blockMeta->uFlags = pSlot->uFlags;
+	blockMeta->uParam0 = pSlot->uParam0;
+	blockMeta->uParam1 = pSlot->uParam1;
 
-	EMTMultiPool_construct(&pThis->sMultiPool, mem, (uint8_t *)pThis->pMem + metaLen);
+	if (EMTCore_process(pThis, blockMeta) != 0)
+		EMTMultiPool_free(&pThis->sMultiPool, blockMeta);
 }
 
-void EMTCore_destruct(PEMTCORE pThis)
+static uint32_t EMTCore_batchable(PEMTCORE pThis, const uint64_t uFlags)
 {
-	if (pThis->uConnId != kEMTCoreInvalidConn && *pThis->pPeerIdL == 0 && *pThis->pPeerIdR == 0)
-		EMTMultiPool_free(&pThis->sMultiPool, EMTMultiPool_take(&pThis->sMultiPool, pThis->uConnId));
-
-	pThis->pSinkOps->releaseShareMemory(pThis->pSinkCtx, pThis->pMem);
+	return (uFlags & kEMTCoreTypeMask) == kEMTCoreSend && pThis->pInHead[EMTCore_domain(pThis, uFlags)] == 0;
 }
 
-uint32_t EMTCore_connId(PEMTCORE pThis)
+static void EMTCore_batchAdd(PEMTCORE pThis, PEMTCOREBATCH pBatch, const uint32_t uToken, const uint64_t uParam0, const uint64_t uParam1, const uint32_t uPeer)
 {
-	return pThis->uConnId;
+	PEMTCOREMESSAGE message = pBatch->sMessage + pBatch->uCount++;
+
+	message->pMem = EMTMultiPool_take(&pThis->sMultiPool, uToken);
+	message->uParam0 = uParam0;
+	message->uParam1 = uParam1;
+	message->uPeer = uPeer;
+
+	// Read by the sink only after the batch in front of this one
+	rt_prefetch(message->pMem);
 }
 
-uint32_t EMTCore_isConnected(PEMTCORE pThis)
+static void EMTCore_batchFlush(PEMTCORE pThis, PEMTCOREBATCH pBatch)
 {
-	return pThis->pPeerIdL && pThis->pPeerIdR && *pThis->pPeerIdL && *pThis->pPeerIdR;
+	if (pBatch->uCount != 0)
+		pThis->pSinkOps->receivedBatch(pThis->pSinkCtx, pBatch->sMessage, pBatch->uCount);
+
+	EMTMultiPool_freeBatch(&pThis->sMultiPool, pBatch->pBlockMeta, pBatch->uBlockCount);
+	pBatch->uCount = 0;
+	pBatch->uBlockCount = 0;
 }
 
-uint32_t EMTCore_connect(PEMTCORE pThis, uint32_t uConnId)
+/*
+ * Runs of plain sends go out in batches. The next run is gathered before the
+ * current one is handed over, so its descriptors and payloads load while the
+ * sink works. Anything else breaks the run and takes the single path.
+ */
+static void EMTCore_notifiedBatch(PEMTCORE pThis, PEMTCOREBLOCKMETA pBlockMeta)
 {
-	const int32_t isNewConn = uConnId == kEMTCoreInvalidConn;
-	PEMTCORECONNMETA connMeta = (PEMTCORECONNMETA)(isNewConn ? EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCORECONNMETA)) : EMTMultiPool_take(&pThis->sMultiPool, uConnId));
-	pThis->uConnId = isNewConn ? EMTMultiPool_transfer(&pThis->sMultiPool, connMeta, EMTMultiPool_id(&pThis->sMultiPool)) : uConnId;
+	EMTCOREBATCH batch[2];
+	uint32_t cur = 0;
 
-	pThis->pConnHeadL = connMeta->sHead + (isNewConn ? 0 : 1);
-	pThis->pConnHeadR = connMeta->sHead + (isNewConn ? 1 : 0);
-	pThis->pPeerIdL = connMeta->uPeerId + (isNewConn ? 0 : 1);
-	pThis->pPeerIdR = connMeta->uPeerId + (isNewConn ? 1 : 0);
+	batch[0].uCount = batch[0].uBlockCount = 0;
+	batch[1].uCount = batch[1].uBlockCount = 0;
 
-	*pThis->pPeerIdL = EMTMultiPool_id(&pThis->sMultiPool);
-	if (isNewConn)
+	for (;;)
 	{
-		*pThis->pPeerIdR = 0;
-		EMTLinkList_init(pThis->pConnHeadL);
-		EMTLinkList_init(pThis->pConnHeadR);
-	}
+		PEMTCOREBATCH next = batch + (cur ^ 1);
 
-	return pThis->uConnId;
-}
+		while (pBlockMeta && next->uCount < kEMTCoreBatchMax && EMTCore_batchable(pThis, pBlockMeta->uFlags))
+		{
+			PEMTCOREBLOCKMETA following = (PEMTCOREBLOCKMETA)EMTLinkList_next(&pBlockMeta->sNext);
+			if (following)
+				rt_prefetch(following);
 
-uint32_t EMTCore_disconnect(PEMTCORE pThis)
-{
-	if (pThis->uConnId == kEMTCoreInvalidConn || *pThis->pPeerIdL == 0)
-		return 0;
+			EMTCore_batchAdd(pThis, next, pBlockMeta->uToken, pBlockMeta->uParam0, pBlockMeta->uParam1, pThis->uHubServer ? EMTCore_peerOf(pThis, pBlockMeta) : 0);
+			next->pBlockMeta[next->uBlockCount++] = pBlockMeta;
+			pBlockMeta = following;
+		}
 
-	*pThis->pPeerIdL = 0;
+		EMTCore_batchFlush(pThis, batch + cur);
+		cur ^= 1;
 
-	return 0;
-}
+		if (next->uCount != 0)
+			continue;
+		if (pBlockMeta == 0)
+			break;
 
-void * EMTCore_alloc(PEMTCORE pThis, const uint32_t uLen)
+		{
+			PEMTCOREBLOCKMETA curr = pBlockMeta;
+			pBlockMeta = (PEMTCOREBLOCKMETA)EMTLinkList_next(&pBlockMeta->sNext);
+
+			if (EMTCore_process(pThis, curr) != 0)
+				EMTMultiPool_free(&pThis->sMultiPool, curr);
+		}
+	}
+}
+
+static void EMTCore_ringTakeBatch(PEMTCORE pThis, const uint32_t uUntil)
+{
+	PEMTCORERINGMETA ring = pThis->pRingL;
+	EMTCOREBATCH batch[2];
+	uint32_t tail = ring->uTail;
+	uint32_t cur = 0;
+
+	batch[0].uCount = batch[0].uBlockCount = 0;
+	batch[1].uCount = batch[1].uBlockCount = 0;
+
+	for (;;)
+	{
+		PEMTCOREBATCH next = batch + (cur ^ 1);
+
+		while ((int32_t)(uUntil - tail) > 0 && next->uCount < kEMTCoreBatchMax)
+		{
+			PEMTCORERINGSLOT slot = ring->sSlot + (tail & (kEMTCoreRingSlots - 1));
+			if (!EMTCore_batchable(pThis, slot->uFlags))
+				break;
+
+			// One line of slots a batch ahead
+			if ((tail & (kEMTPoolCacheLine / sizeof(EMTCORERINGSLOT) - 1)) == 0)
+				rt_prefetch(ring->sSlot + ((tail + kEMTCoreBatchMax) & (kEMTCoreRingSlots - 1)));
+
+			EMTCore_batchAdd(pThis, next, slot->uToken, slot->uParam0, slot->uParam1, 0);
+			++tail;
+		}
+
+		// The run is copied out, its slots go back at once
+		if (tail != ring->uTail)
+			rt_xchg32(&ring->uTail, tail);
+
+		EMTCore_batchFlush(pThis, batch + cur);
+		cur ^= 1;
+
+		if (next->uCount != 0)
+			continue;
+		if ((int32_t)(uUntil - tail) <= 0)
+			break;
+
+		{
+			const EMTCORERINGSLOT slot = ring->sSlot[tail & (kEMTCoreRingSlots - 1)];
+
+			rt_xchg32(&ring->uTail, ++tail);
+			EMTCore_ringProcess(pThis, &slot);
+		}
+	}
+}
+
+static void EMTCore_ringTake(PEMTCORE pThis, const uint32_t uUntil)
+{
+	PEMTCORERINGMETA ring = pThis->pRingL;
+	uint32_t tail = ring->uTail;
+
+	if (pThis->pSinkOps->receivedBatch)
+	{
+		EMTCore_ringTakeBatch(pThis, uUntil);
+		return;
+	}
+
+	while ((int32_t)(uUntil - tail) > 0)
+	{
+		const EMTCORERINGSLOT slot = ring->sSlot[tail & (kEMTCoreRingSlots - 1)];
+
+		// The slot is copied out, give it back before the sink runs
+		rt_xchg32(&ring->uTail, ++tail);
+		EMTCore_ringProcess(pThis, &slot);
+	}
+}
+
+static void EMTCore_notifiedRing(PEMTCORE pThis)
+{
+	for (;;)
+	{
+		// Sends spill to the list when the ring is full, each remembers the ring head it was sent at
+		const uint32_t head = pThis->pRingL->uHead;
+		PEMTCOREBLOCKMETA blockMeta = (PEMTCOREBLOCKMETA)EMTLinkList_reverse(EMTLinkList_detach(pThis->pConnHeadL));
+
+		if (blockMeta == 0 && head == pThis->pRingL->uTail)
+			break;
+
+		while (blockMeta)
+		{
+			PEMTCOREBLOCKMETA curr = blockMeta;
+			blockMeta = (PEMTCOREBLOCKMETA)EMTLinkList_next(&blockMeta->sNext);
+
+			EMTCore_ringTake(pThis, (uint32_t)(curr->uFlags >> kEMTCoreRingShift));
+			if (EMTCore_process(pThis, curr) != 0)
+				EMTMultiPool_free(&pThis->sMultiPool, curr);
+		}
+
+		// Only up to the head read before the list was taken, later spills may sit behind it
+		EMTCore_ringTake(pThis, head);
+	}
+}
+
+void EMTCore_construct(PEMTCORE pThis, PEMTCORESINKOPS pSinkOps, void * pSinkCtx)
+{
+	uint32_t metaLen = 0;
+	uint32_t version = 0;
+	uint32_t i;
+	pThis->pSinkOps = pSinkOps;
+	pThis->pSinkCtx = pSinkCtx;
+	pThis->uConnId = kEMTCoreInvalidConn;
+	pThis->pStats = 0;
+	rt_memset((void *)pThis->pInHead, 0, sizeof(pThis->pInHead));
+	rt_memset((void *)pThis->pInTail, 0, sizeof(pThis->pInTail));
+	pThis->uLaneCount = 1;
+	rt_memset((void *)pThis->pLaneNext, 0, sizeof(pThis->pLaneNext));
+	pThis->pParkedHead = 0;
+	pThis->pParkedTail = 0;
+	pThis->uResuming = 0;
+	pThis->pPeerIdL = 0;
+	pThis->pPeerIdR = 0;
+	pThis->pAwakeL = 0;
+	pThis->pAwakeR = 0;
+	pThis->pRingL = 0;
+	pThis->pRingR = 0;
+	pThis->uRingTailR = 0;
+	pThis->pHub = 0;
+	pThis->uHubServer = 0;
+
+	pThis->uSampled = 0;
+	rt_memset((void *)pThis->uHistogram, 0, sizeof(pThis->uHistogram));
+
+	pThis->sMultiPool.pSegmentOps = pSinkOps->getShareSegment && pSinkOps->releaseShareSegment ? &sSegmentOps : 0;
+	pThis->sMultiPool.pSegmentCtx = pThis;
+	pThis->sMultiPool.uSpillClasses = kEMTCoreSpillClasses;
+	pThis->sMultiPool.uRebalancePeriod = kEMTCoreRebalancePeriod;
+
+	if (pThis->pPoolConfig && pThis->uPoolConfigCount)
+		EMTCore_useClasses(pThis, pThis->pPoolConfig, pThis->uPoolConfigCount);
+	else if (pThis->uAutotune && uTunedCount)
+		EMTCore_useClasses(pThis, sTunedConfig, uTunedCount);
+	else
+		EMTCore_useClasses(pThis, sMultiPoolConfig, sizeof(sMultiPoolConfig) / sizeof(EMTMULTIPOOLCONFIG));
+
+	// A segment created with other classes is mapped again with those, a second mismatch gives up
+	for (i = 0; i < 2; ++i)
+	{
+		metaLen = EMTCore_open(pThis);
+
+		version = rt_cmpXchg32(&pThis->pMeta->uVersion, kEMTCoreLayoutInit, 0);
+		if (version == 0)
+		{
+			EMTCore_publishClasses(pThis);
+			pThis->pMeta->uVersion = version = kEMTCoreLayoutVersion;
+			break;
+		}
+
+		while ((version = pThis->pMeta->uVersion) == kEMTCoreLayoutInit);
+
+		if (version != kEMTCoreLayoutVersion || !EMTCore_adoptClasses(pThis))
+			break;
+
+		pThis->pSinkOps->releaseShareMemory(pThis->pSinkCtx, pThis->pMem);
+		version = 0;
+	}
+
+	// Never mix segment layouts, fall back to system memory instead
+	if (version != kEMTCoreLayoutVersion)
+	{
+		pThis->pMeta = 0;
+		pThis->pMemEnd = pThis->pMem;
+		return;
+	}
+
+	for (i = 0; i < pThis->sMultiPool.uPoolCount; ++i)
+		pThis->sMultiPoolConfig[i].pStats = EMTCore_stats(pThis)->sPool[i];
+
+	// Every owner slot is taken
+	if (EMTMultiPool_construct(&pThis->sMultiPool, (uint8_t *)EMTCore_stats(pThis) + EMTCore_statsLength(pThis->sMultiPool.uPoolCount), (uint8_t *)pThis->pMem + metaLen) == 0)
+	{
+		pThis->pMeta = 0;
+		pThis->pMemEnd = pThis->pMem;
+		return;
+	}
+
+	pThis->pStats = EMTCore_stats(pThis)->sCore + (EMTMultiPool_id(&pThis->sMultiPool) & kEMTPoolOwnerSlotMask);
+}
+
+void EMTCore_destruct(PEMTCORE pThis)
+{
+	// The hub lives as long as its server, clients only give up their line
+	if (pThis->pHub)
+		*pThis->pPeerIdL = 0;
+	else if (pThis->uConnId != kEMTCoreInvalidConn && *pThis->pPeerIdL == 0 && *pThis->pPeerIdR == 0)
+		EMTMultiPool_free(&pThis->sMultiPool, EMTMultiPool_take(&pThis->sMultiPool, pThis->uConnId));
+	else if (pThis->uConnId != kEMTCoreInvalidConn && *pThis->pPeerIdR != 0)
+		EMTMultiPool_transfer(&pThis->sMultiPool, EMTMultiPool_take(&pThis->sMultiPool, pThis->uConnId), *pThis->pPeerIdR);
+
+	// Give back everything still held and the owner slot itself
+	if (pThis->pMeta)
+		EMTMultiPool_destruct(&pThis->sMultiPool);
+
+	pThis->pSinkOps->releaseShareMemory(pThis->pSinkCtx, pThis->pMem);
+}
+
+uint32_t EMTCore_connId(PEMTCORE pThis)
+{
+	return pThis->uConnId;
+}
+
+uint32_t EMTCore_isConnected(PEMTCORE pThis)
+{
+	return pThis->pPeerIdL && pThis->pPeerIdR && *pThis->pPeerIdL && *pThis->pPeerIdR;
+}
+
+uint32_t EMTCore_connect(PEMTCORE pThis, uint32_t uConnId)
+{
+	const int32_t isNewConn = uConnId == kEMTCoreInvalidConn;
+	const uint32_t listLength = sizeof(EMTCORECONNMETA) - sizeof(((PEMTCORECONNMETA)0)->sRing);
+	PEMTCORECONNMETA connMeta = 0;
+	uint32_t i;
+
+	if (pThis->pMeta == 0)
+		return kEMTCoreInvalidConn;
+
+	// Classes too small for the rings keep the connection on the lists
+	if (isNewConn && pThis->uRing)
+		connMeta = (PEMTCORECONNMETA)EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCORECONNMETA));
+	if (isNewConn && connMeta == 0)
+		connMeta = (PEMTCORECONNMETA)EMTMultiPool_alloc(&pThis->sMultiPool, listLength);
+	if (!isNewConn)
+		connMeta = (PEMTCORECONNMETA)EMTMultiPool_take(&pThis->sMultiPool, uConnId);
+	pThis->uConnId = isNewConn ? EMTMultiPool_transfer(&pThis->sMultiPool, connMeta, EMTMultiPool_id(&pThis->sMultiPool)) : uConnId;
+
+	pThis->pConnHeadL = connMeta->sDir[isNewConn ? 0 : 1].sHead;
+	pThis->pConnHeadR = connMeta->sDir[isNewConn ? 1 : 0].sHead;
+	pThis->pPeerIdL = connMeta->uPeerId + (isNewConn ? 0 : 1);
+	pThis->pPeerIdR = connMeta->uPeerId + (isNewConn ? 1 : 0);
+	pThis->pAwakeL = &connMeta->sDir[isNewConn ? 0 : 1].uAwake;
+	pThis->pAwakeR = &connMeta->sDir[isNewConn ? 1 : 0].uAwake;
+
+	if (isNewConn)
+	{
+		// The ring stands for a single lane, ordered against the spills of lane 0
+		connMeta->uLanes = pThis->uLanes < 1 ? 1 : pThis->uLanes < kEMTCoreLaneMax ? pThis->uLanes : kEMTCoreLaneMax;
+		connMeta->uRing = pThis->uRing && connMeta->uLanes == 1 && EMTMultiPool_length(&pThis->sMultiPool, connMeta) >= sizeof(EMTCORECONNMETA);
+		if (connMeta->uRing)
+		{
+			connMeta->sRing[0].uHead = connMeta->sRing[0].uTail = 0;
+			connMeta->sRing[1].uHead = connMeta->sRing[1].uTail = 0;
+		}
+
+		*pThis->pPeerIdR = 0;
+		*pThis->pAwakeL = *pThis->pAwakeR = 0;
+		for (i = 0; i < kEMTCoreLaneMax; ++i)
+		{
+			EMTLinkList_initHead(pThis->pConnHeadL + i);
+			EMTLinkList_initHead(pThis->pConnHeadR + i);
+		}
+	}
+
+	pThis->uLaneCount = connMeta->uLanes;
+
+	pThis->pRingL = connMeta->uRing ? &connMeta->sRing[isNewConn ? 0 : 1] : 0;
+	pThis->pRingR = connMeta->uRing ? &connMeta->sRing[isNewConn ? 1 : 0] : 0;
+	pThis->uRingTailR = pThis->pRingR ? pThis->pRingR->uTail : 0;
+
+	// Joining publishes our id last, the ring pointers are set by then
+	*pThis->pPeerIdL = EMTMultiPool_id(&pThis->sMultiPool);
+
+	return pThis->uConnId;
+}
+
+uint32_t EMTCore_listen(PEMTCORE pThis)
+{
+	PEMTCOREHUBMETA hubMeta;
+	uint32_t i;
+
+	if (pThis->pMeta == 0 || (hubMeta = (PEMTCOREHUBMETA)EMTMultiPool_alloc(&pThis->sMultiPool, sizeof(EMTCOREHUBMETA))) == 0)
+		return kEMTCoreInvalidConn;
+
+	EMTLinkList_initHead(&hubMeta->sIn);
+	hubMeta->uServerAwake = 0;
+	for (i = 0; i < kEMTPoolOwnerSlots - 1; ++i)
+	{
+		EMTLinkList_initHead(&hubMeta->sPeer[i].sHead);
+		hubMeta->sPeer[i].uPeerId = 0;
+		hubMeta->sPeer[i].uAwake = 0;
+		hubMeta->sPeer[i].uTopics = 0;
+	}
+
+	pThis->uConnId = EMTMultiPool_transfer(&pThis->sMultiPool, hubMeta, EMTMultiPool_id(&pThis->sMultiPool));
+	pThis->pHub = hubMeta;
+	pThis->uHubServer = 1;
+	pThis->uLaneCount = 1;
+
+	// Everything comes in on one list, replies pick their list per client
+	pThis->pConnHeadL = &hubMeta->sIn;
+	pThis->pConnHeadR = 0;
+	pThis->pPeerIdL = &hubMeta->uServerId;
+	pThis->pPeerIdR = &hubMeta->uServerId;
+	pThis->pAwakeL = &hubMeta->uServerAwake;
+	pThis->pAwakeR = 0;
+
+	*pThis->pPeerIdL = EMTMultiPool_id(&pThis->sMultiPool);
+
+	return pThis->uConnId;
+}
+
+uint32_t EMTCore_join(PEMTCORE pThis, uint32_t uHubId)
+{
+	PEMTCOREHUBMETA hubMeta;
+	PEMTCOREHUBPEERMETA peerMeta;
+
+	if (pThis->pMeta == 0 || uHubId == kEMTCoreInvalidConn)
+		return kEMTCoreInvalidConn;
+
+	hubMeta = (PEMTCOREHUBMETA)EMTMultiPool_take(&pThis->sMultiPool, uHubId);
+	pThis->pHub = hubMeta;
+	peerMeta = EMTCore_hubPeer(pThis, EMTMultiPool_id(&pThis->sMultiPool));
+
+	pThis->uConnId = uHubId;
+	pThis->uLaneCount = 1;
+	pThis->pConnHeadL = &peerMeta->sHead;
+	pThis->pConnHeadR = &hubMeta->sIn;
+	pThis->pPeerIdL = &peerMeta->uPeerId;
+	pThis->pPeerIdR = &hubMeta->uServerId;
+	pThis->pAwakeL = &peerMeta->uAwake;
+	pThis->pAwakeR = &hubMeta->uServerAwake;
+
+	// Whatever a previous owner of the slot left is gone with its blocks
+	EMTLinkList_initHead(pThis->pConnHeadL);
+	*pThis->pAwakeL = 0;
+	peerMeta->uTopics = 0;
+	*pThis->pPeerIdL = EMTMultiPool_id(&pThis->sMultiPool);
+
+	return pThis->uConnId;
+}
+
+uint32_t EMTCore_disconnect(PEMTCORE pThis)
+{
+	if (pThis->uConnId == kEMTCoreInvalidConn || *pThis->pPeerIdL == 0)
+		return 0;
+
+	*pThis->pPeerIdL = 0;
+
+	return 0;
+}
+
+uint32_t EMTCore_reclaim(PEMTCORE pThis)
+{
+	const uint32_t peerId = pThis->pPeerIdR ? *pThis->pPeerIdR : 0;
+
+	if (pThis->uConnId == kEMTCoreInvalidConn || peerId == 0 || pThis->pHub)
+		return 0;
+
+	// The connection block may belong to the peer, keep it for our side
+	EMTMultiPool_transfer(&pThis->sMultiPool, EMTMultiPool_take(&pThis->sMultiPool, pThis->uConnId), EMTMultiPool_id(&pThis->sMultiPool));
+	*pThis->pPeerIdR = 0;
+
+	return EMTMultiPool_reclaim(&pThis->sMultiPool, peerId);
+}
+
+uint32_t EMTCore_reclaimPeer(PEMTCORE pThis, const uint32_t uPeer)
+{
+	PEMTCOREHUBPEERMETA peerMeta = pThis->uHubServer ? EMTCore_hubPeer(pThis, uPeer) : 0;
+	PEMTCOREBLOCKMETA blockMeta;
+
+	// A client that left on its own gave everything back, a new one may hold the slot by now
+	if (peerMeta == 0 || peerMeta->uPeerId != uPeer)
+		return 0;
+
+	// Nothing is published or sent to the line from here on
+	peerMeta->uPeerId = 0;
+	peerMeta->uTopics = 0;
+	peerMeta->uAwake = 0;
+
+	// Descriptors still on the line are ours, what they carry went to the client and goes with its blocks
+	for (blockMeta = (PEMTCOREBLOCKMETA)EMTLinkList_detach(&peerMeta->sHead); blockMeta; )
+	{
+		PEMTCOREBLOCKMETA next = (PEMTCOREBLOCKMETA)EMTLinkList_next(&blockMeta->sNext);
+
+		EMTMultiPool_free(&pThis->sMultiPool, blockMeta);
+		blockMeta = next;
+	}
+
+	return EMTMultiPool_reclaim(&pThis->sMultiPool, uPeer);
+}
+
+void * EMTCore_alloc(PEMTCORE pThis, const uint32_t uLen)
 {
-	void * ret = EMTMultiPool_alloc(&pThis->sMultiPool, uLen);
+	if (pThis->uSampled < pThis->uAutotune)
+		EMTCore_sample(pThis, uLen, 1);
+
+	void * ret = pThis->pMeta ? EMTMultiPool_alloc(&pThis->sMultiPool, uLen) : 0;
 
 	return ret ? ret : EMTCore_allocSys(pThis, uLen);
 }
@@ -347,7 +1226,10 @@ void * EMTCore_alloc(PEMTCORE pThis, const uint32_t uLen)
 void EMTCore_free(PEMTCORE pThis, void * pMem)
 {
 	if (EMTCore_isSharedMemory(pThis, pMem))
+	{
 		EMTMultiPool_free(&pThis->sMultiPool, pMem);
+		EMTCore_wake(pThis);
+	}
 	else if (pMem != 0)
 		pThis->pSinkOps->freeSys(pThis->pSinkCtx, (PEMTCOREMEMMETA)pMem - 1);
 }
@@ -360,6 +1242,39 @@ uint32_t EMTCore_length(PEMTCORE pThis, void * pMem)
 		return ((PEMTCOREMEMMETA)pMem - 1)->uLen;
 }
 
+uint32_t EMTCore_allocBatch(PEMTCORE pThis, const uint32_t uLen, void ** ppMem, const uint32_t uCount)
+{
+	if (pThis->uSampled < pThis->uAutotune)
+		EMTCore_sample(pThis, uLen, uCount);
+
+	uint32_t i = pThis->pMeta ? EMTMultiPool_allocBatch(&pThis->sMultiPool, uLen, ppMem, uCount) : 0;
+
+	for (; i < uCount; ++i)
+		ppMem[i] = EMTCore_allocSys(pThis, uLen);
+
+	return uCount;
+}
+
+void EMTCore_freeBatch(PEMTCORE pThis, void ** ppMem, const uint32_t uCount)
+{
+	uint32_t uFirst = 0;
+	uint32_t i;
+
+	// Shared blocks go back to the pool in runs, the rest one by one
+	for (i = 0; i < uCount; ++i)
+	{
+		if (EMTCore_isSharedMemory(pThis, ppMem[i]))
+			continue;
+
+		EMTMultiPool_freeBatch(&pThis->sMultiPool, ppMem + uFirst, i - uFirst);
+		EMTCore_free(pThis, ppMem[i]);
+		uFirst = i + 1;
+	}
+
+	EMTMultiPool_freeBatch(&pThis->sMultiPool, ppMem + uFirst, uCount - uFirst);
+	EMTCore_wake(pThis);
+}
+
 uint32_t EMTCore_transfer(PEMTCORE pThis, void * pMem)
 {
 	if (EMTCore_isSharedMemory(pThis, pMem))
@@ -370,23 +1285,213 @@ uint32_t EMTCore_transfer(PEMTCORE pThis, void * pMem)
 
 void * EMTCore_take(PEMTCORE pThis, const uint32_t uToken)
 {
-	if (uToken != kEMTCoreInvalidConn)
+	if (uToken != kEMTCoreInvalidConn && pThis->pMeta)
 		return EMTMultiPool_take(&pThis->sMultiPool, uToken);
 	else
 		return 0;
 }
 
+PEMTCORESTATSMETA EMTCore_stats(PEMTCORE pThis)
+{
+	return pThis->pMeta ? (PEMTCORESTATSMETA)(pThis->pMeta + 1) : 0;
+}
+
+uint32_t EMTCore_suggest(PEMTCORE pThis, PEMTMULTIPOOLCONFIG pConfig, const uint32_t uCount)
+{
+	const uint32_t uLargestBin = rt_bitScanReverse32(kEMTCoreLargestBlockLength);
+	uint64_t uBins[kEMTCoreHistogramBins] = { 0 };
+	uint64_t uBudget = 0;
+	uint64_t uTotal = 0;
+	uint64_t uPending = 0;
+	uint32_t uLastBin = 0;
+	uint32_t uDone = 0;
+	uint32_t i;
+
+	// Keep the memory of the built-in table and share it out by message count
+	for (i = 0; i < sizeof(sMultiPoolConfig) / sizeof(EMTMULTIPOOLCONFIG); ++i)
+		uBudget += (uint64_t)sMultiPoolConfig[i].uBlockLength * sMultiPoolConfig[i].uBlockCount;
+
+	// Anything larger than the largest block goes through a few blocks or the partial path
+	for (i = 0; i < kEMTCoreHistogramBins; ++i)
+	{
+		uBins[i < uLargestBin ? i : uLargestBin] += pThis->uHistogram[i];
+		uTotal += pThis->uHistogram[i];
+	}
+
+	for (i = 0; i <= uLargestBin; ++i)
+		uLastBin = uBins[i] ? i : uLastBin;
+
+	if (uTotal == 0 || uCount == 0)
+		return 0;
+
+	for (i = 0; i <= uLastBin; ++i)
+	{
+		const uint32_t uMinLength = i < uLastBin ? kEMTCoreAutotuneMinLength : kEMTCoreAutotuneMinLargest;
+		const uint32_t uBlockLength = (1U << i) > uMinLength ? 1U << i : uMinLength;
+		uint64_t uBlockCount;
+
+		uPending += uBins[i];
+		if (i < uLastBin && ((1U << i) < uMinLength || (uPending << kEMTCoreAutotuneShareShift) < uTotal || uDone + 1 == uCount))
+			continue;
+
+		// Whole pages per pool, the multi pool maps memory to pools page by page
+		uBlockCount = uBudget * uPending / uTotal / uBlockLength;
+		uBlockCount = uBlockLength < kPageSize ? (uBlockCount + (kPageSize / uBlockLength) - 1) & ~(uint64_t)(kPageSize / uBlockLength - 1) : uBlockCount;
+		uBlockCount = uBlockCount ? uBlockCount : 1;
+
+		pConfig[uDone].uBlockLength = uBlockLength;
+		pConfig[uDone].uBlockCount = (uint32_t)uBlockCount;
+		pConfig[uDone].uBlockLimit = 1;
+		pConfig[uDone].uPoolMode = kEMTPoolModeBitmap;
+		pConfig[uDone].uNumaNodeMask = 0;
+		pConfig[uDone].pStats = 0;
+		++uDone;
+
+		uPending = 0;
+	}
+
+	pConfig[uDone - 1].uBlockLimit = kEMTCoreLargestBlockLimit;
+	return uDone;
+}
+
 void EMTCore_send(PEMTCORE pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
 {
+	EMTCore_sendIn(pThis, 0, pMem, uParam0, uParam1);
+}
+
+void EMTCore_sendTo(PEMTCORE pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	PEMTCOREHUBPEERMETA peerMeta = pThis->uHubServer ? EMTCore_hubPeer(pThis, uPeer) : 0;
+
+	// A client that left or a slot that changed hands gets nothing
+	if (peerMeta == 0 || peerMeta->uPeerId != uPeer)
+	{
+		EMTCore_free(pThis, pMem);
+		return;
+	}
+
 	if (EMTCore_isSharedMemory(pThis, pMem))
-		EMTCore_sendAll(pThis, pMem, kEMTCoreSend, uParam0, uParam1);
+		EMTCore_sendAllTo(pThis, &peerMeta->sHead, &peerMeta->uAwake, uPeer, pMem, kEMTCoreSend, uParam0, uParam1);
 	else
-		EMTCore_sendPartialStart(pThis, pMem, uParam0, uParam1);
+		EMTCore_sendAllTo(pThis, &peerMeta->sHead, &peerMeta->uAwake, uPeer, EMTCore_partialStart(pThis, pMem), kEMTCorePartial, uParam0, uParam1);
 }
 
-void EMTCore_notified(PEMTCORE pThis)
+void EMTCore_sendIn(PEMTCORE pThis, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	EMTCore_sendOn(pThis, 0, uDomain, pMem, uParam0, uParam1);
+}
+
+void EMTCore_sendOn(PEMTCORE pThis, const uint32_t uLane, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	const uint32_t lane = uLane < pThis->uLaneCount ? uLane : pThis->uLaneCount - 1;
+	const uint32_t domain = ((uDomain & (kEMTCoreDomains - 1)) << kEMTCoreDomainShift) | (lane << kEMTCoreLaneShift);
+
+	if (EMTCore_isSharedMemory(pThis, pMem))
+		EMTCore_sendInOrder(pThis, pMem, kEMTCoreSend | domain, uParam0, uParam1);
+	else
+		EMTCore_sendInOrder(pThis, EMTCore_partialStart(pThis, pMem), kEMTCorePartial | domain, uParam0, uParam1);
+}
+
+uint32_t EMTCore_subscribe(PEMTCORE pThis, const uint32_t uTopic)
+{
+	PEMTCOREHUBPEERMETA peerMeta = pThis->pHub && !pThis->uHubServer ? EMTCore_hubPeer(pThis, EMTMultiPool_id(&pThis->sMultiPool)) : 0;
+
+	if (peerMeta == 0 || uTopic >= kEMTCoreTopics)
+		return 0;
+
+	peerMeta->uTopics |= 1ULL << uTopic;
+
+	return 1;
+}
+
+uint32_t EMTCore_unsubscribe(PEMTCORE pThis, const uint32_t uTopic)
+{
+	PEMTCOREHUBPEERMETA peerMeta = pThis->pHub && !pThis->uHubServer ? EMTCore_hubPeer(pThis, EMTMultiPool_id(&pThis->sMultiPool)) : 0;
+
+	if (peerMeta == 0 || uTopic >= kEMTCoreTopics)
+		return 0;
+
+	// Something published before this may still come in
+	peerMeta->uTopics &= ~(1ULL << uTopic);
+
+	return 1;
+}
+
+uint32_t EMTCore_publish(PEMTCORE pThis, const uint32_t uTopic, void * pMem, const uint64_t uParam0, const uint64_t uParam1)
+{
+	uint32_t peer[kEMTPoolOwnerSlots - 1];
+	uint32_t count = 0;
+	uint32_t token, i;
+
+	for (i = 0; pThis->uHubServer && uTopic < kEMTCoreTopics && i < kEMTPoolOwnerSlots - 1; ++i)
+	{
+		PEMTCOREHUBPEERMETA peerMeta = pThis->pHub->sPeer + i;
+		const uint32_t peerId = peerMeta->uPeerId;
+
+		if (peerId != 0 && (peerMeta->uTopics >> uTopic & 1) != 0)
+			peer[count++] = peerId;
+	}
+
+	// Only pool blocks are shared, the readers recorded before the first token goes out let the last free release it
+	if (count == 0 || pMem == 0 || !EMTCore_isSharedMemory(pThis, pMem) || EMTMultiPool_share(&pThis->sMultiPool, pMem, peer, count) == 0)
+	{
+		EMTCore_free(pThis, pMem);
+		return 0;
+	}
+
+	token = EMTMultiPool_transfer(&pThis->sMultiPool, pMem, EMTMultiPool_id(&pThis->sMultiPool));
+
+	for (i = 0; i < count; ++i)
+	{
+		PEMTCOREHUBPEERMETA peerMeta = EMTCore_hubPeer(pThis, peer[i]);
+		EMTCore_sendTokenTo(pThis, &peerMeta->sHead, &peerMeta->uAwake, peer[i], token, kEMTCoreSend, uParam0, uParam1);
+	}
+
+	return count;
+}
+
+static uint32_t EMTCore_pending(PEMTCORE pThis)
+{
+	uint32_t lane;
+
+	for (lane = 1; lane < pThis->uLaneCount; ++lane)
+	{
+		if (pThis->pConnHeadL[lane].next != 0)
+			return 1;
+	}
+
+	return pThis->pConnHeadL->next != 0 || (pThis->pRingL && pThis->pRingL->uHead != pThis->pRingL->uTail);
+}
+
+/* Polls the inbox for up to uSpin pauses, backing off so an idle receiver stays off the sender's lines */
+static uint32_t EMTCore_spin(PEMTCORE pThis)
 {
-	PEMTCOREBLOCKMETA blockMeta = (PEMTCOREBLOCKMETA)EMTLinkList_reverse(EMTLinkList_detach(pThis->pConnHeadL));
+	uint32_t spun = 0;
+	uint32_t backoff = 1;
+	uint32_t i;
+
+	while (spun < pThis->uSpin)
+	{
+		if (EMTCore_pending(pThis))
+			return 1;
+
+		for (i = 0; i < backoff; ++i)
+			rt_pause();
+
+		spun += backoff;
+		backoff = backoff < kEMTCoreSpinBackoffMax ? backoff << 1 : backoff;
+	}
+
+	return EMTCore_pending(pThis);
+}
+
+static void EMTCore_drainList(PEMTCORE pThis, PEMTCOREBLOCKMETA blockMeta)
+{
+	if (pThis->pSinkOps->receivedBatch)
+	{
+		EMTCore_notifiedBatch(pThis, blockMeta);
+		return;
+	}
 
 	while (blockMeta)
 	{
@@ -398,10 +1503,148 @@ void EMTCore_notified(PEMTCORE pThis)
 	}
 }
 
+/* Up to uMax descriptors of a lane in order, the shared head is only touched once the last ones taken are used up */
+static PEMTCOREBLOCKMETA EMTCore_laneTake(PEMTCORE pThis, const uint32_t uLane, uint32_t uMax)
+{
+	PEMTCOREBLOCKMETA first = pThis->pLaneNext[uLane];
+	PEMTCOREBLOCKMETA last, next;
+
+	if (first == 0 && pThis->pConnHeadL[uLane].next != 0)
+		first = (PEMTCOREBLOCKMETA)EMTLinkList_reverse(EMTLinkList_detach(pThis->pConnHeadL + uLane));
+	if (first == 0)
+		return 0;
+
+	for (last = first; --uMax != 0 && (next = (PEMTCOREBLOCKMETA)EMTLinkList_next(&last->sNext)) != 0; last = next);
+
+	pThis->pLaneNext[uLane] = (PEMTCOREBLOCKMETA)EMTLinkList_next(&last->sNext);
+	EMTLinkList_init(&last->sNext);
+	return first;
+}
+
+/*
+ * Strict priority drains lane 0 whole and the others a batch at a time, looking
+ * at the lanes above again in between. Weighted takes pLaneWeight[lane] from each
+ * lane in turn. Both go on until a look at every lane finds nothing.
+ */
+static void EMTCore_drainLanes(PEMTCORE pThis)
+{
+	PEMTCOREBLOCKMETA blockMeta = 0;
+	uint32_t lane = 0;
+	uint32_t idle = 0;
+
+	if (pThis->pLaneWeight == 0)
+	{
+		for (;;)
+		{
+			for (lane = 0; lane < pThis->uLaneCount && (blockMeta = EMTCore_laneTake(pThis, lane, lane ? kEMTCoreBatchMax : ~0U)) == 0; ++lane);
+			if (blockMeta == 0)
+				break;
+
+			EMTCore_drainList(pThis, blockMeta);
+		}
+		return;
+	}
+
+	while (idle < pThis->uLaneCount)
+	{
+		blockMeta = EMTCore_laneTake(pThis, lane, pThis->pLaneWeight[lane] ? pThis->pLaneWeight[lane] : 1);
+		idle = blockMeta ? 0 : idle + 1;
+
+		if (blockMeta)
+			EMTCore_drainList(pThis, blockMeta);
+
+		lane = lane + 1 < pThis->uLaneCount ? lane + 1 : 0;
+	}
+}
+
+static void EMTCore_drain(PEMTCORE pThis)
+{
+	if (pThis->pRingL)
+		EMTCore_notifiedRing(pThis);
+	else if (pThis->uLaneCount > 1)
+		EMTCore_drainLanes(pThis);
+	else
+		EMTCore_drainList(pThis, (PEMTCOREBLOCKMETA)EMTLinkList_reverse(EMTLinkList_detach(pThis->pConnHeadL)));
+}
+
+/* Credits and frees seen by the drain may have refilled the pool, a partial still dry parks again */
+static void EMTCore_resume(PEMTCORE pThis)
+{
+	PEMTCOREBLOCKMETA blockMeta = pThis->pParkedHead;
+
+	pThis->pParkedHead = 0;
+	pThis->pParkedTail = 0;
+	while (blockMeta)
+	{
+		PEMTCOREBLOCKMETA next = (PEMTCOREBLOCKMETA)EMTLinkList_next(&blockMeta->sNext);
+
+		EMTCore_queued(pThis, blockMeta);
+		blockMeta = next;
+	}
+}
+
+void EMTCore_notified(PEMTCORE pThis)
+{
+	if (pThis->uSpin == 0 || pThis->pAwakeL == 0)
+	{
+		EMTCore_drain(pThis);
+		EMTCore_resume(pThis);
+		return;
+	}
+
+	// Senders skip notify from here until the flag is cleared
+	*pThis->pAwakeL = 1;
+
+	for (;;)
+	{
+		EMTCore_drain(pThis);
+		if (EMTCore_spin(pThis))
+			continue;
+
+		// Going to sleep, a send that saw the flag set is in the inbox by now
+		rt_xchg32(pThis->pAwakeL, 0);
+		if (!EMTCore_pending(pThis))
+			break;
+
+		*pThis->pAwakeL = 1;
+	}
+
+	EMTCore_resume(pThis);
+}
+
 void EMTCore_queued(PEMTCORE pThis, void * pMem)
 {
-	if (EMTCore_process(pThis, (PEMTCOREBLOCKMETA)pMem) != 0)
+	// The resume a free posted, cleared first so a free during it posts the next one
+	if (pMem == &pThis->uResuming)
+	{
+		rt_xchg32(&pThis->uResuming, 0);
+		EMTCore_resume(pThis);
+	}
+	else if (EMTCore_process(pThis, (PEMTCOREBLOCKMETA)pMem) != 0)
+	{
 		EMTMultiPool_free(&pThis->sMultiPool, pMem);
+	}
+}
+
+void EMTCore_copied(PEMTCORE pThis, void * pJob)
+{
+	PEMTCOREBLOCKMETA job = (PEMTCOREBLOCKMETA)pJob;
+
+	if ((job->uFlags & kEMTCoreTypeMask) == kEMTCoreCopyOut)
+	{
+		PEMTCOREPARTIALMETA partialMeta = (PEMTCOREPARTIALMETA)EMTMultiPool_take(&pThis->sMultiPool, (uint32_t)job->uParam0);
+
+		EMTCore_sendBack(pThis, job, EMTMultiPool_take(&pThis->sMultiPool, job->uToken), kEMTCorePartialChunk, job->uParam0, job->uParam1);
+
+		if (--partialMeta->uCopying == 0 && partialMeta->uSent == partialMeta->uLength)
+			EMTCore_free(pThis, (void *)partialMeta->pSend);
+	}
+	else
+	{
+		EMTCore_receivedPartialChunkDone(pThis, job);
+	}
+
+	EMTMultiPool_free(&pThis->sMultiPool, job);
 }
 
 PCEMTCOREOPS emtCore(void)
@@ -413,15 +1656,30 @@ PCEMTCOREOPS emtCore(void)
 		EMTCore_connId,
 		EMTCore_isConnected,
 		EMTCore_connect,
+		EMTCore_listen,
+		EMTCore_join,
 		EMTCore_disconnect,
+		EMTCore_reclaim,
+		EMTCore_reclaimPeer,
 		EMTCore_alloc,
 		EMTCore_free,
 		EMTCore_length,
+		EMTCore_allocBatch,
+		EMTCore_freeBatch,
 		EMTCore_transfer,
 		EMTCore_take,
+		EMTCore_stats,
+		EMTCore_suggest,
 		EMTCore_send,
+		EMTCore_sendTo,
+		EMTCore_sendIn,
+		EMTCore_sendOn,
+		EMTCore_subscribe,
+		EMTCore_unsubscribe,
+		EMTCore_publish,
 		EMTCore_notified,
 		EMTCore_queued,
+		EMTCore_copied,
 	};
 
 	return &sOps;
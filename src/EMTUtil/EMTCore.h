@@ -11,6 +11,30 @@
 enum
 {
 	kEMTCoreInvalidConn = ~0U,
+
+	/* Pool ids in tokens are 8 bits wide */
+	kEMTCorePoolMax = 255,
+
+	/* Message sizes are sampled into power-of-two bins */
+	kEMTCoreHistogramBins = 32,
+
+	/* The stats region follows the segment header and its 16-byte class entries */
+	kEMTCoreStatsOffset = kEMTPoolCacheLine + 16 * (kEMTCorePoolMax + 1),
+
+	/* Descriptors in each direction of a ring connection, a power of two */
+	kEMTCoreRingSlots = 128,
+
+	/* Pauses between two looks at the inbox while spinning, the backoff doubles up to this */
+	kEMTCoreSpinBackoffMax = 64,
+
+	/* Ordering domains, a message only waits behind earlier ones of its own domain, a power of two */
+	kEMTCoreDomains = 16,
+
+	/* Priority lanes per direction of a connection, lane 0 is drained first, a power of two */
+	kEMTCoreLaneMax = 4,
+
+	/* Topics of a hub, each client subscribes to any of them */
+	kEMTCoreTopics = 64,
 };
 
 typedef struct _EMTCOREOPS EMTCOREOPS, * PEMTCOREOPS;
@@ -20,6 +44,44 @@ typedef struct _EMTCORESINKOPS EMTCORESINKOPS, * PEMTCORESINKOPS;
 typedef struct _EMTCOREMETA EMTCOREMETA, * PEMTCOREMETA;
 typedef struct _EMTCORECONNMETA EMTCORECONNMETA, *PEMTCORECONNMETA;
 typedef struct _EMTCOREBLOCKMETA EMTCOREBLOCKMETA, * PEMTCOREBLOCKMETA;
+typedef struct _EMTCORERINGMETA EMTCORERINGMETA, * PEMTCORERINGMETA;
+typedef struct _EMTCOREHUBMETA EMTCOREHUBMETA, * PEMTCOREHUBMETA;
+typedef struct _EMTCORESTATS EMTCORESTATS, * PEMTCORESTATS;
+typedef struct _EMTCORESTATSMETA EMTCORESTATSMETA, * PEMTCORESTATSMETA;
+typedef struct _EMTCOREMESSAGE EMTCOREMESSAGE, * PEMTCOREMESSAGE;
+
+/* Counters of one owner slot, written by that process only */
+#pragma pack(push, 1)
+struct _EMTCORESTATS
+{
+	volatile uint64_t uAllocSys;
+	volatile uint64_t uBytesSys;
+	volatile uint64_t uPartialSend;
+	volatile uint64_t uPartialRounds;
+	volatile uint64_t uPartialStalls;
+	volatile uint64_t uNotify;
+	volatile uint64_t uNotifyElided; /* skipped because the peer was spinning */
+	uint64_t uReserved[1];
+};
+
+struct _EMTCORESTATSMETA
+{
+	uint32_t uPoolCount;
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(uint32_t)];
+
+	EMTCORESTATS sCore[kEMTPoolOwnerSlots];
+	EMTPOOLSTATS sPool[1][kEMTPoolOwnerSlots]; /* uPoolCount of them */
+};
+#pragma pack(pop)
+
+/* One message of a batch handed to receivedBatch */
+struct _EMTCOREMESSAGE
+{
+	void * pMem;
+	uint64_t uParam0;
+	uint64_t uParam1;
+	uint32_t uPeer; /* sender on hub servers, 0 otherwise */
+};
 
 struct _EMTCOREOPS
 {
@@ -30,20 +92,44 @@ struct _EMTCOREOPS
 	uint32_t (*isConnected)(PEMTCORE pThis);
 
 	uint32_t (*connect)(PEMTCORE pThis, uint32_t uConnId);
+	/* hub: many clients share one inbound list of the server, which answers each with sendTo */
+	uint32_t (*listen)(PEMTCORE pThis);
+	uint32_t (*join)(PEMTCORE pThis, uint32_t uHubId);
 	uint32_t (*disconnect)(PEMTCORE pThis);
+	uint32_t (*reclaim)(PEMTCORE pThis);
+	/* hub servers, gives back what a client that died still held and frees its line for the next owner of the slot */
+	uint32_t (*reclaimPeer)(PEMTCORE pThis, const uint32_t uPeer);
 
 	void * (*alloc)(PEMTCORE pThis, const uint32_t uLen);
 	void (*free)(PEMTCORE pThis, void * pMem);
 	uint32_t (*length)(PEMTCORE pThis, void * pMem);
 
+	uint32_t (*allocBatch)(PEMTCORE pThis, const uint32_t uLen, void ** ppMem, const uint32_t uCount);
+	void (*freeBatch)(PEMTCORE pThis, void ** ppMem, const uint32_t uCount);
+
 	uint32_t (*transfer)(PEMTCORE pThis, void * pMem);
 	void * (*take)(PEMTCORE pThis, const uint32_t uToken);
 
+	PEMTCORESTATSMETA (*stats)(PEMTCORE pThis);
+	uint32_t (*suggest)(PEMTCORE pThis, PEMTMULTIPOOLCONFIG pConfig, const uint32_t uCount);
+
 	void (*send)(PEMTCORE pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	void (*sendTo)(PEMTCORE pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	/* send keeps every message in order, these only against the earlier ones of uDomain, send is domain 0 */
+	void (*sendIn)(PEMTCORE pThis, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	/* on a lane of the connection, the last one when it has fewer, messages on different lanes keep no order */
+	void (*sendOn)(PEMTCORE pThis, const uint32_t uLane, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+
+	/* hub clients, what the server publishes on uTopic is received like a send */
+	uint32_t (*subscribe)(PEMTCORE pThis, const uint32_t uTopic);
+	uint32_t (*unsubscribe)(PEMTCORE pThis, const uint32_t uTopic);
+	/* hub servers, every subscriber gets the same pool block and the last free releases it, returns the subscribers reached, 0 for memory outside the pools */
+	uint32_t (*publish)(PEMTCORE pThis, const uint32_t uTopic, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
 
 	/* callback */
 	void (*notified)(PEMTCORE pThis);
 	void (*queued)(PEMTCORE pThis, void * pMem);
+	void (*copied)(PEMTCORE pThis, void * pJob);
 };
 
 struct _EMTCORESINKOPS
@@ -55,12 +141,29 @@ struct _EMTCORESINKOPS
 	void * (*getShareMemory)(void * pThis, const uint32_t uLen);
 	void (*releaseShareMemory)(void * pThis, void * pMem);
 
+	/* extra segments, both may be 0 to keep the pools fixed */
+	void * (*getShareSegment)(void * pThis, const uint32_t uSegment, const uint32_t uLen);
+	void (*releaseShareSegment)(void * pThis, const uint32_t uSegment, void * pMem);
+
 	void (*notify)(void * pThis);
 	void (*queue)(void * pThis, void * pMem);
 
 	/* fallback */
 	void * (*allocSys)(void * pThis, const uint32_t uLen);
 	void (*freeSys)(void * pThis, void * pMem);
+
+	/* hub servers, received and notify stand in when these are 0 */
+	void (*receivedFrom)(void * pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+	void (*notifyPeer)(void * pThis, const uint32_t uPeer);
+
+	/* runs of plain messages in order, received stands in when 0 */
+	void (*receivedBatch)(void * pThis, PEMTCOREMESSAGE pMessage, const uint32_t uCount);
+
+	/* messages too large for the pools chunk by chunk in order as they land, the sink frees each, received gets them whole when 0, messages of other domains may come in between */
+	void (*receivedChunk)(void * pThis, const uint32_t uPeer, void * pMem, const uint32_t uOffset, const uint32_t uLength, const uint64_t uParam0, const uint64_t uParam1);
+
+	/* chunk copies of the partial path, 1 takes the copy over and copied must then get pJob on the thread of the core, 0 or no op copies inline */
+	uint32_t (*copy)(void * pThis, void * pDst, const void * pSrc, const uint32_t uLen, void * pJob);
 };
 
 struct _EMTCORE
@@ -70,21 +173,55 @@ struct _EMTCORE
 	void * pSinkCtx;
 
 	PEMTCOREMETA pMeta;
+	PEMTCORESTATS pStats;
 
-	PEMTLINKLISTNODE pConnHeadL;
-	PEMTLINKLISTNODE pConnHeadR;
+	PEMTLINKLISTHEAD pConnHeadL;
+	PEMTLINKLISTHEAD pConnHeadR;
 	volatile uint32_t * pPeerIdL;
 	volatile uint32_t * pPeerIdR;
+	volatile uint32_t * pAwakeL;
+	volatile uint32_t * pAwakeR;
 	uint32_t uConnId;
 
+	PEMTCORERINGMETA pRingL;
+	PEMTCORERINGMETA pRingR;
+	uint32_t uRingTailR;
+
+	PEMTCOREHUBMETA pHub;
+	uint32_t uHubServer;
+
 	void * pMem;
 	void * pMemEnd;
 
-	PEMTCOREBLOCKMETA pInHead;
-	PEMTCOREBLOCKMETA pInTail;
+	PEMTCOREBLOCKMETA pInHead[kEMTCoreDomains];
+	PEMTCOREBLOCKMETA pInTail[kEMTCoreDomains];
+
+	uint32_t uLaneCount;
+	PEMTCOREBLOCKMETA pLaneNext[kEMTCoreLaneMax]; /* taken off a lane, not processed yet */
+
+	/* Partials stalled on a dry pool, retried from notified or from a resume a free posted */
+	PEMTCOREBLOCKMETA volatile pParkedHead;
+	PEMTCOREBLOCKMETA pParkedTail;
+	volatile uint32_t uResuming;
 
+	uint32_t uPartialLength;
+
+	volatile uint32_t uSampled;
+	volatile uint32_t uHistogram[kEMTCoreHistogramBins];
+
+	/* Public fields - init */
+	const EMTMULTIPOOLCONFIG * pPoolConfig; /* 0 for the built-in table, a segment created with another table wins */
+	uint32_t uPoolConfigCount;
+	uint32_t uAutotune; /* allocations sampled before a table is suggested and used by the next construct, 0 disables */
+	uint32_t uRing; /* 1 gives connections this side creates a descriptor ring per direction, sends must then come from one thread */
+	uint32_t uSpin; /* pauses notified keeps polling the inbox before it returns to block, senders skip notify meanwhile, 0 disables */
+	uint32_t uPartialWindow; /* chunks of a message too large for the pools in flight at once, 0 for the default of 10 */
+	uint32_t uLanes; /* priority lanes per direction of connections this side creates, up to kEMTCoreLaneMax, more than 1 keeps them off the ring */
+	const uint32_t * pLaneWeight; /* descriptors notified takes from each lane in turn, 0 for strict priority */
+
+	/* Private fields */
 	EMTMULTIPOOL sMultiPool;
-	EMTMULTIPOOLCONFIG sMultiPoolConfig[3];
+	EMTMULTIPOOLCONFIG sMultiPoolConfig[kEMTCorePoolMax];
 };
 
 EXTERN_C PCEMTCOREOPS emtCore(void);
@@ -95,32 +232,65 @@ EMTIMPL_CALL void EMTCore_destruct(PEMTCORE pThis);
 EMTIMPL_CALL uint32_t EMTCore_connId(PEMTCORE pThis);
 EMTIMPL_CALL uint32_t EMTCore_isConnected(PEMTCORE pThis);
 EMTIMPL_CALL uint32_t EMTCore_connect(PEMTCORE pThis, uint32_t uConnId);
+EMTIMPL_CALL uint32_t EMTCore_listen(PEMTCORE pThis);
+EMTIMPL_CALL uint32_t EMTCore_join(PEMTCORE pThis, uint32_t uHubId);
 EMTIMPL_CALL uint32_t EMTCore_disconnect(PEMTCORE pThis);
+EMTIMPL_CALL uint32_t EMTCore_reclaim(PEMTCORE pThis);
+EMTIMPL_CALL uint32_t EMTCore_reclaimPeer(PEMTCORE pThis, const uint32_t uPeer);
 EMTIMPL_CALL void * EMTCore_alloc(PEMTCORE pThis, const uint32_t uLen);
 EMTIMPL_CALL void EMTCore_free(PEMTCORE pThis, void * pMem);
 EMTIMPL_CALL uint32_t EMTCore_length(PEMTCORE pThis, void * pMem);
+EMTIMPL_CALL uint32_t EMTCore_allocBatch(PEMTCORE pThis, const uint32_t uLen, void ** ppMem, const uint32_t uCount);
+EMTIMPL_CALL void EMTCore_freeBatch(PEMTCORE pThis, void ** ppMem, const uint32_t uCount);
 EMTIMPL_CALL uint32_t EMTCore_transfer(PEMTCORE pThis, void * pMem);
 EMTIMPL_CALL void * EMTCore_take(PEMTCORE pThis, const uint32_t uToken);
+EMTIMPL_CALL PEMTCORESTATSMETA EMTCore_stats(PEMTCORE pThis);
+EMTIMPL_CALL uint32_t EMTCore_suggest(PEMTCORE pThis, PEMTMULTIPOOLCONFIG pConfig, const uint32_t uCount);
 EMTIMPL_CALL void EMTCore_send(PEMTCORE pThis, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+EMTIMPL_CALL void EMTCore_sendTo(PEMTCORE pThis, const uint32_t uPeer, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+EMTIMPL_CALL void EMTCore_sendIn(PEMTCORE pThis, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+EMTIMPL_CALL void EMTCore_sendOn(PEMTCORE pThis, const uint32_t uLane, const uint32_t uDomain, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
+EMTIMPL_CALL uint32_t EMTCore_subscribe(PEMTCORE pThis, const uint32_t uTopic);
+EMTIMPL_CALL uint32_t EMTCore_unsubscribe(PEMTCORE pThis, const uint32_t uTopic);
+EMTIMPL_CALL uint32_t EMTCore_publish(PEMTCORE pThis, const uint32_t uTopic, void * pMem, const uint64_t uParam0, const uint64_t uParam1);
 EMTIMPL_CALL void EMTCore_notified(PEMTCORE pThis);
 EMTIMPL_CALL void EMTCore_queued(PEMTCORE pThis, void * pMem);
+EMTIMPL_CALL void EMTCore_copied(PEMTCORE pThis, void * pJob);
 #else
 #define EMTCore_construct emtCore()->construct
 #define EMTCore_destruct emtCore()->destruct
 #define EMTCore_connId emtCore()->connId
 #define EMTCore_isConnected emtCore()->isConnected
 #define EMTCore_connect emtCore()->connect
+#define EMTCore_listen emtCore()->listen
+#define EMTCore_join emtCore()->join
 #define EMTCore_disconnect emtCore()->disconnect
+#define EMTCore_reclaim emtCore()->reclaim
+#define EMTCore_reclaimPeer emtCore()->reclaimPeer
 #define EMTCore_alloc emtCore()->alloc
 #define EMTCore_free emtCore()->free
 #define EMTCore_length emtCore()->length
+#define EMTCore_allocBatch emtCore()->allocBatch
+#define EMTCore_freeBatch emtCore()->freeBatch
 #define EMTCore_transfer emtCore()->transfer
 #define EMTCore_take emtCore()->take
+#define EMTCore_stats emtCore()->stats
+#define EMTCore_suggest emtCore()->suggest
 #define EMTCore_send emtCore()->send
+#define EMTCore_sendTo emtCore()->sendTo
+#define EMTCore_sendIn emtCore()->sendIn
+#define EMTCore_sendOn emtCore()->sendOn
+#define EMTCore_subscribe emtCore()->subscribe
+#define EMTCore_unsubscribe emtCore()->unsubscribe
+#define EMTCore_publish emtCore()->publish
 #define EMTCore_notified emtCore()->notified
 #define EMTCore_queued emtCore()->queued
+#define EMTCore_copied emtCore()->copied
 #endif
 
 EXTERN_C void * rt_memcpy(void * dst, const void * src, const uint32_t size);
+EXTERN_C uint32_t rt_xchg32(volatile uint32_t * dest, uint32_t exchg);
+EXTERN_C void rt_prefetch(const void * mem);
+EXTERN_C void rt_pause(void);
 
 #endif // __EMTCORE_H__
@@ -12,22 +12,48 @@ static int32_t nodeToOffset(PEMTLINKLISTNODE node, PEMTLINKLISTNODE nextNode)
 	return (int32_t)((uint8_t *)nextNode - (uint8_t *)node);
 }
 
-void EMTLinkList_init(PEMTLINKLISTNODE head)
+static uint64_t headPack(const int32_t next, const uint32_t tag)
+{
+	return (uint32_t)next | ((uint64_t)tag << 32);
+}
+
+void EMTLinkList_init(PEMTLINKLISTNODE node)
+{
+	node->next = 0;
+}
+
+void EMTLinkList_initHead(PEMTLINKLISTHEAD head)
 {
 	head->next = 0;
+	head->tag = 0;
 }
 
-PEMTLINKLISTNODE EMTLinkList_prepend(PEMTLINKLISTNODE head, PEMTLINKLISTNODE node)
+PEMTLINKLISTNODE EMTLinkList_prepend(PEMTLINKLISTHEAD head, PEMTLINKLISTNODE node)
 {
+	volatile uint64_t * headTagged = (volatile uint64_t *)head;
+	const int32_t offset = nodeToOffset((PEMTLINKLISTNODE)head, node);
+	uint64_t headOld;
 	int32_t headNext;
-	const int32_t offset = nodeToOffset(head, node);
 	do
 	{
-		headNext = head->next;
+		headOld = *headTagged;
+		headNext = (int32_t)headOld;
 		node->next = headNext ? headNext - offset: 0;
-	} while (rt_cmpXchg32(&head->next, offset, headNext) != headNext);
+	} while (rt_cmpXchg64(headTagged, headPack(offset, (uint32_t)(headOld >> 32) + 1), headOld) != headOld);
+
+	return headNext ? offsetToNode((PEMTLINKLISTNODE)head, headNext) : 0;
+}
+
+PEMTLINKLISTNODE EMTLinkList_insertAfter(PEMTLINKLISTNODE node, PEMTLINKLISTNODE newNode)
+{
+	PEMTLINKLISTNODE next = EMTLinkList_next(node);
+	const int32_t offset = nodeToOffset(node, newNode);
+
+	// Not atomic, for chains only one thread can see
+	newNode->next = next ? node->next - offset : 0;
+	node->next = offset;
 
-	return headNext ? offsetToNode(head, headNext) : 0;
+	return next;
 }
 
 PEMTLINKLISTNODE EMTLinkList_next(PEMTLINKLISTNODE node)
@@ -36,35 +62,41 @@ PEMTLINKLISTNODE EMTLinkList_next(PEMTLINKLISTNODE node)
 	return ret != node ? ret : 0;
 }
 
-PEMTLINKLISTNODE EMTLinkList_takeFirst(PEMTLINKLISTNODE head)
+PEMTLINKLISTNODE EMTLinkList_takeFirst(PEMTLINKLISTHEAD head)
 {
+	volatile uint64_t * headTagged = (volatile uint64_t *)head;
+	uint64_t headOld;
 	int32_t headNext, headNextNext;
-	PEMTLINKLISTNODE node = 0;
+	PEMTLINKLISTNODE node;
 
+	// The node may be taken and put back by others meanwhile, the tag catches that
 	do
 	{
-		node = EMTLinkList_next(head);
-		headNext = nodeToOffset(head, node);
-		headNextNext = node->next ? headNext + node->next : 0;
-	} while (headNext && rt_cmpXchg32(&head->next, headNextNext, headNext) != headNext);
+		headOld = *headTagged;
+		headNext = (int32_t)headOld;
+		if (!headNext)
+			return 0;
 
-	if (node != head)
-		node->next = 0;
-	else
-		node = 0;
+		node = offsetToNode((PEMTLINKLISTNODE)head, headNext);
+		headNextNext = node->next ? headNext + node->next : 0;
+	} while (rt_cmpXchg64(headTagged, headPack(headNextNext, (uint32_t)(headOld >> 32) + 1), headOld) != headOld);
 
+	node->next = 0;
 	return node;
 }
 
-PEMTLINKLISTNODE EMTLinkList_detach(PEMTLINKLISTNODE head)
+PEMTLINKLISTNODE EMTLinkList_detach(PEMTLINKLISTHEAD head)
 {
+	volatile uint64_t * headTagged = (volatile uint64_t *)head;
+	uint64_t headOld;
 	int32_t headNext;
 	do
 	{
-		headNext = head->next;
-	} while (rt_cmpXchg32(&head->next, 0, headNext) != headNext);
+		headOld = *headTagged;
+		headNext = (int32_t)headOld;
+	} while (rt_cmpXchg64(headTagged, headPack(0, (uint32_t)(headOld >> 32) + 1), headOld) != headOld);
 
-	return headNext ? offsetToNode(head, headNext) : 0;
+	return headNext ? offsetToNode((PEMTLINKLISTNODE)head, headNext) : 0;
 }
 
 PEMTLINKLISTNODE EMTLinkList_reverse(PEMTLINKLISTNODE node)
@@ -92,7 +124,9 @@ PCEMTLINKLISTOPS emtLinkList(void)
 	static const EMTLINKLISTOPS sOps =
 	{
 		EMTLinkList_init,
+		EMTLinkList_initHead,
 		EMTLinkList_prepend,
+		EMTLinkList_insertAfter,
 		EMTLinkList_next,
 		EMTLinkList_takeFirst,
 		EMTLinkList_detach,
@@ -102,52 +136,71 @@ PCEMTLINKLISTOPS emtLinkList(void)
 	return &sOps;
 }
 
-void EMTLinkList2_init(PEMTLINKLISTNODE2 head)
+void EMTLinkList2_init(PEMTLINKLISTNODE2 node)
+{
+	node->next = 0;
+}
+
+void EMTLinkList2_initHead(PEMTLINKLISTHEAD2 head)
 {
 	head->next = 0;
+	head->tag = 0;
 }
 
-PEMTLINKLISTNODE2 EMTLinkList2_prepend(PEMTLINKLISTNODE2 head, PEMTLINKLISTNODE2 node)
+PEMTLINKLISTNODE2 EMTLinkList2_prepend(PEMTLINKLISTHEAD2 head, PEMTLINKLISTNODE2 node)
 {
 	PEMTLINKLISTNODE2 headNext;
+	uintptr_t tag;
 	do
 	{
+		tag = head->tag;
 		headNext = head->next;
 		node->next = headNext;
-	} while (rt_cmpXchgPtr(&head->next, node, headNext) != headNext);
+	} while (!rt_cmpXchgPtr2((void * volatile *)head, node, tag + 1, headNext, tag));
 
 	return headNext;
 }
 
+PEMTLINKLISTNODE2 EMTLinkList2_insertAfter(PEMTLINKLISTNODE2 node, PEMTLINKLISTNODE2 newNode)
+{
+	// Not atomic, for chains only one thread can see
+	newNode->next = node->next;
+	node->next = newNode;
+
+	return newNode->next;
+}
+
 PEMTLINKLISTNODE2 EMTLinkList2_next(PEMTLINKLISTNODE2 node)
 {
 	return node->next;
 }
 
-PEMTLINKLISTNODE2 EMTLinkList2_takeFirst(PEMTLINKLISTNODE2 head)
+PEMTLINKLISTNODE2 EMTLinkList2_takeFirst(PEMTLINKLISTHEAD2 head)
 {
-	PEMTLINKLISTNODE2 node = 0;
+	PEMTLINKLISTNODE2 node;
+	uintptr_t tag;
 
 	do
 	{
-		node = EMTLinkList2_next(head);
-	} while (node && rt_cmpXchgPtr(&head->next, node->next, node) != node);
+		tag = head->tag;
+		node = head->next;
+	} while (node && !rt_cmpXchgPtr2((void * volatile *)head, node->next, tag + 1, node, tag));
 
-	if (node != head)
+	if (node)
 		node->next = 0;
-	else
-		node = 0;
 
 	return node;
 }
 
-PEMTLINKLISTNODE2 EMTLinkList2_detach(PEMTLINKLISTNODE2 head)
+PEMTLINKLISTNODE2 EMTLinkList2_detach(PEMTLINKLISTHEAD2 head)
 {
 	PEMTLINKLISTNODE2 headNext;
+	uintptr_t tag;
 	do
 	{
+		tag = head->tag;
 		headNext = head->next;
-	} while (rt_cmpXchgPtr(&head->next, 0, headNext) != headNext);
+	} while (!rt_cmpXchgPtr2((void * volatile *)head, 0, tag + 1, headNext, tag));
 
 	return headNext;
 }
@@ -174,7 +227,9 @@ PCEMTLINKLISTOPS2 emtLinkList2(void)
 	static const EMTLINKLISTOPS2 sOps =
 	{
 		EMTLinkList2_init,
+		EMTLinkList2_initHead,
 		EMTLinkList2_prepend,
+		EMTLinkList2_insertAfter,
 		EMTLinkList2_next,
 		EMTLinkList2_takeFirst,
 		EMTLinkList2_detach,
@@ -10,16 +10,19 @@
 typedef struct _EMTLINKLISTOPS EMTLINKLISTOPS, * PEMTLINKLISTOPS;
 typedef const EMTLINKLISTOPS * PCEMTLINKLISTOPS;
 typedef struct _EMTLINKLISTNODE EMTLINKLISTNODE, * PEMTLINKLISTNODE;
+typedef struct _EMTLINKLISTHEAD EMTLINKLISTHEAD, * PEMTLINKLISTHEAD;
 
 struct _EMTLINKLISTOPS
 {
-	void (*init)(PEMTLINKLISTNODE head);
-	PEMTLINKLISTNODE (*prepend)(PEMTLINKLISTNODE head, PEMTLINKLISTNODE node);
+	void (*init)(PEMTLINKLISTNODE node);
+	void (*initHead)(PEMTLINKLISTHEAD head);
+	PEMTLINKLISTNODE (*prepend)(PEMTLINKLISTHEAD head, PEMTLINKLISTNODE node);
+	PEMTLINKLISTNODE (*insertAfter)(PEMTLINKLISTNODE node, PEMTLINKLISTNODE newNode);
 
 	PEMTLINKLISTNODE (*next)(PEMTLINKLISTNODE node);
 
-	PEMTLINKLISTNODE (*takeFirst)(PEMTLINKLISTNODE head);
-	PEMTLINKLISTNODE (*detach)(PEMTLINKLISTNODE head);
+	PEMTLINKLISTNODE (*takeFirst)(PEMTLINKLISTHEAD head);
+	PEMTLINKLISTNODE (*detach)(PEMTLINKLISTHEAD head);
 	PEMTLINKLISTNODE (*reverse)(PEMTLINKLISTNODE node);
 };
 
@@ -28,20 +31,35 @@ struct _EMTLINKLISTNODE
 {
 	volatile int32_t next;
 };
+
+/*
+ * The head carries a tag bumped by every change and swapped together with the
+ * first offset in one 64-bit CAS, so a head that comes back to the same node
+ * still fails a stale CAS. Keep it 8-byte aligned.
+ */
+struct _EMTLINKLISTHEAD
+{
+	volatile int32_t next;
+	volatile uint32_t tag;
+};
 #pragma pack(pop)
 
 EXTERN_C PCEMTLINKLISTOPS emtLinkList(void);
 
 #if !defined(USE_VTABLE) || defined(EMTIMPL_LINKLIST)
-EMTIMPL_CALL void EMTLinkList_init(PEMTLINKLISTNODE head);
-EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_prepend(PEMTLINKLISTNODE head, PEMTLINKLISTNODE node);
+EMTIMPL_CALL void EMTLinkList_init(PEMTLINKLISTNODE node);
+EMTIMPL_CALL void EMTLinkList_initHead(PEMTLINKLISTHEAD head);
+EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_prepend(PEMTLINKLISTHEAD head, PEMTLINKLISTNODE node);
+EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_insertAfter(PEMTLINKLISTNODE node, PEMTLINKLISTNODE newNode);
 EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_next(PEMTLINKLISTNODE node);
-EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_takeFirst(PEMTLINKLISTNODE head);
-EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_detach(PEMTLINKLISTNODE head);
+EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_takeFirst(PEMTLINKLISTHEAD head);
+EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_detach(PEMTLINKLISTHEAD head);
 EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_reverse(PEMTLINKLISTNODE node);
 #else
 #define EMTLinkList_init emtLinkList()->init
+#define EMTLinkList_initHead emtLinkList()->initHead
 #define EMTLinkList_prepend emtLinkList()->prepend
+#define EMTLinkList_insertAfter emtLinkList()->insertAfter
 #define EMTLinkList_next emtLinkList()->next
 #define EMTLinkList_takeFirst emtLinkList()->takeFirst
 #define EMTLinkList_detach emtLinkList()->detach
@@ -51,16 +69,19 @@ EMTIMPL_CALL PEMTLINKLISTNODE EMTLinkList_reverse(PEMTLINKLISTNODE node);
 typedef struct _EMTLINKLISTOPS2 EMTLINKLISTOPS2, * PEMTLINKLISTOPS2;
 typedef const EMTLINKLISTOPS2 * PCEMTLINKLISTOPS2;
 typedef struct _EMTLINKLISTNODE2 EMTLINKLISTNODE2, * PEMTLINKLISTNODE2;
+typedef struct _EMTLINKLISTHEAD2 EMTLINKLISTHEAD2, * PEMTLINKLISTHEAD2;
 
 struct _EMTLINKLISTOPS2
 {
-	void (*init)(PEMTLINKLISTNODE2 head);
-	PEMTLINKLISTNODE2 (*prepend)(PEMTLINKLISTNODE2 head, PEMTLINKLISTNODE2 node);
+	void (*init)(PEMTLINKLISTNODE2 node);
+	void (*initHead)(PEMTLINKLISTHEAD2 head);
+	PEMTLINKLISTNODE2 (*prepend)(PEMTLINKLISTHEAD2 head, PEMTLINKLISTNODE2 node);
+	PEMTLINKLISTNODE2 (*insertAfter)(PEMTLINKLISTNODE2 node, PEMTLINKLISTNODE2 newNode);
 
 	PEMTLINKLISTNODE2 (*next)(PEMTLINKLISTNODE2 node);
 
-	PEMTLINKLISTNODE2 (*takeFirst)(PEMTLINKLISTNODE2 head);
-	PEMTLINKLISTNODE2 (*detach)(PEMTLINKLISTNODE2 head);
+	PEMTLINKLISTNODE2 (*takeFirst)(PEMTLINKLISTHEAD2 head);
+	PEMTLINKLISTNODE2 (*detach)(PEMTLINKLISTHEAD2 head);
 	PEMTLINKLISTNODE2 (*reverse)(PEMTLINKLISTNODE2 node);
 };
 
@@ -71,18 +92,37 @@ struct _EMTLINKLISTNODE2
 };
 #pragma pack(pop)
 
+/* Pointer and tag are swapped together with a double-width CAS, which faults unless the head is aligned to twice the pointer size */
+#if defined(_MSC_VER) && defined(_WIN64)
+#define EMTLINKLISTHEAD2_ALIGN __declspec(align(16))
+#elif defined(_MSC_VER)
+#define EMTLINKLISTHEAD2_ALIGN __declspec(align(8))
+#else
+#define EMTLINKLISTHEAD2_ALIGN __attribute__((aligned(2 * sizeof(void *))))
+#endif
+
+struct EMTLINKLISTHEAD2_ALIGN _EMTLINKLISTHEAD2
+{
+	volatile PEMTLINKLISTNODE2 next;
+	volatile uintptr_t tag;
+};
+
 EXTERN_C PCEMTLINKLISTOPS2 emtLinkList2(void);
 
 #if !defined(USE_VTABLE) || defined(EMTIMPL_LINKLIST)
-EMTIMPL_CALL void EMTLinkList2_init(PEMTLINKLISTNODE2 head);
-EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_prepend(PEMTLINKLISTNODE2 head, PEMTLINKLISTNODE2 node);
+EMTIMPL_CALL void EMTLinkList2_init(PEMTLINKLISTNODE2 node);
+EMTIMPL_CALL void EMTLinkList2_initHead(PEMTLINKLISTHEAD2 head);
+EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_prepend(PEMTLINKLISTHEAD2 head, PEMTLINKLISTNODE2 node);
+EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_insertAfter(PEMTLINKLISTNODE2 node, PEMTLINKLISTNODE2 newNode);
 EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_next(PEMTLINKLISTNODE2 node);
-EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_takeFirst(PEMTLINKLISTNODE2 head);
-EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_detach(PEMTLINKLISTNODE2 head);
+EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_takeFirst(PEMTLINKLISTHEAD2 head);
+EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_detach(PEMTLINKLISTHEAD2 head);
 EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_reverse(PEMTLINKLISTNODE2 node);
 #else
 #define EMTLinkList2_init emtLinkList2()->init
+#define EMTLinkList2_initHead emtLinkList2()->initHead
 #define EMTLinkList2_prepend emtLinkList2()->prepend
+#define EMTLinkList2_insertAfter emtLinkList2()->insertAfter
 #define EMTLinkList2_next emtLinkList2()->next
 #define EMTLinkList2_takeFirst emtLinkList2()->takeFirst
 #define EMTLinkList2_detach emtLinkList2()->detach
@@ -90,5 +130,6 @@ EMTIMPL_CALL PEMTLINKLISTNODE2 EMTLinkList2_reverse(PEMTLINKLISTNODE2 node);
 #endif
 
 EXTERN_C void * rt_cmpXchgPtr(void * volatile * dest, void * exchg, void * comp);
+EXTERN_C uint32_t rt_cmpXchgPtr2(void * volatile * dest, void * exchg, const uintptr_t exchgTag, void * comp, const uintptr_t compTag);
 
 #endif // __EMTLINKLIST_H__
@@ -1,20 +1,38 @@
 #define EMTIMPL_MULTIPOOL
 #include "EMTMultiPool.h"
 
+typedef struct _EMTMULTIPOOLSEGMENTMETA EMTMULTIPOOLSEGMENTMETA, * PEMTMULTIPOOLSEGMENTMETA;
+
 #pragma pack(push, 1)
+struct _EMTMULTIPOOLSEGMENTMETA
+{
+	volatile uint32_t uState;
+	uint32_t uPool;
+};
+
 struct _EMTMULTIPOOLMETA
 {
-	volatile uint32_t uNextId;
+	/* Generation of each owner slot shifted left by one, low bit set while in use */
+	volatile uint32_t uSlot[kEMTPoolOwnerSlots];
+
+	/* Segment i is pool id uPoolCount + i in tokens */
+	EMTMULTIPOOLSEGMENTMETA sSegment[kEMTMultiPoolSegments];
 };
 #pragma pack(pop)
 
 enum
 {
-	kEMTMultiPoolPageShift = 12,
-	kEMTMultiPoolPoolIdShift = 24,
-	kEMTMultiPoolTokenMask = (1 << 24) - 1,
+	kEMTMultiPoolPageMask = (1 << kEMTMultiPoolPageShift) - 1,
+
+	kEMTMultiPoolInvalidPool = ~0x0,
+	kEMTMultiPoolPoolIds = 1 << (32 - kEMTMultiPoolPoolIdShift),
 
-	kEMTMultiPoolInvalidToken = ~0x0,
+	kEMTMultiPoolSegmentFree = 0,
+	kEMTMultiPoolSegmentOpening = 1,
+	kEMTMultiPoolSegmentReady = 2,
+
+	kEMTMultiPoolSlotUsed = 1,
+	kEMTMultiPoolGenerationMask = (1 << (32 - kEMTPoolOwnerSlotShift)) - 1,
 };
 
 static PEMTMULTIPOOLCONFIG EMTMultiPool_poolConfig(PEMTMULTIPOOL pThis, const uint32_t uPool)
@@ -22,12 +40,220 @@ static PEMTMULTIPOOLCONFIG EMTMultiPool_poolConfig(PEMTMULTIPOOL pThis, const ui
 	return uPool < pThis->uPoolCount ? (PEMTMULTIPOOLCONFIG)(pThis + 1) + uPool : 0;
 }
 
-static PEMTMULTIPOOLCONFIG EMTMultiPool_poolConfigByMem(PEMTMULTIPOOL pThis, void * pMem)
+static const uint32_t EMTMultiPool_acquireSlot(PEMTMULTIPOOL pThis)
+{
+	uint32_t i;
+
+	// Slot 0 is never handed out so that no owner id is zero
+	for (i = 1; i < kEMTPoolOwnerSlots; ++i)
+	{
+		const uint32_t uSlot = pThis->pMeta->uSlot[i];
+
+		if ((uSlot & kEMTMultiPoolSlotUsed) == 0 && rt_cmpXchg32(pThis->pMeta->uSlot + i, uSlot + 2 + kEMTMultiPoolSlotUsed, uSlot) == uSlot)
+			return ((((uSlot >> 1) + 1) & kEMTMultiPoolGenerationMask) << kEMTPoolOwnerSlotShift) | i;
+	}
+
+	return 0;
+}
+
+static const uint32_t EMTMultiPool_isLive(PEMTMULTIPOOL pThis, const uint32_t uId, uint32_t * pSlot)
+{
+	const uint32_t uSlot = pThis->pMeta->uSlot[uId & kEMTPoolOwnerSlotMask];
+
+	*pSlot = uSlot;
+	return (uId & kEMTPoolOwnerSlotMask) != 0 && (uSlot & kEMTMultiPoolSlotUsed) != 0
+		&& ((uSlot >> 1) & kEMTMultiPoolGenerationMask) == uId >> kEMTPoolOwnerSlotShift;
+}
+
+static const uint32_t EMTMultiPool_segmentCount(PEMTMULTIPOOL pThis)
+{
+	return pThis->uPoolCount + kEMTMultiPoolSegments <= kEMTMultiPoolPoolIds ? kEMTMultiPoolSegments : kEMTMultiPoolPoolIds - pThis->uPoolCount;
+}
+
+static const uint32_t EMTMultiPool_segmentLength(PEMTMULTIPOOLCONFIG pPoolConfig, uint32_t * pMetaLen)
 {
-	if (pMem < pThis->pMem || pMem > pThis->pMemEnd)
+	uint32_t poolMetaLen, poolMemLen;
+	EMTPool_calcMetaSize(pPoolConfig->uBlockCount, pPoolConfig->uBlockLength, &poolMetaLen, &poolMemLen);
+
+	*pMetaLen = (poolMetaLen + kEMTMultiPoolPageMask) & ~kEMTMultiPoolPageMask;
+	return *pMetaLen + poolMemLen;
+}
+
+static PEMTPOOL EMTMultiPool_segmentOpen(PEMTMULTIPOOL pThis, const uint32_t uSegment, const uint32_t uPool)
+{
+	PEMTMULTIPOOLSEGMENT segment = pThis->sSegment + uSegment;
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, uPool);
+	uint32_t metaLen, len, end;
+	uint8_t * mem;
+
+	// One thread of the process maps the segment, the others wait for it
+	if (rt_cmpXchg32(&segment->uState, kEMTMultiPoolSegmentOpening, kEMTMultiPoolSegmentFree) != kEMTMultiPoolSegmentFree)
+	{
+		while (segment->uState == kEMTMultiPoolSegmentOpening);
+		return segment->uState == kEMTMultiPoolSegmentReady ? &segment->sPool : 0;
+	}
+
+	len = EMTMultiPool_segmentLength(poolConfig, &metaLen);
+	mem = (uint8_t *)pThis->pSegmentOps->open(pThis->pSegmentCtx, uSegment, len);
+	if (mem == 0)
+	{
+		segment->uState = kEMTMultiPoolSegmentFree;
 		return 0;
+	}
+
+	segment->sPool.uMode = poolConfig->uPoolMode;
+	segment->sPool.uNumaNodeMask = poolConfig->uNumaNodeMask;
+	segment->sPool.pStats = poolConfig->pStats;
+	EMTPool_construct(&segment->sPool, pThis->uId, poolConfig->uBlockCount, poolConfig->uBlockLength, poolConfig->uBlockLimit, mem, mem + metaLen);
+
+	// Mapped lazily, peers may have handed us blocks in it already, so nothing of ours is freed here
+	segment->pMem = mem;
+	segment->pMemEnd = mem + len;
+	segment->uState = kEMTMultiPoolSegmentReady;
+
+	while ((end = pThis->uSegmentEnd) <= uSegment && rt_cmpXchg32(&pThis->uSegmentEnd, uSegment + 1, end) != end);
+
+	return &segment->sPool;
+}
+
+static PEMTPOOL EMTMultiPool_segmentPool(PEMTMULTIPOOL pThis, const uint32_t uSegment)
+{
+	PEMTMULTIPOOLSEGMENTMETA segmentMeta = pThis->pMeta->sSegment + uSegment;
+
+	if (pThis->sSegment[uSegment].uState == kEMTMultiPoolSegmentReady)
+		return &pThis->sSegment[uSegment].sPool;
+
+	// Added by another process, mapped here on first use
+	if (segmentMeta->uState != kEMTMultiPoolSegmentReady || pThis->pSegmentOps == 0)
+		return 0;
+
+	return EMTMultiPool_segmentOpen(pThis, uSegment, segmentMeta->uPool);
+}
+
+static PEMTPOOL EMTMultiPool_segmentGrow(PEMTMULTIPOOL pThis, const uint32_t uPool)
+{
+	const uint32_t segmentCount = EMTMultiPool_segmentCount(pThis);
+	uint32_t i;
+
+	for (i = 0; i < segmentCount; ++i)
+	{
+		PEMTMULTIPOOLSEGMENTMETA segmentMeta = pThis->pMeta->sSegment + i;
+		PEMTPOOL pool;
+
+		if (segmentMeta->uState != kEMTMultiPoolSegmentFree
+			|| rt_cmpXchg32(&segmentMeta->uState, kEMTMultiPoolSegmentOpening, kEMTMultiPoolSegmentFree) != kEMTMultiPoolSegmentFree)
+			continue;
+
+		// Peers only look at the entry once it is ready
+		segmentMeta->uPool = uPool;
+		pool = EMTMultiPool_segmentOpen(pThis, i, uPool);
+		segmentMeta->uState = pool ? kEMTMultiPoolSegmentReady : kEMTMultiPoolSegmentFree;
+
+		return pool;
+	}
+
+	return 0;
+}
+
+static const uint32_t EMTMultiPool_allocSegment(PEMTMULTIPOOL pThis, const uint32_t uPool, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount)
+{
+	const uint32_t segmentCount = EMTMultiPool_segmentCount(pThis);
+	uint32_t uDone = 0;
+	uint32_t i;
+	PEMTPOOL pool;
+
+	for (i = 0; i < segmentCount && uDone < uCount; ++i)
+	{
+		PEMTMULTIPOOLSEGMENTMETA segmentMeta = pThis->pMeta->sSegment + i;
+
+		if (segmentMeta->uState != kEMTMultiPoolSegmentReady || segmentMeta->uPool != uPool)
+			continue;
+
+		if ((pool = EMTMultiPool_segmentPool(pThis, i)) != 0)
+			uDone += EMTPool_allocBatch(pool, uMemLen, ppMem + uDone, uCount - uDone);
+	}
+
+	return uDone;
+}
+
+static const uint32_t EMTMultiPool_allocDry(PEMTMULTIPOOL pThis, const uint32_t uPool, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount)
+{
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, uPool);
+	const uint32_t spillEnd = pThis->uSpillClasses < pThis->uPoolCount - uPool - 1 ? uPool + 1 + pThis->uSpillClasses : pThis->uPoolCount;
+	uint32_t uDone = 0;
+	uint32_t uGot, i;
+	PEMTPOOL pool;
+
+	// The class ran dry, use the segments already added for it first
+	if (pThis->pSegmentOps)
+	{
+		uDone = EMTMultiPool_allocSegment(pThis, uPool, uMemLen, ppMem, uCount);
+		poolConfig->sStats.uSegment += uDone;
+	}
+
+	// Then borrow from larger classes that are not short themselves, cheaper than mapping a segment
+	for (i = uPool + 1; i < spillEnd && uDone < uCount; ++i)
+	{
+		PEMTMULTIPOOLCONFIG lender = EMTMultiPool_poolConfig(pThis, i);
+
+		if (!lender->uLend || uMemLen > lender->uBlockLimitLength)
+			continue;
+
+		uGot = EMTPool_allocBatch(&lender->sPool, uMemLen, ppMem + uDone, uCount - uDone);
+		poolConfig->sStats.uSpill += uGot;
+		lender->sStats.uLent += uGot;
+		uDone += uGot;
+	}
+
+	while (uDone < uCount && pThis->pSegmentOps && (pool = EMTMultiPool_segmentGrow(pThis, uPool)) != 0)
+	{
+		uGot = EMTPool_allocBatch(pool, uMemLen, ppMem + uDone, uCount - uDone);
+		++poolConfig->sStats.uGrow;
+		poolConfig->sStats.uSegment += uGot;
+		uDone += uGot;
+	}
+
+	poolConfig->sStats.uMiss += uCount - uDone;
+	return uDone;
+}
+
+static void EMTMultiPool_tick(PEMTMULTIPOOL pThis)
+{
+	// Racing threads may both see zero, rebalance lets only one of them in
+	if (pThis->uRebalancePeriod && (int32_t)--pThis->uRebalanceTick <= 0)
+		EMTMultiPool_rebalance(pThis);
+}
+
+static const uint32_t EMTMultiPool_poolIdByMem(PEMTMULTIPOOL pThis, void * pMem)
+{
+	const uint32_t segmentEnd = pThis->uSegmentEnd;
+	uint32_t i;
+
+	if (pMem >= pThis->pMem && pMem < pThis->pMemEnd)
+		return pThis->pMemMap[((uint8_t *)pMem - (uint8_t *)pThis->pMem) >> kEMTMultiPoolPageShift];
+
+	for (i = 0; i < segmentEnd; ++i)
+	{
+		PEMTMULTIPOOLSEGMENT segment = pThis->sSegment + i;
+
+		if (segment->uState == kEMTMultiPoolSegmentReady && (uint8_t *)pMem >= segment->pMem && (uint8_t *)pMem < segment->pMemEnd)
+			return pThis->uPoolCount + i;
+	}
+
+	return kEMTMultiPoolInvalidPool;
+}
+
+static PEMTPOOL EMTMultiPool_poolById(PEMTMULTIPOOL pThis, const uint32_t uPoolId)
+{
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, uPoolId);
+
+	if (poolConfig)
+		return &poolConfig->sPool;
 
-	return EMTMultiPool_poolConfig(pThis, pThis->pMemMap[((uint8_t *)pMem - (uint8_t *)pThis->pMem) >> kEMTMultiPoolPageShift]);
+	if (uPoolId != kEMTMultiPoolInvalidPool && uPoolId - pThis->uPoolCount < EMTMultiPool_segmentCount(pThis))
+		return EMTMultiPool_segmentPool(pThis, uPoolId - pThis->uPoolCount);
+
+	return 0;
 }
 
 void EMTMultiPool_calcMetaSize(PEMTMULTIPOOL pThis, uint32_t * pMetaLen, uint32_t * pMemLen)
@@ -46,7 +272,7 @@ void EMTMultiPool_calcMetaSize(PEMTMULTIPOOL pThis, uint32_t * pMetaLen, uint32_
 	}
 }
 
-void EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool)
+const uint32_t EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool)
 {
 	uint8_t * meta = (uint8_t *)pMeta;
 	uint8_t * mem = (uint8_t *)pPool;
@@ -56,10 +282,13 @@ void EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool)
 	pThis->pMeta = (PEMTMULTIPOOLMETA)meta;
 	meta += sizeof(*pThis->pMeta);
 
-	do
-	{
-		pThis->uId = pThis->pMeta->uNextId;
-	} while (rt_cmpXchg32(&pThis->pMeta->uNextId, pThis->uId + 1, pThis->uId) != pThis->uId || pThis->uId == 0);
+	pThis->uId = EMTMultiPool_acquireSlot(pThis);
+	pThis->uSegmentEnd = 0;
+	pThis->uRebalanceTick = pThis->uRebalancePeriod;
+	pThis->uRebalancing = 0;
+
+	for (i = 0; i < kEMTMultiPoolSegments; ++i)
+		pThis->sSegment[i].uState = kEMTMultiPoolSegmentFree;
 
 	for (i = 0; i < pThis->uPoolCount; ++i)
 	{
@@ -67,10 +296,20 @@ void EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool)
 		uint32_t poolMetaLen, poolMemLen;
 		EMTPool_calcMetaSize(poolConfig->uBlockCount, poolConfig->uBlockLength, &poolMetaLen, &poolMemLen);
 
+		poolConfig->sPool.uMode = poolConfig->uPoolMode;
+		poolConfig->sPool.uNumaNodeMask = poolConfig->uNumaNodeMask;
+		poolConfig->sPool.pStats = poolConfig->pStats;
 		EMTPool_construct(&poolConfig->sPool, pThis->uId, poolConfig->uBlockCount, poolConfig->uBlockLength, poolConfig->uBlockLimit, meta, mem);
+
+		// Blocks sent to an earlier generation of this slot after it was reclaimed, those in segments go with our destruct or reclaim
+		if (pThis->uId != 0)
+			EMTPool_freeAll(&poolConfig->sPool, pThis->uId);
 		meta += poolMetaLen;
 		mem += poolMemLen;
 		poolConfig->uBlockLimitLength = poolConfig->uBlockLength * poolConfig->uBlockLimit;
+		poolConfig->uLend = 1;
+		rt_memset(&poolConfig->sStats, 0, sizeof(poolConfig->sStats));
+		rt_memset(&poolConfig->sMark, 0, sizeof(poolConfig->sMark));
 	}
 
 	pThis->pMemMap = meta;
@@ -87,6 +326,8 @@ void EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool)
 	pThis->pMem = pPool;
 	pThis->pMemEnd = mem;
 	pThis->uBlockLimitLength = poolConfig->uBlockLength * poolConfig->uBlockCount;
+
+	return pThis->uId;
 }
 
 void EMTMultiPool_destruct(PEMTMULTIPOOL pThis)
@@ -94,10 +335,27 @@ void EMTMultiPool_destruct(PEMTMULTIPOOL pThis)
 	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, 0);
 	PEMTMULTIPOOLCONFIG poolConfigEnd = poolConfig + pThis->uPoolCount;
 
+	uint32_t uSlot, i;
+
 	for (; poolConfig < poolConfigEnd; ++poolConfig)
 	{
 		EMTPool_destruct(&poolConfig->sPool);
 	}
+
+	for (i = 0; i < pThis->uSegmentEnd; ++i)
+	{
+		PEMTMULTIPOOLSEGMENT segment = pThis->sSegment + i;
+
+		if (segment->uState != kEMTMultiPoolSegmentReady)
+			continue;
+
+		EMTPool_destruct(&segment->sPool);
+		pThis->pSegmentOps->close(pThis->pSegmentCtx, i, segment->pMem);
+		segment->uState = kEMTMultiPoolSegmentFree;
+	}
+
+	if (EMTMultiPool_isLive(pThis, pThis->uId, &uSlot))
+		rt_cmpXchg32(pThis->pMeta->uSlot + (pThis->uId & kEMTPoolOwnerSlotMask), uSlot & ~kEMTMultiPoolSlotUsed, uSlot);
 }
 
 const uint32_t EMTMultiPool_id(PEMTMULTIPOOL pThis)
@@ -107,14 +365,12 @@ const uint32_t EMTMultiPool_id(PEMTMULTIPOOL pThis)
 
 const PEMTPOOL EMTMultiPool_pool(PEMTMULTIPOOL pThis, const uint32_t uPool)
 {
-	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, uPool);
-	return poolConfig ? &poolConfig->sPool : 0;
+	return EMTMultiPool_poolById(pThis, uPool);
 }
 
 const PEMTPOOL EMTMultiPool_poolByMem(PEMTMULTIPOOL pThis, void * pMem)
 {
-	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfigByMem(pThis, pMem);
-	return poolConfig ? &poolConfig->sPool : 0;
+	return EMTMultiPool_poolById(pThis, EMTMultiPool_poolIdByMem(pThis, pMem));
 }
 
 const uint32_t EMTMultiPool_length(PEMTMULTIPOOL pThis, void * pMem)
@@ -128,13 +384,24 @@ void * EMTMultiPool_alloc(PEMTMULTIPOOL pThis, const uint32_t uMemLen)
 	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, 0);
 	PEMTMULTIPOOLCONFIG poolConfigEnd = poolConfig + pThis->uPoolCount;
 
-	if (uMemLen > pThis->uBlockLimitLength)
+	// Without an owner slot nothing allocated here could be told apart from a free block
+	if (uMemLen > pThis->uBlockLimitLength || pThis->uId == 0)
 		return 0;
 
 	for (; poolConfig < poolConfigEnd; ++poolConfig)
 	{
 		if (uMemLen <= poolConfig->uBlockLimitLength)
-			return EMTPool_alloc(&poolConfig->sPool, uMemLen);
+		{
+			void * pMem = EMTPool_alloc(&poolConfig->sPool, uMemLen);
+
+			if (pMem)
+				++poolConfig->sStats.uNatural;
+			else
+				EMTMultiPool_allocDry(pThis, (uint32_t)(poolConfig - EMTMultiPool_poolConfig(pThis, 0)), uMemLen, &pMem, 1);
+
+			EMTMultiPool_tick(pThis);
+			return pMem;
+		}
 	}
 
 	return 0;
@@ -151,22 +418,103 @@ void EMTMultiPool_freeAll(PEMTMULTIPOOL pThis, const uint32_t uId)
 	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, 0);
 	PEMTMULTIPOOLCONFIG poolConfigEnd = poolConfig + pThis->uPoolCount;
 
+	uint32_t i;
+
 	for (; poolConfig < poolConfigEnd; ++poolConfig)
 	{
 		EMTPool_freeAll(&poolConfig->sPool, uId);
 	}
+
+	for (i = 0; i < pThis->uSegmentEnd; ++i)
+	{
+		if (pThis->sSegment[i].uState == kEMTMultiPoolSegmentReady)
+			EMTPool_freeAll(&pThis->sSegment[i].sPool, uId);
+	}
+}
+
+const uint32_t EMTMultiPool_reclaim(PEMTMULTIPOOL pThis, const uint32_t uId)
+{
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, 0);
+	PEMTMULTIPOOLCONFIG poolConfigEnd = poolConfig + pThis->uPoolCount;
+	const uint32_t segmentCount = EMTMultiPool_segmentCount(pThis);
+	uint32_t uSlot, i;
+
+	// A stale id from an earlier generation must not touch the current holder of the slot
+	if (!EMTMultiPool_isLive(pThis, uId, &uSlot))
+		return 0;
+
+	for (; poolConfig < poolConfigEnd; ++poolConfig)
+	{
+		EMTPool_reclaim(&poolConfig->sPool, uId);
+	}
+
+	// The dead owner may hold blocks in segments never mapped here
+	for (i = 0; i < segmentCount; ++i)
+	{
+		PEMTPOOL pool = EMTMultiPool_segmentPool(pThis, i);
+		pool ? EMTPool_reclaim(pool, uId) : 0;
+	}
+
+	return rt_cmpXchg32(pThis->pMeta->uSlot + (uId & kEMTPoolOwnerSlotMask), uSlot & ~kEMTMultiPoolSlotUsed, uSlot) == uSlot;
+}
+
+const uint32_t EMTMultiPool_allocBatch(PEMTMULTIPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount)
+{
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, 0);
+	PEMTMULTIPOOLCONFIG poolConfigEnd = poolConfig + pThis->uPoolCount;
+
+	if (uMemLen > pThis->uBlockLimitLength || pThis->uId == 0)
+		return 0;
+
+	for (; poolConfig < poolConfigEnd; ++poolConfig)
+	{
+		if (uMemLen <= poolConfig->uBlockLimitLength)
+		{
+			uint32_t uDone = EMTPool_allocBatch(&poolConfig->sPool, uMemLen, ppMem, uCount);
+			poolConfig->sStats.uNatural += uDone;
+
+			if (uDone < uCount)
+				uDone += EMTMultiPool_allocDry(pThis, (uint32_t)(poolConfig - EMTMultiPool_poolConfig(pThis, 0)), uMemLen, ppMem + uDone, uCount - uDone);
+
+			EMTMultiPool_tick(pThis);
+			return uDone;
+		}
+	}
+
+	return 0;
+}
+
+void EMTMultiPool_freeBatch(PEMTMULTIPOOL pThis, void ** ppMem, const uint32_t uCount)
+{
+	PEMTPOOL pool = 0;
+	uint32_t uFirst = 0;
+	uint32_t i;
+
+	// Hand each run of blocks from the same pool over in one call
+	for (i = 0; i < uCount; ++i)
+	{
+		PEMTPOOL poolCur = EMTMultiPool_poolByMem(pThis, ppMem[i]);
+		if (poolCur == pool)
+			continue;
+
+		pool ? EMTPool_freeBatch(pool, ppMem + uFirst, i - uFirst) : 0;
+		pool = poolCur;
+		uFirst = i;
+	}
+
+	pool ? EMTPool_freeBatch(pool, ppMem + uFirst, uCount - uFirst) : 0;
 }
 
 const uint32_t EMTMultiPool_transfer(PEMTMULTIPOOL pThis, void * pMem, const uint32_t uToId)
 {
-	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfigByMem(pThis, pMem);
+	const uint32_t poolId = EMTMultiPool_poolIdByMem(pThis, pMem);
+	PEMTPOOL pool = EMTMultiPool_poolById(pThis, poolId);
 
-	if (poolConfig)
+	if (pool)
 	{
-		const uint32_t poolId = (uint32_t)((poolConfig - EMTMultiPool_poolConfig(pThis, 0)) << kEMTMultiPoolPoolIdShift);
-		const uint32_t token = EMTPool_transfer(&poolConfig->sPool, pMem, uToId) & kEMTMultiPoolTokenMask;
+		const uint32_t token = EMTPool_transfer(pool, pMem, uToId) & kEMTMultiPoolTokenMask;
 
-		return poolId | token;
+		return (poolId << kEMTMultiPoolPoolIdShift) | token;
 	}
 
 	return kEMTMultiPoolInvalidToken;
@@ -174,18 +522,77 @@ const uint32_t EMTMultiPool_transfer(PEMTMULTIPOOL pThis, void * pMem, const uin
 
 void * EMTMultiPool_take(PEMTMULTIPOOL pThis, const uint32_t uToken)
 {
-	const uint8_t poolId = uToken >> kEMTMultiPoolPoolIdShift;
+	const uint32_t poolId = uToken >> kEMTMultiPoolPoolIdShift;
 	const uint32_t token = uToken & kEMTMultiPoolTokenMask;
-	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, poolId);
+	PEMTPOOL pool = EMTMultiPool_poolById(pThis, poolId);
 
-	if (poolConfig)
+	if (pool)
 	{
-		return EMTPool_take(&poolConfig->sPool, token);
+		return EMTPool_take(pool, token);
 	}
 
 	return 0;
 }
 
+const uint32_t EMTMultiPool_share(PEMTMULTIPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount)
+{
+	PEMTPOOL pool = EMTMultiPool_poolByMem(pThis, pMem);
+	return pool ? EMTPool_share(pool, pMem, pReaders, uCount) : 0;
+}
+
+const PEMTMULTIPOOLSTATS EMTMultiPool_stats(PEMTMULTIPOOL pThis, const uint32_t uPool)
+{
+	PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, uPool);
+	return poolConfig ? &poolConfig->sStats : 0;
+}
+
+const uint32_t EMTMultiPool_rebalance(PEMTMULTIPOOL pThis)
+{
+	uint32_t uChanged = 0;
+	uint32_t i;
+
+	if (rt_cmpXchg32(&pThis->uRebalancing, 1, 0) != 0)
+		return 0;
+
+	pThis->uRebalanceTick = pThis->uRebalancePeriod;
+
+	for (i = 0; i < pThis->uPoolCount; ++i)
+	{
+		PEMTMULTIPOOLCONFIG poolConfig = EMTMultiPool_poolConfig(pThis, i);
+		EMTMULTIPOOLSTATS sNow = poolConfig->sStats;
+		PEMTMULTIPOOLSTATS pMark = &poolConfig->sMark;
+
+		const uint64_t uSpill = sNow.uSpill - pMark->uSpill;
+		const uint64_t uDry = uSpill + (sNow.uMiss - pMark->uMiss) + (sNow.uGrow - pMark->uGrow);
+		const uint64_t uTotal = (sNow.uNatural - pMark->uNatural) + (sNow.uSegment - pMark->uSegment) + uSpill + (sNow.uMiss - pMark->uMiss);
+		const uint32_t uLend = uDry == 0;
+		uint32_t bChanged = uLend != poolConfig->uLend;
+
+		// A class that ran dry since the last pass keeps what is left for its own traffic
+		poolConfig->uLend = uLend;
+
+		// Steady borrowing moves to a segment of the class's own instead of eating into its lenders
+		if (pThis->pSegmentOps && uSpill > uTotal >> kEMTMultiPoolBorrowShift && EMTMultiPool_segmentGrow(pThis, i))
+		{
+			++poolConfig->sStats.uGrow;
+			++sNow.uGrow;
+			bChanged = 1;
+		}
+
+		if (bChanged)
+		{
+			++poolConfig->sStats.uRebalance;
+			++sNow.uRebalance;
+			++uChanged;
+		}
+
+		*pMark = sNow;
+	}
+
+	pThis->uRebalancing = 0;
+	return uChanged;
+}
+
 PCEMTMULTIPOOLOPS emtMultiPool(void)
 {
 	static const EMTMULTIPOOLOPS sOps =
@@ -200,8 +607,14 @@ PCEMTMULTIPOOLOPS emtMultiPool(void)
 		EMTMultiPool_alloc,
 		EMTMultiPool_free,
 		EMTMultiPool_freeAll,
+		EMTMultiPool_reclaim,
+		EMTMultiPool_allocBatch,
+		EMTMultiPool_freeBatch,
 		EMTMultiPool_transfer,
 		EMTMultiPool_take,
+		EMTMultiPool_share,
+		EMTMultiPool_stats,
+		EMTMultiPool_rebalance,
 	};
 
 	return &sOps;
@@ -12,12 +12,50 @@ typedef const EMTMULTIPOOLOPS * PCEMTMULTIPOOLOPS;
 typedef struct _EMTMULTIPOOLCONFIG EMTMULTIPOOLCONFIG, * PEMTMULTIPOOLCONFIG;
 typedef struct _EMTMULTIPOOL EMTMULTIPOOL, * PEMTMULTIPOOL;
 typedef struct _EMTMULTIPOOLMETA EMTMULTIPOOLMETA, *PEMTMULTIPOOLMETA;
+typedef struct _EMTMULTIPOOLSEGMENTOPS EMTMULTIPOOLSEGMENTOPS, * PEMTMULTIPOOLSEGMENTOPS;
+typedef const EMTMULTIPOOLSEGMENTOPS * PCEMTMULTIPOOLSEGMENTOPS;
+typedef struct _EMTMULTIPOOLSEGMENT EMTMULTIPOOLSEGMENT, * PEMTMULTIPOOLSEGMENT;
+typedef struct _EMTMULTIPOOLSTATS EMTMULTIPOOLSTATS, * PEMTMULTIPOOLSTATS;
+
+enum
+{
+	/* Extra segments added when a size class runs dry, each holds one more pool of that class */
+	kEMTMultiPoolSegments = 64,
+
+	/* A class borrowing more than 1/8 of its allocations from larger classes gets a segment of its own */
+	kEMTMultiPoolBorrowShift = 3,
+
+	/* Layout shared with every peer, the memory map has one pool id per page and tokens carry the pool id on top */
+	kEMTMultiPoolPageShift = 12,
+	kEMTMultiPoolPoolIdShift = 24,
+	kEMTMultiPoolTokenMask = (1 << 24) - 1,
+	kEMTMultiPoolInvalidToken = ~0x0,
+};
+
+/*
+ * How the allocations of one class were served, counted in blocks by this process only.
+ * Threads bump them without locking, so they are close but not exact under contention.
+ * Packed to 4 so the configs still start right after an EMTMULTIPOOL on 32-bit builds.
+ */
+#pragma pack(push, 4)
+struct _EMTMULTIPOOLSTATS
+{
+	uint64_t uNatural; /* the class's own pool */
+	uint64_t uSegment; /* segments added for the class */
+	uint64_t uSpill; /* borrowed from a larger class */
+	uint64_t uLent; /* handed to smaller classes */
+	uint64_t uGrow; /* segments added */
+	uint64_t uMiss; /* nothing left, the caller falls back */
+	uint64_t uRebalance; /* passes that stopped, resumed lending or grew the class */
+};
+#pragma pack(pop)
 
 struct _EMTMULTIPOOLOPS
 {
 	void (*calcMetaSize)(PEMTMULTIPOOL pThis, uint32_t * pMetaLen, uint32_t * pMemLen);
 
-	void (*construct)(PEMTMULTIPOOL pThis, void * pMeta, void * pPool);
+	/* Returns the owner id, 0 when every owner slot is taken and the pool refuses to allocate */
+	const uint32_t (*construct)(PEMTMULTIPOOL pThis, void * pMeta, void * pPool);
 	void (*destruct)(PEMTMULTIPOOL pThis);
 
 	const uint32_t (*id)(PEMTMULTIPOOL pThis);
@@ -29,9 +67,24 @@ struct _EMTMULTIPOOLOPS
 	void * (*alloc)(PEMTMULTIPOOL pThis, const uint32_t uMemLen);
 	void (*free)(PEMTMULTIPOOL pThis, void * pMem);
 	void (*freeAll)(PEMTMULTIPOOL pThis, const uint32_t uId);
+	const uint32_t (*reclaim)(PEMTMULTIPOOL pThis, const uint32_t uId);
+
+	const uint32_t (*allocBatch)(PEMTMULTIPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount);
+	void (*freeBatch)(PEMTMULTIPOOL pThis, void ** ppMem, const uint32_t uCount);
 
 	const uint32_t (*transfer)(PEMTMULTIPOOL pThis, void * pMem, const uint32_t uToId);
 	void * (*take)(PEMTMULTIPOOL pThis, const uint32_t uToken);
+	const uint32_t (*share)(PEMTMULTIPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount);
+
+	const PEMTMULTIPOOLSTATS (*stats)(PEMTMULTIPOOL pThis, const uint32_t uPool);
+	const uint32_t (*rebalance)(PEMTMULTIPOOL pThis);
+};
+
+struct _EMTMULTIPOOLSEGMENTOPS
+{
+	/* Create or open segment uSegment of uLen bytes, every process gets the same memory for the same index */
+	void * (*open)(void * pCtx, const uint32_t uSegment, const uint32_t uLen);
+	void (*close)(void * pCtx, const uint32_t uSegment, void * pMem);
 };
 
 struct _EMTMULTIPOOLCONFIG
@@ -40,11 +93,29 @@ struct _EMTMULTIPOOLCONFIG
 	uint32_t uBlockLength;
 	uint32_t uBlockCount;
 	uint32_t uBlockLimit;
+	uint32_t uPoolMode;
+	uint32_t uNumaNodeMask; /* 0 leaves placement to whoever touches first */
+	PEMTPOOLSTATS pStats; /* kEMTPoolOwnerSlots rows, 0 keeps no counters */
 
 	/* Private fields */
 	uint32_t uBlockLimitLength;
+	uint32_t uLend; /* cleared while the class runs dry itself */
+
+	EMTMULTIPOOLSTATS sStats;
+	EMTMULTIPOOLSTATS sMark; /* sStats at the last rebalance */
+
+	EMTPOOL sPool;
+};
 
+struct _EMTMULTIPOOLSEGMENT
+{
+	/* Private fields */
 	EMTPOOL sPool;
+
+	uint8_t * pMem;
+	uint8_t * pMemEnd;
+
+	volatile uint32_t uState;
 };
 
 struct _EMTMULTIPOOL
@@ -60,15 +131,25 @@ struct _EMTMULTIPOOL
 	void * pMem;
 	void * pMemEnd;
 
+	EMTMULTIPOOLSEGMENT sSegment[kEMTMultiPoolSegments];
+	volatile uint32_t uSegmentEnd;
+
+	volatile uint32_t uRebalanceTick;
+	volatile uint32_t uRebalancing;
+
 	/* Public fields - init */
 	uint32_t uPoolCount;
+	PCEMTMULTIPOOLSEGMENTOPS pSegmentOps; /* 0 keeps the pool table fixed */
+	void * pSegmentCtx;
+	uint32_t uSpillClasses; /* larger classes a dry class may borrow from, 0 never borrows */
+	uint32_t uRebalancePeriod; /* allocations between rebalance passes, 0 leaves it to the caller */
 };
 
 EXTERN_C PCEMTMULTIPOOLOPS emtMultiPool(void);
 
 #if !defined(USE_VTABLE) || defined(EMTIMPL_MULTIPOOL)
 EMTIMPL_CALL void EMTMultiPool_calcMetaSize(PEMTMULTIPOOL pThis, uint32_t * pMetaLen, uint32_t * pMemLen);
-EMTIMPL_CALL void EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool);
+EMTIMPL_CALL const uint32_t EMTMultiPool_construct(PEMTMULTIPOOL pThis, void * pMeta, void * pPool);
 EMTIMPL_CALL void EMTMultiPool_destruct(PEMTMULTIPOOL pThis);
 EMTIMPL_CALL const uint32_t EMTMultiPool_id(PEMTMULTIPOOL pThis);
 EMTIMPL_CALL const PEMTPOOL EMTMultiPool_pool(PEMTMULTIPOOL pThis, const uint32_t uPool);
@@ -77,8 +158,14 @@ EMTIMPL_CALL const uint32_t EMTMultiPool_length(PEMTMULTIPOOL pThis, void * pMem
 EMTIMPL_CALL void * EMTMultiPool_alloc(PEMTMULTIPOOL pThis, const uint32_t uMemLen);
 EMTIMPL_CALL void EMTMultiPool_free(PEMTMULTIPOOL pThis, void * pMem);
 EMTIMPL_CALL void EMTMultiPool_freeAll(PEMTMULTIPOOL pThis, const uint32_t uId);
+EMTIMPL_CALL const uint32_t EMTMultiPool_reclaim(PEMTMULTIPOOL pThis, const uint32_t uId);
+EMTIMPL_CALL const uint32_t EMTMultiPool_allocBatch(PEMTMULTIPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount);
+EMTIMPL_CALL void EMTMultiPool_freeBatch(PEMTMULTIPOOL pThis, void ** ppMem, const uint32_t uCount);
 EMTIMPL_CALL const uint32_t EMTMultiPool_transfer(PEMTMULTIPOOL pThis, void * pMem, const uint32_t uToId);
 EMTIMPL_CALL void * EMTMultiPool_take(PEMTMULTIPOOL pThis, const uint32_t uToken);
+EMTIMPL_CALL const uint32_t EMTMultiPool_share(PEMTMULTIPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount);
+EMTIMPL_CALL const PEMTMULTIPOOLSTATS EMTMultiPool_stats(PEMTMULTIPOOL pThis, const uint32_t uPool);
+EMTIMPL_CALL const uint32_t EMTMultiPool_rebalance(PEMTMULTIPOOL pThis);
 #else
 #define EMTMultiPool_calcMetaSize emtMultiPool()->calcMetaSize
 #define EMTMultiPool_construct emtMultiPool()->construct
@@ -90,8 +177,14 @@ EMTIMPL_CALL void * EMTMultiPool_take(PEMTMULTIPOOL pThis, const uint32_t uToken
 #define EMTMultiPool_alloc emtMultiPool()->alloc
 #define EMTMultiPool_free emtMultiPool()->free
 #define EMTMultiPool_freeAll emtMultiPool()->freeAll
+#define EMTMultiPool_reclaim emtMultiPool()->reclaim
+#define EMTMultiPool_allocBatch emtMultiPool()->allocBatch
+#define EMTMultiPool_freeBatch emtMultiPool()->freeBatch
 #define EMTMultiPool_transfer emtMultiPool()->transfer
 #define EMTMultiPool_take emtMultiPool()->take
+#define EMTMultiPool_share emtMultiPool()->share
+#define EMTMultiPool_stats emtMultiPool()->stats
+#define EMTMultiPool_rebalance emtMultiPool()->rebalance
 #endif
 
 #endif // __EMTMULTIPOOL_H__
@@ -0,0 +1,114 @@
+#define EMTIMPL_MULTIPOOLCACHE
+#include "EMTMultiPoolCache.h"
+
+static PEMTMULTIPOOLCACHEMAGAZINE EMTMultiPoolCache_magazine(PEMTMULTIPOOLCACHE pThis, const uint32_t uPool)
+{
+	return uPool < pThis->uMagazineCount ? (PEMTMULTIPOOLCACHEMAGAZINE)(pThis + 1) + uPool : 0;
+}
+
+static void EMTMultiPoolCache_refill(PEMTMULTIPOOLCACHE pThis, PEMTMULTIPOOLCACHEMAGAZINE pMagazine, PEMTPOOL pPool)
+{
+	if (pMagazine->uCount < kEMTMultiPoolCacheBatch)
+		pMagazine->uCount += EMTPool_allocBatch(pPool, EMTPool_blockLength(pPool), pMagazine->pBlock + pMagazine->uCount, kEMTMultiPoolCacheBatch - pMagazine->uCount);
+}
+
+static void EMTMultiPoolCache_drain(PEMTMULTIPOOLCACHE pThis, PEMTMULTIPOOLCACHEMAGAZINE pMagazine, PEMTPOOL pPool, const uint32_t uKeep)
+{
+	if (pMagazine->uCount <= uKeep)
+		return;
+
+	EMTPool_freeBatch(pPool, pMagazine->pBlock + uKeep, pMagazine->uCount - uKeep);
+	pMagazine->uCount = uKeep;
+}
+
+void EMTMultiPoolCache_construct(PEMTMULTIPOOLCACHE pThis, PEMTMULTIPOOL pMultiPool)
+{
+	uint32_t i;
+
+	pThis->pMultiPool = pMultiPool;
+	if (pThis->uMagazineCount > pMultiPool->uPoolCount)
+		pThis->uMagazineCount = pMultiPool->uPoolCount;
+
+	for (i = 0; i < pThis->uMagazineCount; ++i)
+		EMTMultiPoolCache_magazine(pThis, i)->uCount = 0;
+}
+
+void EMTMultiPoolCache_destruct(PEMTMULTIPOOLCACHE pThis)
+{
+	EMTMultiPoolCache_flush(pThis);
+}
+
+void * EMTMultiPoolCache_alloc(PEMTMULTIPOOLCACHE pThis, const uint32_t uMemLen)
+{
+	PEMTMULTIPOOLCACHEMAGAZINE magazine;
+	PEMTPOOL pool = 0;
+	uint32_t i;
+
+	for (i = 0; i < pThis->uMagazineCount; ++i)
+	{
+		pool = EMTMultiPool_pool(pThis->pMultiPool, i);
+		if (uMemLen <= EMTPool_blockLength(pool))
+			break;
+	}
+
+	magazine = EMTMultiPoolCache_magazine(pThis, i);
+	if (magazine == 0)
+		return EMTMultiPool_alloc(pThis->pMultiPool, uMemLen);
+
+	if (magazine->uCount == 0)
+		EMTMultiPoolCache_refill(pThis, magazine, pool);
+
+	if (magazine->uCount == 0)
+		return EMTMultiPool_alloc(pThis->pMultiPool, uMemLen);
+
+	--magazine->uCount;
+	EMTPool_setLength(pool, magazine->pBlock[magazine->uCount], uMemLen);
+	return magazine->pBlock[magazine->uCount];
+}
+
+void EMTMultiPoolCache_free(PEMTMULTIPOOLCACHE pThis, void * pMem)
+{
+	PEMTPOOL pool = EMTMultiPool_poolByMem(pThis->pMultiPool, pMem);
+	PEMTMULTIPOOLCACHEMAGAZINE magazine = 0;
+	uint32_t i;
+
+	for (i = 0; pool && i < pThis->uMagazineCount && magazine == 0; ++i)
+	{
+		if (EMTMultiPool_pool(pThis->pMultiPool, i) == pool)
+			magazine = EMTMultiPoolCache_magazine(pThis, i);
+	}
+
+	// A shared block is not ours to reuse, its free only counts down the readers
+	if (magazine == 0 || EMTPool_readers(pool, pMem) != 0)
+	{
+		EMTMultiPool_free(pThis->pMultiPool, pMem);
+		return;
+	}
+
+	if (magazine->uCount == kEMTMultiPoolCacheMagazineLength)
+		EMTMultiPoolCache_drain(pThis, magazine, pool, kEMTMultiPoolCacheBatch);
+
+	magazine->pBlock[magazine->uCount++] = pMem;
+}
+
+void EMTMultiPoolCache_flush(PEMTMULTIPOOLCACHE pThis)
+{
+	uint32_t i;
+
+	for (i = 0; i < pThis->uMagazineCount; ++i)
+		EMTMultiPoolCache_drain(pThis, EMTMultiPoolCache_magazine(pThis, i), EMTMultiPool_pool(pThis->pMultiPool, i), 0);
+}
+
+PCEMTMULTIPOOLCACHEOPS emtMultiPoolCache(void)
+{
+	static const EMTMULTIPOOLCACHEOPS sOps =
+	{
+		EMTMultiPoolCache_construct,
+		EMTMultiPoolCache_destruct,
+		EMTMultiPoolCache_alloc,
+		EMTMultiPoolCache_free,
+		EMTMultiPoolCache_flush,
+	};
+
+	return &sOps;
+}
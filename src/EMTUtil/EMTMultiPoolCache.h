@@ -0,0 +1,69 @@
+/*
+ * EMT - Enhanced Memory Transfer (not emiria-tan)
+ */
+
+#ifndef __EMTMULTIPOOLCACHE_H__
+#define __EMTMULTIPOOLCACHE_H__
+
+#include "EMTMultiPool.h"
+
+enum
+{
+	kEMTMultiPoolCacheMagazineLength = 64,
+	kEMTMultiPoolCacheBatch = kEMTMultiPoolCacheMagazineLength / 2,
+};
+
+typedef struct _EMTMULTIPOOLCACHEOPS EMTMULTIPOOLCACHEOPS, * PEMTMULTIPOOLCACHEOPS;
+typedef const EMTMULTIPOOLCACHEOPS * PCEMTMULTIPOOLCACHEOPS;
+typedef struct _EMTMULTIPOOLCACHEMAGAZINE EMTMULTIPOOLCACHEMAGAZINE, * PEMTMULTIPOOLCACHEMAGAZINE;
+typedef struct _EMTMULTIPOOLCACHE EMTMULTIPOOLCACHE, * PEMTMULTIPOOLCACHE;
+
+struct _EMTMULTIPOOLCACHEOPS
+{
+	void (*construct)(PEMTMULTIPOOLCACHE pThis, PEMTMULTIPOOL pMultiPool);
+	void (*destruct)(PEMTMULTIPOOLCACHE pThis);
+
+	void * (*alloc)(PEMTMULTIPOOLCACHE pThis, const uint32_t uMemLen);
+	void (*free)(PEMTMULTIPOOLCACHE pThis, void * pMem);
+	void (*flush)(PEMTMULTIPOOLCACHE pThis);
+};
+
+struct _EMTMULTIPOOLCACHEMAGAZINE
+{
+	/* Private fields */
+	uint32_t uCount;
+	void * pBlock[kEMTMultiPoolCacheMagazineLength];
+};
+
+/*
+ * A cache belongs to exactly one thread. Blocks sitting in a magazine stay
+ * owned by the multi pool id, so alloc and free hit only thread-local memory
+ * until a magazine runs empty or full and is refilled or flushed in a batch.
+ * The magazines follow the structure, one per cached size class.
+ */
+struct _EMTMULTIPOOLCACHE
+{
+	/* Private fields */
+	PEMTMULTIPOOL pMultiPool;
+
+	/* Public fields - init */
+	uint32_t uMagazineCount;
+};
+
+EXTERN_C PCEMTMULTIPOOLCACHEOPS emtMultiPoolCache(void);
+
+#if !defined(USE_VTABLE) || defined(EMTIMPL_MULTIPOOLCACHE)
+EMTIMPL_CALL void EMTMultiPoolCache_construct(PEMTMULTIPOOLCACHE pThis, PEMTMULTIPOOL pMultiPool);
+EMTIMPL_CALL void EMTMultiPoolCache_destruct(PEMTMULTIPOOLCACHE pThis);
+EMTIMPL_CALL void * EMTMultiPoolCache_alloc(PEMTMULTIPOOLCACHE pThis, const uint32_t uMemLen);
+EMTIMPL_CALL void EMTMultiPoolCache_free(PEMTMULTIPOOLCACHE pThis, void * pMem);
+EMTIMPL_CALL void EMTMultiPoolCache_flush(PEMTMULTIPOOLCACHE pThis);
+#else
+#define EMTMultiPoolCache_construct emtMultiPoolCache()->construct
+#define EMTMultiPoolCache_destruct emtMultiPoolCache()->destruct
+#define EMTMultiPoolCache_alloc emtMultiPoolCache()->alloc
+#define EMTMultiPoolCache_free emtMultiPoolCache()->free
+#define EMTMultiPoolCache_flush emtMultiPoolCache()->flush
+#endif
+
+#endif // __EMTMULTIPOOLCACHE_H__
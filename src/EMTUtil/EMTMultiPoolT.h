@@ -0,0 +1,244 @@
+/*
+ * EMT - Enhanced Memory Transfer (not emiria-tan)
+ */
+
+#ifndef __EMTMULTIPOOLT_H__
+#define __EMTMULTIPOOLT_H__
+
+#include "EMTMultiPool.h"
+
+#include <utility>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/*
+ * One size class fixed at compile time. The block length is a power of two so
+ * block math is a shift, and the pool covers whole pages of the memory map.
+ */
+template <uint32_t BlockLength, uint32_t BlockCount, uint32_t BlockLimit = 4, uint32_t PoolMode = kEMTPoolModeBitmap>
+struct EMTPoolClassT
+{
+	static_assert(BlockLength != 0 && (BlockLength & (BlockLength - 1)) == 0, "block length must be a power of two");
+	static_assert(BlockCount != 0 && BlockCount - 1 <= kEMTMultiPoolTokenMask, "block count must fit in a token");
+	static_assert((uint64_t)BlockLength * BlockCount % (1 << kEMTMultiPoolPageShift) == 0, "pool memory must fill whole pages");
+	static_assert((uint64_t)BlockLength * BlockLimit <= 0xFFFFFFFF, "limit length must fit in 32 bits");
+
+	static constexpr uint32_t shiftOf(const uint32_t uLength) { return uLength > 1 ? 1 + shiftOf(uLength >> 1) : 0; }
+
+	static constexpr uint32_t kBlockLength = BlockLength;
+	static constexpr uint32_t kBlockCount = BlockCount;
+	static constexpr uint32_t kBlockLimit = BlockLimit;
+	static constexpr uint32_t kPoolMode = PoolMode;
+	static constexpr uint32_t kBlockShift = shiftOf(BlockLength);
+	static constexpr uint32_t kLimitLength = BlockLength * BlockLimit;
+};
+
+template <class Pool, class Buckets>
+struct EMTMultiPoolBucketT;
+
+/*
+ * EMTMultiPool with the class table baked in. Class selection is a table lookup on
+ * the highest bit of the length, addresses and tokens turn into blocks with shifts,
+ * and only the calls that touch shared allocator state go out to the C pools.
+ * Construct builds the C table from the same classes, so the segment is laid out
+ * exactly as EMTMultiPool_construct would lay it out and a C peer configured with
+ * config() can join it and exchange tokens.
+ */
+template <class... Classes>
+class EMTMultiPoolT
+{
+public:
+	enum : uint32_t
+	{
+		kPoolCount = sizeof...(Classes),
+		kBucketCount = 33, /* lengths up to 1, then one per power of two up to 2^32 */
+	};
+
+	static_assert(kPoolCount != 0 && kPoolCount < 256, "pool ids are one byte in the memory map");
+
+	EMTMultiPoolT() : mMultiPool(), mConfig(), mPoolBase()
+	{
+		const EMTMULTIPOOLCONFIG config[kPoolCount] = { { Classes::kBlockLength, Classes::kBlockCount, Classes::kBlockLimit, Classes::kPoolMode }... };
+
+		static_assert(ascending(0), "size classes must be ordered by block length times limit");
+
+		for (uint32_t i = 0; i < kPoolCount; ++i)
+			mConfig[i] = config[i];
+		mMultiPool.uPoolCount = kPoolCount;
+	}
+
+	EMTMultiPoolT(const EMTMultiPoolT &) = delete;
+	EMTMultiPoolT & operator=(const EMTMultiPoolT &) = delete;
+
+	/* The C view, for its public init fields and for the C helpers built on it */
+	PEMTMULTIPOOL multiPool() { return &mMultiPool; }
+	PEMTMULTIPOOLCONFIG config(const uint32_t uPool) { return mConfig + uPool; }
+
+	void calcMetaSize(uint32_t * pMetaLen, uint32_t * pMemLen) { EMTMultiPool_calcMetaSize(&mMultiPool, pMetaLen, pMemLen); }
+
+	/* Returns the owner id, 0 when every owner slot is taken */
+	uint32_t construct(void * pMeta, void * pPool)
+	{
+		const uint32_t uId = EMTMultiPool_construct(&mMultiPool, pMeta, pPool);
+
+		for (uint32_t i = 0; i < kPoolCount; ++i)
+			mPoolBase[i] = (uint8_t *)EMTPool_address(&mConfig[i].sPool);
+
+		return uId;
+	}
+
+	void destruct() { EMTMultiPool_destruct(&mMultiPool); }
+	uint32_t id() const { return mMultiPool.uId; }
+
+	static uint32_t poolOf(const uint32_t uMemLen)
+	{
+		uint32_t uPool = EMTMultiPoolBucketT<EMTMultiPoolT, std::make_index_sequence<kBucketCount>>::kPool[bucketOf(uMemLen)];
+
+		while (uMemLen > kLimitLength[uPool])
+			++uPool;
+
+		return uPool;
+	}
+
+	void * alloc(const uint32_t uMemLen)
+	{
+		if (uMemLen > kLimitLength[kPoolCount - 1] || mMultiPool.uId == 0)
+			return 0;
+
+		const uint32_t uPool = poolOf(uMemLen);
+		void * pMem = EMTPool_alloc(&mConfig[uPool].sPool, uMemLen);
+
+		// Segments, spilling and misses are the C pool's business
+		if (pMem == 0)
+			return EMTMultiPool_alloc(&mMultiPool, uMemLen);
+
+		++mConfig[uPool].sStats.uNatural;
+		tick();
+		return pMem;
+	}
+
+	uint32_t allocBatch(const uint32_t uMemLen, void ** ppMem, const uint32_t uCount)
+	{
+		if (uMemLen > kLimitLength[kPoolCount - 1] || mMultiPool.uId == 0)
+			return 0;
+
+		const uint32_t uPool = poolOf(uMemLen);
+		const uint32_t uDone = EMTPool_allocBatch(&mConfig[uPool].sPool, uMemLen, ppMem, uCount);
+
+		mConfig[uPool].sStats.uNatural += uDone;
+		if (uDone < uCount)
+			return uDone + EMTMultiPool_allocBatch(&mMultiPool, uMemLen, ppMem + uDone, uCount - uDone);
+
+		tick();
+		return uDone;
+	}
+
+	void free(void * pMem)
+	{
+		const uint32_t uPool = poolOfMem(pMem);
+		uPool < kPoolCount ? EMTPool_free(&mConfig[uPool].sPool, pMem) : EMTMultiPool_free(&mMultiPool, pMem);
+	}
+
+	void freeBatch(void ** ppMem, const uint32_t uCount) { EMTMultiPool_freeBatch(&mMultiPool, ppMem, uCount); }
+
+	uint32_t length(void * pMem)
+	{
+		const uint32_t uPool = poolOfMem(pMem);
+		return uPool < kPoolCount ? mConfig[uPool].sPool.pAllocLen[blockOf(uPool, pMem)] : EMTMultiPool_length(&mMultiPool, pMem);
+	}
+
+	uint32_t transfer(void * pMem, const uint32_t uToId)
+	{
+		const uint32_t uPool = poolOfMem(pMem);
+
+		if (uPool >= kPoolCount)
+			return EMTMultiPool_transfer(&mMultiPool, pMem, uToId);
+
+		return (uPool << kEMTMultiPoolPoolIdShift) | (EMTPool_transfer(&mConfig[uPool].sPool, pMem, uToId) & kEMTMultiPoolTokenMask);
+	}
+
+	void * take(const uint32_t uToken)
+	{
+		const uint32_t uPool = uToken >> kEMTMultiPoolPoolIdShift;
+		const uint32_t uBlock = uToken & kEMTMultiPoolTokenMask;
+
+		if (uPool >= kPoolCount)
+			return EMTMultiPool_take(&mMultiPool, uToken);
+
+		// Tokens come from other processes, the pool checks them against the layout in the shared meta
+		return EMTPool_take(&mConfig[uPool].sPool, uBlock);
+	}
+
+	static constexpr uint8_t bucketPool(const uint32_t uBucket) { return (uint8_t)firstFit(uBucket ? (1ULL << (uBucket - 1)) + 1 : 0, 0); }
+
+private:
+	static constexpr uint32_t kLimitLength[kPoolCount] = { Classes::kLimitLength... };
+	static constexpr uint32_t kBlockShift[kPoolCount] = { Classes::kBlockShift... };
+
+	static constexpr uint32_t firstFit(const uint64_t uMemLen, const uint32_t uPool)
+	{
+		return uPool + 1 >= kPoolCount || kLimitLength[uPool] >= uMemLen ? uPool : firstFit(uMemLen, uPool + 1);
+	}
+
+	static constexpr bool ascending(const uint32_t uPool)
+	{
+		return uPool + 1 >= kPoolCount || (kLimitLength[uPool] < kLimitLength[uPool + 1] && ascending(uPool + 1));
+	}
+
+	static uint32_t bucketOf(const uint32_t uMemLen)
+	{
+		if (uMemLen <= 1)
+			return 0;
+
+#if defined(_MSC_VER)
+		unsigned long uBit;
+		_BitScanReverse(&uBit, uMemLen - 1);
+		return uBit + 1;
+#else
+		return 32 - __builtin_clz(uMemLen - 1);
+#endif
+	}
+
+	uint32_t poolOfMem(void * pMem) const
+	{
+		const uint8_t * mem = (const uint8_t *)pMem;
+
+		if (mem < (const uint8_t *)mMultiPool.pMem || mem >= (const uint8_t *)mMultiPool.pMemEnd)
+			return kPoolCount;
+
+		return mMultiPool.pMemMap[(size_t)(mem - (const uint8_t *)mMultiPool.pMem) >> kEMTMultiPoolPageShift];
+	}
+
+	uint32_t blockOf(const uint32_t uPool, void * pMem) const
+	{
+		return (uint32_t)((size_t)((uint8_t *)pMem - mPoolBase[uPool]) >> kBlockShift[uPool]);
+	}
+
+	void tick()
+	{
+		if (mMultiPool.uRebalancePeriod && (int32_t)--mMultiPool.uRebalanceTick <= 0)
+			EMTMultiPool_rebalance(&mMultiPool);
+	}
+
+	/* EMTMultiPool_construct expects the configs right after the multi pool */
+	EMTMULTIPOOL mMultiPool;
+	EMTMULTIPOOLCONFIG mConfig[kPoolCount];
+
+	uint8_t * mPoolBase[kPoolCount];
+};
+
+template <class... Classes> constexpr uint32_t EMTMultiPoolT<Classes...>::kLimitLength[];
+template <class... Classes> constexpr uint32_t EMTMultiPoolT<Classes...>::kBlockShift[];
+
+template <class Pool, size_t... Bucket>
+struct EMTMultiPoolBucketT<Pool, std::index_sequence<Bucket...>>
+{
+	static const uint8_t kPool[sizeof...(Bucket)];
+};
+
+template <class Pool, size_t... Bucket>
+const uint8_t EMTMultiPoolBucketT<Pool, std::index_sequence<Bucket...>>::kPool[sizeof...(Bucket)] = { Pool::bucketPool(Bucket)... };
+
+#endif // __EMTMULTIPOOLT_H__
@@ -1,20 +1,57 @@
 #define EMTIMPL_POOL
 #include "EMTPool.h"
 
+typedef struct _EMTPOOLOWNERMAP EMTPOOLOWNERMAP, * PEMTPOOLOWNERMAP;
+typedef struct _EMTPOOLSHARE EMTPOOLSHARE, * PEMTPOOLSHARE;
+
+enum
+{
+	/* Chunks the pool is cut into for owner maps, a power of two */
+	kEMTPoolOwnerChunks = 64,
+	kEMTPoolOwnerMapWords = kEMTPoolOwnerChunks / 32,
+
+	/* Blocks out to readers at once, a power of two */
+	kEMTPoolShareSlots = 256,
+	kEMTPoolShareReaderWords = kEMTPoolOwnerSlots / 32,
+};
+
 #pragma pack(push, 1)
-struct _EMTPOOLBLOCKMETA
+/* Blocks an owner slot holds in each chunk of the pool, and a bit for every chunk where that is not 0 */
+struct _EMTPOOLOWNERMAP
 {
-	volatile uint32_t uOwner;
-	volatile uint32_t uLen;
-	uint32_t uAllocLen;
+	volatile uint32_t uChunk[kEMTPoolOwnerMapWords];
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(uint32_t) * kEMTPoolOwnerMapWords];
+	volatile uint32_t uHeld[kEMTPoolOwnerChunks];
 };
 
-struct _EMTPOOLMETA
+/* A shared block and the owner slots still holding a reference to it, one cache line */
+struct _EMTPOOLSHARE
 {
-	volatile uint32_t uNextBlock;
+	volatile uint32_t uBlock; /* block + 1, 0 while the entry is free */
+	volatile uint32_t uCount;
+	volatile uint32_t uReader[kEMTPoolShareReaderWords];
+	uint8_t uReserved[kEMTPoolCacheLine - sizeof(uint32_t) * (2 + kEMTPoolShareReaderWords)];
+};
 
+struct _EMTPOOLMETA
+{
+	/* Read-mostly config, one cache line */
+	uint32_t uVersion;
 	uint32_t uBlockLen;
 	uint32_t uBlockCount;
+	uint32_t uMode;
+	uint32_t uNumaNodeMask;
+	uint8_t uReserved0[kEMTPoolCacheLine - sizeof(uint32_t) * 5];
+
+	/* Allocation cursor on its own cache line, next block in the low half and a tag bumped by every move above it */
+	volatile uint64_t uCursor;
+	uint8_t uReserved1[kEMTPoolCacheLine - sizeof(uint64_t)];
+
+	/* Where each owner slot holds blocks, freeAll scans only those chunks */
+	EMTPOOLOWNERMAP sOwner[kEMTPoolOwnerSlots];
+
+	/* Blocks handed to readers, pShare points each one at its entry */
+	EMTPOOLSHARE sShare[kEMTPoolShareSlots];
 };
 #pragma pack(pop)
 
@@ -28,6 +65,17 @@ enum
 	kEMTPoolError = 0x80000000,
 	kEMTPoolOutOfRange,
 	kEMTPoolNotOwner,
+
+	kEMTPoolBitmapShift = 5,
+	kEMTPoolBitmapBits = 1 << kEMTPoolBitmapShift,
+	kEMTPoolBitmapMask = kEMTPoolBitmapBits - 1,
+
+	kEMTPoolInvalidBlock = ~0,
+
+	/* Owner of blocks merged into a scan-mode run, slot 0 belongs to no owner id */
+	kEMTPoolOwnerInner = ~kEMTPoolOwnerSlotMask,
+
+	kEMTPoolLayoutVersion = 9,
 };
 
 static const uint32_t EMTPool_blockFromAddress(PEMTPOOL pThis, void * pMem)
@@ -35,23 +83,729 @@ static const uint32_t EMTPool_blockFromAddress(PEMTPOOL pThis, void * pMem)
 	return (uint32_t)(((uint8_t *)pMem - (uint8_t *)pThis->pPool) / pThis->pMeta->uBlockLen);
 }
 
+static const uint64_t EMTPool_cursor(const uint32_t uBlock, const uint64_t uCursorOld)
+{
+	return ((uCursorOld >> 32) + 1) << 32 | uBlock;
+}
+
 static int32_t EMTPool_validation(PEMTPOOL pThis, void * pMem)
 {
 	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
-	PEMTPOOLBLOCKMETA pBlockMeta = pThis->pBlockMeta + uBlock;
 
 	if (uBlock >= pThis->pMeta->uBlockCount)
 		return kEMTPoolOutOfRange;
 
-	//if (pBlockMeta->owner != pThis->uId)
+	//if (pThis->pOwner[uBlock] != pThis->uId)
 	//	return kEMTPoolNotOwner;
 
 	return kEMTPoolNoError;
 }
 
+static const uint32_t EMTPool_bitmapWords(const uint32_t uBits)
+{
+	return (uBits + kEMTPoolBitmapMask) >> kEMTPoolBitmapShift;
+}
+
+static const uint32_t EMTPool_lineWords(const uint32_t uWords)
+{
+	const uint32_t uLineWords = kEMTPoolCacheLine / sizeof(uint32_t);
+	return (uWords + uLineWords - 1) & ~(uLineWords - 1);
+}
+
+static const uint32_t EMTPool_bitmapMask(const uint32_t uStart, const uint32_t uCount)
+{
+	return (uCount == kEMTPoolBitmapBits ? ~0U : (1U << uCount) - 1) << uStart;
+}
+
+static PEMTPOOLSTATS EMTPool_stats(PEMTPOOL pThis)
+{
+	return pThis->pStats ? pThis->pStats + (pThis->uId & kEMTPoolOwnerSlotMask) : 0;
+}
+
+static void EMTPool_statsSample(PEMTPOOL pThis, PEMTPOOLSTATS pStats)
+{
+	uint64_t uInUse = 0;
+	uint64_t uHighWater;
+	uint32_t i;
+
+	for (i = 0; i < kEMTPoolOwnerSlots; ++i)
+		uInUse += pThis->pStats[i].uAlloc - pThis->pStats[i].uFree;
+
+	// Rows are read while others write them, drop sums that cannot be right
+	if (uInUse > pThis->pMeta->uBlockCount)
+		return;
+
+	do
+	{
+		uHighWater = pStats->uHighWater;
+	} while (uInUse > uHighWater && rt_cmpXchg64(&pStats->uHighWater, uInUse, uHighWater) != uHighWater);
+}
+
+static void EMTPool_statsAlloc(PEMTPOOL pThis, void ** ppMem, const uint32_t uDone, const uint32_t uCount)
+{
+	PEMTPOOLSTATS stats = EMTPool_stats(pThis);
+	uint64_t uBlocks = 0;
+	uint64_t uAlloc;
+	uint32_t i;
+
+	if (stats == 0)
+		return;
+
+	for (i = 0; i < uDone; ++i)
+		uBlocks += pThis->pLen[EMTPool_blockFromAddress(pThis, ppMem[i])];
+
+	// Every thread of the process writes the row, plain increments would lose counts for good
+	uAlloc = rt_add64(&stats->uAlloc, uDone);
+	rt_add64(&stats->uBytesAlloc, uBlocks * pThis->pMeta->uBlockLen);
+
+	if (uDone < uCount)
+		rt_add64(&stats->uFail, 1);
+
+	if (uDone < uCount || (uAlloc >> kEMTPoolStatsSampleShift) != ((uAlloc + uDone) >> kEMTPoolStatsSampleShift))
+		EMTPool_statsSample(pThis, stats);
+}
+
+static void EMTPool_statsFree(PEMTPOOL pThis, const uint32_t uBlocks)
+{
+	PEMTPOOLSTATS stats = EMTPool_stats(pThis);
+
+	if (stats == 0)
+		return;
+
+	rt_add64(&stats->uFree, 1);
+	rt_add64(&stats->uBytesFree, (uint64_t)uBlocks * pThis->pMeta->uBlockLen);
+}
+
+static uint32_t EMTPool_statsRetry(PEMTPOOL pThis)
+{
+	PEMTPOOLSTATS stats = EMTPool_stats(pThis);
+
+	if (stats)
+		rt_add64(&stats->uRetry, 1);
+
+	return 1;
+}
+
+static uint32_t EMTPool_atomicOr(volatile uint32_t * pDest, const uint32_t uMask)
+{
+	uint32_t uOld;
+	do
+	{
+		uOld = *pDest;
+	} while ((uOld & uMask) != uMask && rt_cmpXchg32(pDest, uOld | uMask, uOld) != uOld);
+
+	return uOld;
+}
+
+static void EMTPool_summarySet(PEMTPOOL pThis, const uint32_t uWord)
+{
+	EMTPool_atomicOr(pThis->pSummary + (uWord >> kEMTPoolBitmapShift), 1U << (uWord & kEMTPoolBitmapMask));
+}
+
+static void EMTPool_summaryClear(PEMTPOOL pThis, const uint32_t uWord)
+{
+	volatile uint32_t * pSummary = pThis->pSummary + (uWord >> kEMTPoolBitmapShift);
+	const uint32_t uMask = 1U << (uWord & kEMTPoolBitmapMask);
+	uint32_t uOld;
+
+	do
+	{
+		uOld = *pSummary;
+	} while ((uOld & uMask) && rt_cmpXchg32(pSummary, uOld & ~uMask, uOld) != uOld);
+
+	// A release may have refilled the word before the summary bit went down
+	if (pThis->pBitmap[uWord] != 0)
+		EMTPool_atomicOr(pSummary, uMask);
+}
+
+static void EMTPool_bitmapReleaseWord(PEMTPOOL pThis, const uint32_t uWord, const uint32_t uMask)
+{
+	EMTPool_atomicOr(pThis->pBitmap + uWord, uMask);
+	EMTPool_summarySet(pThis, uWord);
+}
+
+static void EMTPool_bitmapRelease(PEMTPOOL pThis, const uint32_t uBlock, const uint32_t uBlocks)
+{
+	const uint32_t uEnd = uBlock + uBlocks;
+	uint32_t uCur = uBlock;
+
+	while (uCur < uEnd)
+	{
+		const uint32_t uWord = uCur >> kEMTPoolBitmapShift;
+		const uint32_t uStart = uCur & kEMTPoolBitmapMask;
+		const uint32_t uCount = uEnd - uCur < kEMTPoolBitmapBits - uStart ? uEnd - uCur : kEMTPoolBitmapBits - uStart;
+
+		EMTPool_bitmapReleaseWord(pThis, uWord, EMTPool_bitmapMask(uStart, uCount));
+
+		uCur += uCount;
+	}
+}
+
+static uint32_t EMTPool_bitmapClaim(PEMTPOOL pThis, const uint32_t uBlock, const uint32_t uBlocks)
+{
+	const uint32_t uEnd = uBlock + uBlocks;
+	uint32_t uCur = uBlock;
+
+	while (uCur < uEnd)
+	{
+		const uint32_t uWord = uCur >> kEMTPoolBitmapShift;
+		const uint32_t uStart = uCur & kEMTPoolBitmapMask;
+		const uint32_t uCount = uEnd - uCur < kEMTPoolBitmapBits - uStart ? uEnd - uCur : kEMTPoolBitmapBits - uStart;
+		const uint32_t uMask = EMTPool_bitmapMask(uStart, uCount);
+		volatile uint32_t * pWord = pThis->pBitmap + uWord;
+		uint32_t uOld;
+
+		do
+		{
+			uOld = *pWord;
+		} while ((uOld & uMask) == uMask && rt_cmpXchg32(pWord, uOld & ~uMask, uOld) != uOld && EMTPool_statsRetry(pThis));
+
+		if ((uOld & uMask) != uMask)
+		{
+			EMTPool_statsRetry(pThis);
+			EMTPool_bitmapRelease(pThis, uBlock, uCur - uBlock);
+			return 0;
+		}
+
+		if ((uOld & ~uMask) == 0)
+			EMTPool_summaryClear(pThis, uWord);
+
+		uCur += uCount;
+	}
+
+	return 1;
+}
+
+static uint32_t EMTPool_bitmapRuns(PEMTPOOL pThis, const uint32_t uWord, const uint32_t uBlocks)
+{
+	uint64_t uRuns = pThis->pBitmap[uWord];
+	uint32_t uLen = 1;
+
+	// Runs may start in this word and continue into the next one
+	if (uWord + 1 < EMTPool_bitmapWords(pThis->pMeta->uBlockCount))
+		uRuns |= (uint64_t)pThis->pBitmap[uWord + 1] << kEMTPoolBitmapBits;
+
+	while (uLen < uBlocks)
+	{
+		const uint32_t uShift = uLen < uBlocks - uLen ? uLen : uBlocks - uLen;
+		uRuns &= uRuns >> uShift;
+		uLen += uShift;
+	}
+
+	return (uint32_t)uRuns;
+}
+
+static uint32_t EMTPool_bitmapClaimWord(PEMTPOOL pThis, const uint32_t uWord, const uint32_t uBlocks, uint32_t * pStart, const uint32_t uCount)
+{
+	volatile uint32_t * pWord = pThis->pBitmap + uWord;
+	uint32_t uOld, uClaim, uClaimed;
+
+	// Pick as many disjoint runs inside the word as wanted and take them with one CAS
+	do
+	{
+		uint32_t uRuns = uOld = *pWord;
+		uint32_t uLen = 1;
+
+		while (uLen < uBlocks)
+		{
+			const uint32_t uShift = uLen < uBlocks - uLen ? uLen : uBlocks - uLen;
+			uRuns &= uRuns >> uShift;
+			uLen += uShift;
+		}
+
+		uClaim = 0;
+		uClaimed = 0;
+		while (uRuns && uClaimed < uCount)
+		{
+			const uint32_t uStart = rt_bitScan32(uRuns);
+
+			uClaim |= EMTPool_bitmapMask(uStart, uBlocks);
+			pStart[uClaimed++] = uStart;
+			uRuns &= ~EMTPool_bitmapMask(0, uStart + uBlocks);
+		}
+	} while (uClaim && rt_cmpXchg32(pWord, uOld & ~uClaim, uOld) != uOld && EMTPool_statsRetry(pThis));
+
+	if (uClaim && (uOld & ~uClaim) == 0)
+		EMTPool_summaryClear(pThis, uWord);
+
+	return uClaimed;
+}
+
+static const uint32_t EMTPool_numaPartStart(const uint32_t uBlockCount, const uint32_t uPart, const uint32_t uParts)
+{
+	return (uint32_t)((uint64_t)uBlockCount * uPart / uParts);
+}
+
+static void EMTPool_numaPlace(PEMTPOOL pThis, const uint32_t uBlockCount, const uint32_t uBlockLen)
+{
+	uint32_t uParts = 0;
+	uint32_t uBits, i;
+
+	for (uBits = pThis->uNumaNodeMask; uBits; uBits &= uBits - 1)
+		++uParts;
+
+	// Split the pool evenly over the nodes, each part first-touched from its own node
+	for (uBits = pThis->uNumaNodeMask, i = 0; uBits; uBits &= uBits - 1, ++i)
+	{
+		const uint32_t uStart = EMTPool_numaPartStart(uBlockCount, i, uParts);
+		const uint32_t uEnd = EMTPool_numaPartStart(uBlockCount, i + 1, uParts);
+
+		rt_numaTouch((uint8_t *)pThis->pPool + uBlockLen * uStart, uBlockLen * (uEnd - uStart), rt_bitScan32(uBits));
+	}
+}
+
+static const uint32_t EMTPool_bitmapHint(PEMTPOOL pThis)
+{
+	const uint32_t uMask = pThis->pMeta->uNumaNodeMask;
+	uint32_t uHint = (uint32_t)pThis->pMeta->uCursor;
+
+	if (uMask != 0)
+	{
+		const uint32_t uNode = rt_numaNode();
+		uint32_t uPart = 0;
+		uint32_t uParts = 0;
+		uint32_t uBits;
+
+		for (uBits = uMask; uBits; uBits &= uBits - 1, ++uParts)
+			uPart += rt_bitScan32(uBits) < uNode;
+
+		// Start from the part local to the caller, the scan still wraps into remote parts
+		if (uNode < kEMTPoolBitmapBits && (uMask & (1U << uNode)))
+			uHint = EMTPool_numaPartStart(pThis->pMeta->uBlockCount, uPart, uParts);
+	}
+
+	return uHint < pThis->pMeta->uBlockCount ? uHint >> (kEMTPoolBitmapShift * 2) : 0;
+}
+
+static const uint32_t EMTPool_bitmapFindLong(PEMTPOOL pThis, const uint32_t uBlocks)
+{
+	const uint32_t uWords = EMTPool_bitmapWords(pThis->pMeta->uBlockCount);
+	uint32_t uStart = 0;
+	uint32_t uLen = 0;
+	uint32_t i;
+
+	for (i = 0; i < uWords; ++i)
+	{
+		const uint32_t uBits = pThis->pBitmap[i];
+
+		if (uLen == 0)
+			uStart = i << kEMTPoolBitmapShift;
+
+		if (uBits == ~0U)
+		{
+			uLen += kEMTPoolBitmapBits;
+		}
+		else
+		{
+			uLen += rt_bitScan32(~uBits);
+			if (uLen < uBlocks)
+			{
+				uLen = (uBits >> kEMTPoolBitmapMask) ? kEMTPoolBitmapMask - rt_bitScanReverse32(~uBits) : 0;
+				uStart = ((i + 1) << kEMTPoolBitmapShift) - uLen;
+			}
+		}
+
+		if (uLen >= uBlocks)
+		{
+			if (EMTPool_bitmapClaim(pThis, uStart, uBlocks))
+				return uStart;
+
+			uLen = 0;
+		}
+	}
+
+	return kEMTPoolInvalidBlock;
+}
+
+static const uint32_t EMTPool_bitmapFind(PEMTPOOL pThis, const uint32_t uBlocks)
+{
+	const uint32_t uSummaryWords = EMTPool_bitmapWords(EMTPool_bitmapWords(pThis->pMeta->uBlockCount));
+	const uint32_t uFirst = EMTPool_bitmapHint(pThis);
+	uint32_t i;
+
+	if (uBlocks > kEMTPoolBitmapBits)
+		return EMTPool_bitmapFindLong(pThis, uBlocks);
+
+	for (i = 0; i < uSummaryWords; ++i)
+	{
+		const uint32_t uSummary = uFirst + i < uSummaryWords ? uFirst + i : uFirst + i - uSummaryWords;
+		uint32_t uWords = pThis->pSummary[uSummary];
+
+		while (uWords)
+		{
+			const uint32_t uWord = (uSummary << kEMTPoolBitmapShift) + rt_bitScan32(uWords);
+			uint32_t uRuns = EMTPool_bitmapRuns(pThis, uWord, uBlocks);
+
+			while (uRuns)
+			{
+				const uint32_t uBlock = (uWord << kEMTPoolBitmapShift) + rt_bitScan32(uRuns);
+				if (EMTPool_bitmapClaim(pThis, uBlock, uBlocks))
+					return uBlock;
+
+				uRuns &= uRuns - 1;
+			}
+
+			uWords &= uWords - 1;
+		}
+	}
+
+	return kEMTPoolInvalidBlock;
+}
+
+static const uint32_t EMTPool_buddyOrders(const uint32_t uBlockCount)
+{
+	return uBlockCount ? rt_bitScanReverse32(uBlockCount) + 1 : 0;
+}
+
+static const uint32_t EMTPool_buddyWords(const uint32_t uBlockCount, const uint32_t uOrder)
+{
+	uint32_t uWords = 0;
+	uint32_t i;
+
+	for (i = 0; i < uOrder; ++i)
+		uWords += EMTPool_bitmapWords(uBlockCount >> i);
+
+	return uWords;
+}
+
+static const uint32_t EMTPool_indexWords(const uint32_t uBlockCount)
+{
+	const uint32_t uBitmapWords = EMTPool_bitmapWords(uBlockCount);
+	const uint32_t uBuddyWords = EMTPool_buddyWords(uBlockCount, EMTPool_buddyOrders(uBlockCount));
+	const uint32_t uSummaryWords = EMTPool_bitmapWords(uBitmapWords);
+
+	return uBitmapWords + uSummaryWords > uBuddyWords ? uBitmapWords + uSummaryWords : uBuddyWords;
+}
+
+static void EMTPool_buddyPut(PEMTPOOL pThis, uint32_t uOrder, uint32_t uIndex)
+{
+	const uint32_t uOrders = EMTPool_buddyOrders(pThis->pMeta->uBlockCount);
+	volatile uint32_t * pOrder = pThis->pBitmap + EMTPool_buddyWords(pThis->pMeta->uBlockCount, uOrder);
+
+	for (; uOrder < uOrders; pOrder += EMTPool_bitmapWords(pThis->pMeta->uBlockCount >> uOrder++), uIndex >>= 1)
+	{
+		volatile uint32_t * pWord = pOrder + (uIndex >> kEMTPoolBitmapShift);
+		const uint32_t uMask = 1U << (uIndex & kEMTPoolBitmapMask);
+		const uint32_t uBuddyMask = 1U << ((uIndex ^ 1) & kEMTPoolBitmapMask);
+		const uint32_t bHasBuddy = (uIndex ^ 1) < (pThis->pMeta->uBlockCount >> uOrder);
+		uint32_t uOld, uNew;
+
+		// Either take the free buddy for merging or publish ourselves, in one step
+		do
+		{
+			uOld = *pWord;
+			uNew = bHasBuddy && (uOld & uBuddyMask) ? uOld & ~uBuddyMask : uOld | uMask;
+		} while (rt_cmpXchg32(pWord, uNew, uOld) != uOld);
+
+		if ((uNew & uMask) != 0)
+			break;
+	}
+}
+
+static const uint32_t EMTPool_buddyTake(PEMTPOOL pThis, const uint32_t uOrder)
+{
+	const uint32_t uOrderCount = pThis->pMeta->uBlockCount >> uOrder;
+	const uint32_t uWords = EMTPool_bitmapWords(uOrderCount);
+	volatile uint32_t * pOrder = pThis->pBitmap + EMTPool_buddyWords(pThis->pMeta->uBlockCount, uOrder);
+	uint32_t uIndex;
+	uint32_t i;
+
+	if (uOrder >= EMTPool_buddyOrders(pThis->pMeta->uBlockCount))
+		return kEMTPoolInvalidBlock;
+
+	for (i = 0; i < uWords; ++i)
+	{
+		uint32_t uOld = pOrder[i];
+
+		while (uOld != 0)
+		{
+			const uint32_t uMask = uOld & (0 - uOld);
+			if (rt_cmpXchg32(pOrder + i, uOld & ~uMask, uOld) == uOld)
+				return (i << kEMTPoolBitmapShift) + rt_bitScan32(uMask);
+
+			EMTPool_statsRetry(pThis);
+			uOld = pOrder[i];
+		}
+	}
+
+	// Split a block of the next order, keeping the lower half and freeing the upper one
+	uIndex = EMTPool_buddyTake(pThis, uOrder + 1);
+	if (uIndex == kEMTPoolInvalidBlock)
+		return kEMTPoolInvalidBlock;
+
+	EMTPool_buddyPut(pThis, uOrder, uIndex * 2 + 1);
+	return uIndex * 2;
+}
+
+static void * EMTPool_allocScan(PEMTPOOL pThis, const uint32_t uMemLen, const uint32_t uBlocks)
+{
+	uint32_t uBlock = kEMTPoolInvalidBlock;
+	uint32_t uRound = 3;
+	while ((uBlock == kEMTPoolInvalidBlock || pThis->pLen[uBlock] < uBlocks) && uRound)
+	{
+		const uint64_t uCursor = pThis->pMeta->uCursor;
+		const uint32_t uBlockCurP = uBlock != kEMTPoolInvalidBlock ? uBlock + pThis->pLen[uBlock] : (uint32_t)uCursor;
+		const uint32_t uBlockCur = uBlockCurP < pThis->pMeta->uBlockCount ? uBlockCurP : 0;
+		const uint32_t uBlockNextP = uBlockCur + pThis->pLen[uBlockCur];
+		const uint32_t uBlockNext = uBlockNextP < pThis->pMeta->uBlockCount ? uBlockNextP : 0;
+
+		// The cursor may leave uBlockCur and come back while pLen is read, the tag makes that CAS fail
+		const uint32_t bSuccess = (uint32_t)uCursor == uBlockCur
+			&& rt_cmpXchg64(&pThis->pMeta->uCursor, EMTPool_cursor(uBlockNext, uCursor), uCursor) == uCursor
+			&& rt_cmpXchg32(pThis->pOwner + uBlockCur, pThis->uId, 0) == 0;
+
+		if (uBlock != kEMTPoolInvalidBlock && (!bSuccess || uBlockCur != uBlockCurP))
+		{
+			pThis->pOwner[uBlock] = 0;
+			uBlock = kEMTPoolInvalidBlock;
+		}
+
+		if (uBlockNext != uBlockNextP)
+		{
+			--uRound;
+		}
+
+		if (bSuccess)
+		{
+			if (uBlock != kEMTPoolInvalidBlock)
+			{
+				// Inner blocks stay taken for a cursor walking stale lengths onto them, but are no owner's for freeAll
+				pThis->pLen[uBlock] += pThis->pLen[uBlockCur];
+				pThis->pOwner[uBlockCur] = kEMTPoolOwnerInner;
+			}
+			else
+			{
+				uBlock = uBlockCur;
+			}
+		}
+	}
+
+	if (uBlock != kEMTPoolInvalidBlock)
+	{
+		if (pThis->pLen[uBlock] > uBlocks)
+		{
+			pThis->pLen[uBlock + uBlocks] = pThis->pLen[uBlock] - uBlocks;
+			pThis->pOwner[uBlock + uBlocks] = 0;
+			pThis->pLen[uBlock] = uBlocks;
+		}
+		if (pThis->pLen[uBlock] == uBlocks)
+		{
+			pThis->pAllocLen[uBlock] = uMemLen;
+		}
+
+		if (pThis->pLen[uBlock] < uBlocks)
+		{
+			pThis->pOwner[uBlock] = 0;
+			uBlock = kEMTPoolInvalidBlock;
+		}
+	}
+
+	return uBlock != kEMTPoolInvalidBlock ? (uint8_t *)pThis->pPool + pThis->pMeta->uBlockLen * uBlock : 0;
+}
+
+static void * EMTPool_allocBitmap(PEMTPOOL pThis, const uint32_t uMemLen, const uint32_t uBlocks)
+{
+	const uint32_t uBlock = EMTPool_bitmapFind(pThis, uBlocks);
+
+	if (uBlock == kEMTPoolInvalidBlock)
+		return 0;
+
+	pThis->pLen[uBlock] = uBlocks;
+	pThis->pAllocLen[uBlock] = uMemLen;
+	pThis->pOwner[uBlock] = pThis->uId;
+	pThis->pMeta->uCursor = EMTPool_cursor(uBlock + uBlocks, pThis->pMeta->uCursor);
+
+	return (uint8_t *)pThis->pPool + pThis->pMeta->uBlockLen * uBlock;
+}
+
+static const uint32_t EMTPool_allocBatchBitmap(PEMTPOOL pThis, const uint32_t uMemLen, const uint32_t uBlocks, void ** ppMem, const uint32_t uCount)
+{
+	const uint32_t uSummaryWords = EMTPool_bitmapWords(EMTPool_bitmapWords(pThis->pMeta->uBlockCount));
+	const uint32_t uFirst = EMTPool_bitmapHint(pThis);
+	uint32_t uStart[kEMTPoolBitmapBits];
+	uint32_t uDone = 0;
+	uint32_t uBlock = 0;
+	uint32_t i, j;
+
+	for (i = 0; i < uSummaryWords && uDone < uCount && uBlocks <= kEMTPoolBitmapBits; ++i)
+	{
+		const uint32_t uSummary = uFirst + i < uSummaryWords ? uFirst + i : uFirst + i - uSummaryWords;
+		uint32_t uWords = pThis->pSummary[uSummary];
+
+		while (uWords && uDone < uCount)
+		{
+			const uint32_t uWord = (uSummary << kEMTPoolBitmapShift) + rt_bitScan32(uWords);
+			const uint32_t uClaimed = EMTPool_bitmapClaimWord(pThis, uWord, uBlocks, uStart,
+				uCount - uDone < kEMTPoolBitmapBits ? uCount - uDone : kEMTPoolBitmapBits);
+
+			for (j = 0; j < uClaimed; ++j)
+			{
+				uBlock = (uWord << kEMTPoolBitmapShift) + uStart[j];
+				pThis->pLen[uBlock] = uBlocks;
+				pThis->pAllocLen[uBlock] = uMemLen;
+				pThis->pOwner[uBlock] = pThis->uId;
+				ppMem[uDone++] = (uint8_t *)pThis->pPool + pThis->pMeta->uBlockLen * uBlock;
+			}
+
+			uWords &= uWords - 1;
+		}
+	}
+
+	if (uDone)
+		pThis->pMeta->uCursor = EMTPool_cursor(uBlock + uBlocks, pThis->pMeta->uCursor);
+
+	// Runs straddling two words, or longer than a word, go through the single path
+	for (; uDone < uCount; ++uDone)
+	{
+		if ((ppMem[uDone] = EMTPool_allocBitmap(pThis, uMemLen, uBlocks)) == 0)
+			break;
+	}
+
+	return uDone;
+}
+
+static void * EMTPool_allocBuddy(PEMTPOOL pThis, const uint32_t uMemLen, const uint32_t uBlocks)
+{
+	const uint32_t uOrder = uBlocks > 1 ? rt_bitScanReverse32(uBlocks - 1) + 1 : 0;
+	const uint32_t uIndex = EMTPool_buddyTake(pThis, uOrder);
+	const uint32_t uBlock = uIndex << uOrder;
+
+	if (uIndex == kEMTPoolInvalidBlock)
+		return 0;
+
+	pThis->pLen[uBlock] = 1U << uOrder;
+	pThis->pAllocLen[uBlock] = uMemLen;
+	pThis->pOwner[uBlock] = pThis->uId;
+
+	return (uint8_t *)pThis->pPool + pThis->pMeta->uBlockLen * uBlock;
+}
+
+/* Counts a block the owner now holds, the first one in a chunk marks it */
+static void EMTPool_ownerHold(PEMTPOOL pThis, const uint32_t uOwner, const uint32_t uBlock)
+{
+	PEMTPOOLOWNERMAP map = pThis->pMeta->sOwner + (uOwner & kEMTPoolOwnerSlotMask);
+	const uint32_t uChunk = uBlock >> pThis->uChunkShift;
+	uint32_t uOld;
+
+	do
+	{
+		uOld = map->uHeld[uChunk];
+	} while (rt_cmpXchg32(map->uHeld + uChunk, uOld + 1, uOld) != uOld);
+
+	if (uOld == 0)
+		EMTPool_atomicOr(map->uChunk + (uChunk >> kEMTPoolBitmapShift), 1U << (uChunk & kEMTPoolBitmapMask));
+}
+
+/* Uncounts a block the owner let go of, the last one in a chunk unmarks it */
+static void EMTPool_ownerDrop(PEMTPOOL pThis, const uint32_t uOwner, const uint32_t uBlock)
+{
+	PEMTPOOLOWNERMAP map = pThis->pMeta->sOwner + (uOwner & kEMTPoolOwnerSlotMask);
+	const uint32_t uChunk = uBlock >> pThis->uChunkShift;
+	volatile uint32_t * pWord = map->uChunk + (uChunk >> kEMTPoolBitmapShift);
+	const uint32_t uBit = 1U << (uChunk & kEMTPoolBitmapMask);
+	uint32_t uOld;
+
+	if (uOwner == kEMTPoolOwnerInner)
+		return;
+
+	do
+	{
+		uOld = map->uHeld[uChunk];
+	} while (uOld != 0 && rt_cmpXchg32(map->uHeld + uChunk, uOld - 1, uOld) != uOld);
+
+	if (uOld != 1)
+		return;
+
+	do
+	{
+		uOld = *pWord;
+	} while ((uOld & uBit) && rt_cmpXchg32(pWord, uOld & ~uBit, uOld) != uOld);
+
+	// A hold may have come in before the bit went down
+	if (map->uHeld[uChunk] != 0)
+		EMTPool_atomicOr(pWord, uBit);
+}
+
+static void EMTPool_freeIndexed(PEMTPOOL pThis, const uint32_t uBlock)
+{
+	const uint32_t uOwner = pThis->pOwner[uBlock];
+	const uint32_t uBlocks = pThis->pLen[uBlock];
+
+	if (uOwner == 0 || rt_cmpXchg32(pThis->pOwner + uBlock, 0, uOwner) != uOwner)
+		return;
+
+	EMTPool_ownerDrop(pThis, uOwner, uBlock);
+	EMTPool_statsFree(pThis, uBlocks);
+	pThis->pLen[uBlock] = 1;
+	if (pThis->uMode == kEMTPoolModeBuddy)
+	{
+		const uint32_t uOrder = rt_bitScan32(uBlocks);
+		EMTPool_buddyPut(pThis, uOrder, uBlock >> uOrder);
+	}
+	else
+	{
+		EMTPool_bitmapRelease(pThis, uBlock, uBlocks);
+	}
+}
+
+static PEMTPOOLSHARE EMTPool_shareOf(PEMTPOOL pThis, const uint32_t uBlock)
+{
+	const uint32_t uShare = pThis->pShare[uBlock];
+	return uShare ? pThis->pMeta->sShare + uShare - 1 : 0;
+}
+
+/* Drops the reference of one owner slot, nonzero only for the one taking the count from 1 to 0 */
+static uint32_t EMTPool_release(PEMTPOOL pThis, const uint32_t uBlock, const uint32_t uSlot)
+{
+	PEMTPOOLSHARE share = EMTPool_shareOf(pThis, uBlock);
+	volatile uint32_t * pWord;
+	uint32_t uBit, uOld;
+
+	if (share == 0)
+		return 0;
+
+	pWord = share->uReader + (uSlot >> kEMTPoolBitmapShift);
+	uBit = 1U << (uSlot & kEMTPoolBitmapMask);
+
+	// A slot that already let go, or never was a reader, has nothing to drop
+	do
+	{
+		uOld = *pWord;
+		if ((uOld & uBit) == 0)
+			return 0;
+	} while (rt_cmpXchg32(pWord, uOld & ~uBit, uOld) != uOld);
+
+	do
+	{
+		uOld = share->uCount;
+	} while (rt_cmpXchg32(&share->uCount, uOld - 1, uOld) != uOld);
+
+	if (uOld != 1)
+		return 0;
+
+	pThis->pShare[uBlock] = 0;
+	share->uBlock = 0;
+	return 1;
+}
+
+static void EMTPool_freeBlock(PEMTPOOL pThis, const uint32_t uBlock)
+{
+	const uint32_t uOwner = pThis->pOwner[uBlock];
+
+	if (pThis->uMode != kEMTPoolModeScan)
+	{
+		EMTPool_freeIndexed(pThis, uBlock);
+	}
+	else if (uOwner != 0 && uOwner != kEMTPoolOwnerInner && rt_cmpXchg32(pThis->pOwner + uBlock, 0, uOwner) == uOwner)
+	{
+		EMTPool_ownerDrop(pThis, uOwner, uBlock);
+		EMTPool_statsFree(pThis, pThis->pLen[uBlock]);
+	}
+}
+
 void EMTPool_calcMetaSize(const uint32_t uBlockCount, const uint32_t uBlockLen, uint32_t * pMetaLen, uint32_t * pMemLen)
 {
-	*pMetaLen = sizeof(EMTPOOLMETA) + sizeof(EMTPOOLBLOCKMETA) * uBlockCount;
+	*pMetaLen = sizeof(EMTPOOLMETA) + sizeof(uint32_t) * (EMTPool_lineWords(uBlockCount) * 4 + EMTPool_lineWords(EMTPool_indexWords(uBlockCount)));
 	*pMemLen = uBlockLen * uBlockCount;
 }
 
@@ -60,10 +814,21 @@ void EMTPool_construct(PEMTPOOL pThis, const uint32_t uId, const uint32_t uBlock
 	volatile uint32_t * pInitStatus;
 	uint32_t i;
 
+	const uint32_t uArrayWords = EMTPool_lineWords(uBlockCount);
+
 	pThis->pMeta = (PEMTPOOLMETA)pMeta;
-	pThis->pBlockMeta = (PEMTPOOLBLOCKMETA)(pThis->pMeta + 1);
+	pThis->pOwner = (volatile uint32_t *)(pThis->pMeta + 1);
+	pThis->pLen = pThis->pOwner + uArrayWords;
+	pThis->pAllocLen = pThis->pLen + uArrayWords;
+	pThis->pShare = pThis->pAllocLen + uArrayWords;
+	pThis->pBitmap = pThis->pShare + uArrayWords;
+	pThis->pSummary = pThis->pBitmap + EMTPool_bitmapWords(uBlockCount);
 	pThis->pPool = pPool;
 	pThis->uId = uId;
+	pThis->uShareHint = 0;
+
+	// Wide enough chunks that every owner map covers the whole pool
+	for (pThis->uChunkShift = 0; (uBlockCount - 1) >> pThis->uChunkShift >= kEMTPoolOwnerChunks; ++pThis->uChunkShift);
 
 	pInitStatus = &pThis->pMeta->uBlockLen;
 
@@ -71,14 +836,54 @@ void EMTPool_construct(PEMTPOOL pThis, const uint32_t uId, const uint32_t uBlock
 	while (i != kEMTPoolMagicNumUninit && *pInitStatus == kEMTPoolMagicNumInit);
 
 	if (i != kEMTPoolMagicNumUninit)
+	{
+		// The first constructor decides the mode for every process sharing the pool
+		pThis->uMode = pThis->pMeta->uMode;
+		pThis->uNumaNodeMask = pThis->pMeta->uNumaNodeMask;
 		return;
+	}
 
-	pThis->pMeta->uNextBlock = 0;
-	pThis->pMeta->uBlockLen = uBlockLen;
+	pThis->pMeta->uVersion = kEMTPoolLayoutVersion;
+	pThis->pMeta->uCursor = 0;
 	pThis->pMeta->uBlockCount = uBlockCount;
-	rt_memset(pThis->pBlockMeta, 0, pThis->pMeta->uBlockCount * sizeof(*pThis->pBlockMeta));
-	for (i = 0; i < uBlockCount; i += uBlockInit)
-		pThis->pBlockMeta[i].uLen = uBlockInit;
+	pThis->pMeta->uMode = pThis->uMode;
+	pThis->pMeta->uNumaNodeMask = pThis->uNumaNodeMask;
+	rt_memset((void *)pThis->pMeta->sOwner, 0, sizeof(pThis->pMeta->sOwner));
+	rt_memset((void *)pThis->pMeta->sShare, 0, sizeof(pThis->pMeta->sShare));
+	rt_memset((void *)pThis->pOwner, 0, (uArrayWords * 4 + EMTPool_indexWords(uBlockCount)) * sizeof(uint32_t));
+
+	if (pThis->uMode == kEMTPoolModeBitmap)
+	{
+		for (i = 0; i < uBlockCount; ++i)
+			pThis->pLen[i] = 1;
+		EMTPool_bitmapRelease(pThis, 0, uBlockCount);
+	}
+	else if (pThis->uMode == kEMTPoolModeBuddy)
+	{
+		for (i = 0; i < uBlockCount; ++i)
+			pThis->pLen[i] = 1;
+
+		// Cover the pool with the largest aligned power-of-two blocks that fit
+		for (i = 0; i < uBlockCount; )
+		{
+			uint32_t uOrder = i ? rt_bitScan32(i) : EMTPool_buddyOrders(uBlockCount) - 1;
+			while (i + (1U << uOrder) > uBlockCount)
+				--uOrder;
+
+			EMTPool_buddyPut(pThis, uOrder, i >> uOrder);
+			i += 1U << uOrder;
+		}
+	}
+	else
+	{
+		for (i = 0; i < uBlockCount; i += uBlockInit)
+			pThis->pLen[i] = uBlockInit;
+	}
+
+	if (pThis->uNumaNodeMask != 0)
+		EMTPool_numaPlace(pThis, uBlockCount, uBlockLen);
+
+	pThis->pMeta->uBlockLen = uBlockLen;
 }
 
 void EMTPool_destruct(PEMTPOOL pThis)
@@ -114,109 +919,215 @@ const uint32_t EMTPool_blockCount(PEMTPOOL pThis)
 const uint32_t EMTPool_length(PEMTPOOL pThis, void * pMem)
 {
 	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
-	PEMTPOOLBLOCKMETA pBlockMeta = pThis->pBlockMeta + uBlock;
-	return pBlockMeta->uAllocLen;
+	return pThis->pAllocLen[uBlock];
+}
+
+void EMTPool_setLength(PEMTPOOL pThis, void * pMem, const uint32_t uMemLen)
+{
+	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
+
+	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError || uMemLen > pThis->pLen[uBlock] * pThis->pMeta->uBlockLen)
+		return;
+
+	if (pThis->pAllocLen[uBlock] != uMemLen)
+		pThis->pAllocLen[uBlock] = uMemLen;
 }
 
 void * EMTPool_alloc(PEMTPOOL pThis, const uint32_t uMemLen)
 {
 	const uint32_t uBlocks = uMemLen ? (uMemLen + pThis->pMeta->uBlockLen - 1) / pThis->pMeta->uBlockLen : 1;
-	PEMTPOOLBLOCKMETA pBlockMeta = 0;
-	uint32_t uRound = 3;
-	while ((pBlockMeta == 0 || pBlockMeta->uLen < uBlocks) && uRound)
+	void * pMem;
+
+	switch (pThis->uMode)
 	{
-		const uint32_t uBlockCurP = pBlockMeta ? (uint32_t)(pBlockMeta - pThis->pBlockMeta + pBlockMeta->uLen) : pThis->pMeta->uNextBlock;
-		const uint32_t uBlockCur = uBlockCurP < pThis->pMeta->uBlockCount ? uBlockCurP : 0;
-		PEMTPOOLBLOCKMETA pBlockMetaCur = pThis->pBlockMeta + uBlockCur;
-		const uint32_t uBlockNextP = uBlockCur + pBlockMetaCur->uLen;
-		const uint32_t uBlockNext = uBlockNextP < pThis->pMeta->uBlockCount ? uBlockNextP : 0;
+	case kEMTPoolModeBitmap:
+		pMem = EMTPool_allocBitmap(pThis, uMemLen, uBlocks);
+		break;
+	case kEMTPoolModeBuddy:
+		pMem = EMTPool_allocBuddy(pThis, uMemLen, uBlocks);
+		break;
+	default:
+		pMem = EMTPool_allocScan(pThis, uMemLen, uBlocks);
+		break;
+	}
 
-		const uint32_t bSuccess = rt_cmpXchg32(&pThis->pMeta->uNextBlock, uBlockNext, uBlockCur) == uBlockCur
-			&& rt_cmpXchg32(&pBlockMetaCur->uOwner, pThis->uId, 0) == 0;
+	EMTPool_statsAlloc(pThis, &pMem, pMem ? 1 : 0, 1);
 
-		if (pBlockMeta != 0 && (!bSuccess || uBlockCur != uBlockCurP))
-		{
-			pBlockMeta->uOwner = 0;
-			pBlockMeta = 0;
-		}
+	if (pMem)
+		EMTPool_ownerHold(pThis, pThis->uId, EMTPool_blockFromAddress(pThis, pMem));
 
-		if (uBlockNext != uBlockNextP)
-		{
-			--uRound;
-		}
+	return pMem;
+}
 
-		if (bSuccess)
+void EMTPool_free(PEMTPOOL pThis, void * pMem)
+{
+	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
+
+	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError)
+		return;
+
+	// A shared block goes with its last reader, anyone else's free is refused
+	if (pThis->pShare[uBlock] != 0 && !EMTPool_release(pThis, uBlock, pThis->uId & kEMTPoolOwnerSlotMask))
+		return;
+
+	EMTPool_freeBlock(pThis, uBlock);
+}
+
+/* Earlier generations of the slot are dead, blocks sent to them after their owner went are freed along */
+void EMTPool_freeAll(PEMTPOOL pThis, const uint32_t uId)
+{
+	volatile uint32_t * pMap = pThis->pMeta->sOwner[uId & kEMTPoolOwnerSlotMask].uChunk;
+	uint32_t uWord, i;
+
+	for (uWord = 0; uWord < kEMTPoolOwnerMapWords; ++uWord)
+	{
+		uint32_t uChunks;
+
+		for (uChunks = pMap[uWord]; uChunks; uChunks &= uChunks - 1)
 		{
-			if (pBlockMeta != 0)
-			{
-				pBlockMeta->uLen += pBlockMetaCur->uLen;
-			}
-			else
+			const uint32_t uFirst = ((uWord << kEMTPoolBitmapShift) + rt_bitScan32(uChunks)) << pThis->uChunkShift;
+			const uint32_t uLast = uFirst + (1U << pThis->uChunkShift) < pThis->pMeta->uBlockCount ? uFirst + (1U << pThis->uChunkShift) : pThis->pMeta->uBlockCount;
+			uint32_t uBlock;
+
+			// Blocks still out to readers go with the last of them, each free unmarks the chunk once it is empty
+			for (uBlock = uFirst; uBlock < uLast; ++uBlock)
 			{
-				pBlockMeta = pBlockMetaCur;
+				const uint32_t uOwner = pThis->pOwner[uBlock];
+
+				if (uOwner != 0 && uOwner != kEMTPoolOwnerInner && ((uOwner ^ uId) & kEMTPoolOwnerSlotMask) == 0 && pThis->pShare[uBlock] == 0)
+					EMTPool_freeBlock(pThis, uBlock);
 			}
 		}
 	}
 
-	if (pBlockMeta)
+	// References the slot holds as a reader, a dead subscriber's would pin its blocks forever
+	for (i = 0; i < kEMTPoolShareSlots; ++i)
 	{
-		if (pBlockMeta->uLen > uBlocks)
+		const uint32_t uBlock = pThis->pMeta->sShare[i].uBlock;
+
+		if (uBlock != 0 && EMTPool_release(pThis, uBlock - 1, uId & kEMTPoolOwnerSlotMask))
+			EMTPool_freeBlock(pThis, uBlock - 1);
+	}
+}
+
+void EMTPool_reclaim(PEMTPOOL pThis, const uint32_t uId)
+{
+	// Nothing of the owner maps is ever locked, a dead owner leaves no state behind to repair
+	EMTPool_freeAll(pThis, uId);
+}
+
+const uint32_t EMTPool_allocBatch(PEMTPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount)
+{
+	const uint32_t uBlocks = uMemLen ? (uMemLen + pThis->pMeta->uBlockLen - 1) / pThis->pMeta->uBlockLen : 1;
+	uint32_t uDone, i;
+
+	if (pThis->uMode != kEMTPoolModeBitmap)
+	{
+		for (uDone = 0; uDone < uCount; ++uDone)
 		{
-			PEMTPOOLBLOCKMETA pBlockMetaCur = pBlockMeta + uBlocks;
-			pBlockMetaCur->uLen = pBlockMeta->uLen - uBlocks;
-			pBlockMetaCur->uOwner = 0;
-			pBlockMeta->uLen = uBlocks;
+			if ((ppMem[uDone] = EMTPool_alloc(pThis, uMemLen)) == 0)
+				break;
 		}
-		if (pBlockMeta->uLen == uBlocks)
+
+		return uDone;
+	}
+
+	uDone = EMTPool_allocBatchBitmap(pThis, uMemLen, uBlocks, ppMem, uCount);
+	EMTPool_statsAlloc(pThis, ppMem, uDone, uCount);
+	if (uDone == 0)
+		return 0;
+
+	for (i = 0; i < uDone; ++i)
+		EMTPool_ownerHold(pThis, pThis->uId, EMTPool_blockFromAddress(pThis, ppMem[i]));
+
+	return uDone;
+}
+
+void EMTPool_freeBatch(PEMTPOOL pThis, void ** ppMem, const uint32_t uCount)
+{
+	uint32_t uWord = kEMTPoolInvalidBlock;
+	uint32_t uMask = 0;
+	uint32_t i;
+
+	// Shared blocks only go when their last reader lets go, one at a time through free
+	for (i = 0; i < uCount; ++i)
+	{
+		if (EMTPool_validation(pThis, ppMem[i]) == kEMTPoolNoError && pThis->pShare[EMTPool_blockFromAddress(pThis, ppMem[i])] != 0)
 		{
-			pBlockMeta->uAllocLen = uMemLen;
+			for (i = 0; i < uCount; ++i)
+				EMTPool_free(pThis, ppMem[i]);
+			return;
 		}
+	}
 
-		if (pBlockMeta->uLen < uBlocks)
+	if (pThis->uMode != kEMTPoolModeBitmap)
+	{
+		for (i = 0; i < uCount; ++i)
 		{
-			pBlockMeta->uOwner = 0;
-			pBlockMeta = 0;
+			if (EMTPool_validation(pThis, ppMem[i]) == kEMTPoolNoError)
+				EMTPool_freeBlock(pThis, EMTPool_blockFromAddress(pThis, ppMem[i]));
 		}
+		return;
 	}
 
-	return pBlockMeta ? (uint8_t *)pThis->pPool + pThis->pMeta->uBlockLen * (pBlockMeta - pThis->pBlockMeta) : 0;
-}
+	// Release bits of neighbouring blocks together, one atomic per bitmap word
+	for (i = 0; i < uCount; ++i)
+	{
+		const uint32_t uBlock = EMTPool_blockFromAddress(pThis, ppMem[i]);
+		uint32_t uOwner, uEnd, uCur;
 
-void EMTPool_free(PEMTPOOL pThis, void * pMem)
-{
-	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
-	PEMTPOOLBLOCKMETA pBlockMeta = pThis->pBlockMeta + uBlock;
+		if (EMTPool_validation(pThis, ppMem[i]) != kEMTPoolNoError)
+			continue;
 
-	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError)
-		return;
+		uOwner = pThis->pOwner[uBlock];
+		uEnd = uBlock + pThis->pLen[uBlock];
+		if (uOwner == 0 || rt_cmpXchg32(pThis->pOwner + uBlock, 0, uOwner) != uOwner)
+			continue;
 
-	pBlockMeta->uOwner = 0;
-}
+		EMTPool_ownerDrop(pThis, uOwner, uBlock);
+		EMTPool_statsFree(pThis, uEnd - uBlock);
+		pThis->pLen[uBlock] = 1;
+		for (uCur = uBlock; uCur < uEnd; )
+		{
+			const uint32_t uStart = uCur & kEMTPoolBitmapMask;
+			const uint32_t uBits = uEnd - uCur < kEMTPoolBitmapBits - uStart ? uEnd - uCur : kEMTPoolBitmapBits - uStart;
 
-void EMTPool_freeAll(PEMTPOOL pThis, const uint32_t uId)
-{
-	PEMTPOOLBLOCKMETA pBlockMetaCur = pThis->pBlockMeta;
-	PEMTPOOLBLOCKMETA pBlockMetaEnd = pThis->pBlockMeta + pThis->pMeta->uBlockCount;
+			if (uWord != uCur >> kEMTPoolBitmapShift)
+			{
+				if (uMask)
+					EMTPool_bitmapReleaseWord(pThis, uWord, uMask);
 
-	do
-	{
-		PEMTPOOLBLOCKMETA pBlockMeta = pBlockMetaCur;
-		pBlockMetaCur += pBlockMeta->uLen;
+				uWord = uCur >> kEMTPoolBitmapShift;
+				uMask = 0;
+			}
 
-		if (pBlockMeta->uOwner == uId)
-			pBlockMeta->uOwner = 0;
-	} while (pBlockMetaCur < pBlockMetaEnd);
+			uMask |= EMTPool_bitmapMask(uStart, uBits);
+			uCur += uBits;
+		}
+	}
+
+	if (uMask)
+		EMTPool_bitmapReleaseWord(pThis, uWord, uMask);
 }
 
 const uint32_t EMTPool_transfer(PEMTPOOL pThis, void * pMem, const uint32_t uToId)
 {
 	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
-	PEMTPOOLBLOCKMETA pBlockMeta = pThis->pBlockMeta + uBlock;
+	uint32_t uOwner;
 
 	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError)
 		return 0;
 
-	pBlockMeta->uOwner = uToId;
+	uOwner = pThis->pOwner[uBlock];
+	if (uOwner == uToId)
+		return uBlock;
+
+	// Counted for the receiver first, a transfer cut short leaves a stale count rather than a block no map points at
+	EMTPool_ownerHold(pThis, uToId, uBlock);
+	pThis->pOwner[uBlock] = uToId;
+
+	if (uOwner != 0)
+		EMTPool_ownerDrop(pThis, uOwner, uBlock);
 
 	return uBlock;
 }
@@ -231,6 +1142,55 @@ void * EMTPool_take(PEMTPOOL pThis, const uint32_t uToken)
 	return pMem;
 }
 
+const uint32_t EMTPool_share(PEMTPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount)
+{
+	const uint32_t uBlock = EMTPool_blockFromAddress(pThis, pMem);
+	PEMTPOOLSHARE share = 0;
+	uint32_t uReaders = 0;
+	uint32_t i;
+
+	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError || uCount == 0 || pThis->pShare[uBlock] != 0)
+		return 0;
+
+	for (i = 0; i < kEMTPoolShareSlots && share == 0; ++i)
+	{
+		PEMTPOOLSHARE shareCur = pThis->pMeta->sShare + ((pThis->uShareHint + i) & (kEMTPoolShareSlots - 1));
+
+		if (shareCur->uBlock == 0 && rt_cmpXchg32(&shareCur->uBlock, uBlock + 1, 0) == 0)
+			share = shareCur;
+	}
+
+	if (share == 0)
+		return 0;
+
+	pThis->uShareHint = (uint32_t)(share - pThis->pMeta->sShare) + 1;
+	rt_memset((void *)share->uReader, 0, sizeof(share->uReader));
+	for (i = 0; i < uCount; ++i)
+	{
+		const uint32_t uSlot = pReaders[i] & kEMTPoolOwnerSlotMask;
+		const uint32_t uBit = 1U << (uSlot & kEMTPoolBitmapMask);
+
+		uReaders += (share->uReader[uSlot >> kEMTPoolBitmapShift] & uBit) == 0;
+		share->uReader[uSlot >> kEMTPoolBitmapShift] |= uBit;
+	}
+
+	// Set before the token is handed out, each reader's free then finds its bit once
+	share->uCount = uReaders;
+	pThis->pShare[uBlock] = (uint32_t)(share - pThis->pMeta->sShare) + 1;
+	return uReaders;
+}
+
+const uint32_t EMTPool_readers(PEMTPOOL pThis, void * pMem)
+{
+	PEMTPOOLSHARE share;
+
+	if (EMTPool_validation(pThis, pMem) != kEMTPoolNoError)
+		return 0;
+
+	share = EMTPool_shareOf(pThis, EMTPool_blockFromAddress(pThis, pMem));
+	return share ? share->uCount : 0;
+}
+
 PCEMTPOOLOPS emtPool(void)
 {
 	static const EMTPOOLOPS sOps =
@@ -244,11 +1204,17 @@ PCEMTPOOLOPS emtPool(void)
 		EMTPool_blockLength,
 		EMTPool_blockCount,
 		EMTPool_length,
+		EMTPool_setLength,
 		EMTPool_alloc,
 		EMTPool_free,
 		EMTPool_freeAll,
+		EMTPool_reclaim,
+		EMTPool_allocBatch,
+		EMTPool_freeBatch,
 		EMTPool_transfer,
 		EMTPool_take,
+		EMTPool_share,
+		EMTPool_readers,
 	};
 
 	return &sOps;
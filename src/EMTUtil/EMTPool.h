@@ -10,8 +10,44 @@
 typedef struct _EMTPOOLOPS EMTPOOLOPS, * PEMTPOOLOPS;
 typedef const EMTPOOLOPS * PCEMTPOOLOPS;
 typedef struct _EMTPOOL EMTPOOL, * PEMTPOOL;
-typedef struct _EMTPOOLBLOCKMETA EMTPOOLBLOCKMETA, *PEMTPOOLBLOCKMETA;
 typedef struct _EMTPOOLMETA EMTPOOLMETA, *PEMTPOOLMETA;
+typedef struct _EMTPOOLSTATS EMTPOOLSTATS, * PEMTPOOLSTATS;
+
+enum
+{
+	kEMTPoolModeScan = 0,
+	kEMTPoolModeBitmap = 1,
+	kEMTPoolModeBuddy = 2,
+
+	kEMTPoolCacheLine = 64,
+
+	/* Owner ids carry a slot in the low bits and a generation above them */
+	kEMTPoolOwnerSlotShift = 8,
+	kEMTPoolOwnerSlots = 1 << kEMTPoolOwnerSlotShift,
+	kEMTPoolOwnerSlotMask = kEMTPoolOwnerSlots - 1,
+
+	/* The high-water mark is refreshed once every so many allocations */
+	kEMTPoolStatsSampleShift = 8,
+};
+
+/*
+ * Counters of one owner slot, kEMTPoolOwnerSlots of them per pool.
+ * Each process only writes its own row, with interlocked adds as its threads share it, readers sum the rows.
+ * Blocks in use are sum(uAlloc) - sum(uFree), bytes in flight sum(uBytesAlloc) - sum(uBytesFree).
+ */
+#pragma pack(push, 1)
+struct _EMTPOOLSTATS
+{
+	volatile uint64_t uAlloc;
+	volatile uint64_t uFree;
+	volatile uint64_t uFail;
+	volatile uint64_t uRetry;
+	volatile uint64_t uBytesAlloc;
+	volatile uint64_t uBytesFree;
+	volatile uint64_t uHighWater;
+	uint64_t uReserved;
+};
+#pragma pack(pop)
 
 struct _EMTPOOLOPS
 {
@@ -27,13 +63,23 @@ struct _EMTPOOLOPS
 	const uint32_t (*blockCount)(PEMTPOOL pThis);
 
 	const uint32_t (*length)(PEMTPOOL pThis, void * pMem);
+	void (*setLength)(PEMTPOOL pThis, void * pMem, const uint32_t uMemLen);
 
 	void * (*alloc)(PEMTPOOL pThis, const uint32_t uMemLen);
 	void (*free)(PEMTPOOL pThis, void * pMem);
+	/* Every block held by the owner slot of uId, earlier generations of the slot included */
 	void (*freeAll)(PEMTPOOL pThis, const uint32_t uId);
+	void (*reclaim)(PEMTPOOL pThis, const uint32_t uId);
+
+	const uint32_t (*allocBatch)(PEMTPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount);
+	void (*freeBatch)(PEMTPOOL pThis, void ** ppMem, const uint32_t uCount);
 
 	const uint32_t (*transfer)(PEMTPOOL pThis, void * pMem, const uint32_t uToId);
 	void * (*take)(PEMTPOOL pThis, const uint32_t uToken);
+
+	/* Hands the block to the given owner ids, each frees it once and the last free releases it, 0 when it cannot be shared */
+	const uint32_t (*share)(PEMTPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount);
+	const uint32_t (*readers)(PEMTPOOL pThis, void * pMem);
 };
 
 struct _EMTPOOL
@@ -42,9 +88,21 @@ struct _EMTPOOL
 	void * pPool;
 
 	PEMTPOOLMETA pMeta;
-	PEMTPOOLBLOCKMETA pBlockMeta;
+	volatile uint32_t * pOwner;
+	volatile uint32_t * pLen;
+	volatile uint32_t * pAllocLen;
+	volatile uint32_t * pShare;
+	volatile uint32_t * pBitmap;
+	volatile uint32_t * pSummary;
 
 	uint32_t uId;
+	uint32_t uChunkShift;
+	uint32_t uShareHint;
+
+	/* Public fields - init */
+	uint32_t uMode;
+	uint32_t uNumaNodeMask;
+	PEMTPOOLSTATS pStats; /* kEMTPoolOwnerSlots rows indexed by owner slot, or 0 */
 };
 
 EXTERN_C PCEMTPOOLOPS emtPool(void);
@@ -59,11 +117,17 @@ EMTIMPL_CALL const uint32_t EMTPool_poolLength(PEMTPOOL pThis);
 EMTIMPL_CALL const uint32_t EMTPool_blockLength(PEMTPOOL pThis);
 EMTIMPL_CALL const uint32_t EMTPool_blockCount(PEMTPOOL pThis);
 EMTIMPL_CALL const uint32_t EMTPool_length(PEMTPOOL pThis, void * pMem);
+EMTIMPL_CALL void EMTPool_setLength(PEMTPOOL pThis, void * pMem, const uint32_t uMemLen);
 EMTIMPL_CALL void * EMTPool_alloc(PEMTPOOL pThis, const uint32_t uMemLen);
 EMTIMPL_CALL void EMTPool_free(PEMTPOOL pThis, void * pMem);
 EMTIMPL_CALL void EMTPool_freeAll(PEMTPOOL pThis, const uint32_t uId);
+EMTIMPL_CALL void EMTPool_reclaim(PEMTPOOL pThis, const uint32_t uId);
+EMTIMPL_CALL const uint32_t EMTPool_allocBatch(PEMTPOOL pThis, const uint32_t uMemLen, void ** ppMem, const uint32_t uCount);
+EMTIMPL_CALL void EMTPool_freeBatch(PEMTPOOL pThis, void ** ppMem, const uint32_t uCount);
 EMTIMPL_CALL const uint32_t EMTPool_transfer(PEMTPOOL pThis, void * pMem, const uint32_t uToId);
 EMTIMPL_CALL void * EMTPool_take(PEMTPOOL pThis, const uint32_t uToken);
+EMTIMPL_CALL const uint32_t EMTPool_share(PEMTPOOL pThis, void * pMem, const uint32_t * pReaders, const uint32_t uCount);
+EMTIMPL_CALL const uint32_t EMTPool_readers(PEMTPOOL pThis, void * pMem);
 #else
 #define EMTPool_calcMetaSize emtPool()->calcMetaSize
 #define EMTPool_construct emtPool()->construct
@@ -74,14 +138,26 @@ EMTIMPL_CALL void * EMTPool_take(PEMTPOOL pThis, const uint32_t uToken);
 #define EMTPool_blockLength emtPool()->blockLength
 #define EMTPool_blockCount emtPool()->blockCount
 #define EMTPool_length emtPool()->length
+#define EMTPool_setLength emtPool()->setLength
 #define EMTPool_alloc emtPool()->alloc
 #define EMTPool_free emtPool()->free
 #define EMTPool_freeAll emtPool()->freeAll
+#define EMTPool_reclaim emtPool()->reclaim
+#define EMTPool_allocBatch emtPool()->allocBatch
+#define EMTPool_freeBatch emtPool()->freeBatch
 #define EMTPool_transfer emtPool()->transfer
 #define EMTPool_take emtPool()->take
+#define EMTPool_share emtPool()->share
+#define EMTPool_readers emtPool()->readers
 #endif
 
 EXTERN_C void * rt_memset(void * mem, const int val, const uint32_t size);
 EXTERN_C uint32_t rt_cmpXchg32(volatile uint32_t * dest, uint32_t exchg, uint32_t comp);
+EXTERN_C uint64_t rt_cmpXchg64(volatile uint64_t * dest, uint64_t exchg, uint64_t comp);
+EXTERN_C uint64_t rt_add64(volatile uint64_t * dest, uint64_t val);
+EXTERN_C uint32_t rt_bitScan32(const uint32_t val);
+EXTERN_C uint32_t rt_bitScanReverse32(const uint32_t val);
+EXTERN_C uint32_t rt_numaNode(void);
+EXTERN_C void rt_numaTouch(void * mem, const uint32_t size, const uint32_t node);
 
 #endif // __EMTPOOL_H__
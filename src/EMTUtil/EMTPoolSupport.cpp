@@ -4,8 +4,198 @@
 
 #include <EMTUtil/EMTPool.h>
 
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+BEGIN_NAMESPACE_ANONYMOUS
+
+enum
+{
+	/* Copies from here up bypass the caches, a partial chunk would otherwise evict both sides' working sets */
+	kStreamCopyThreshold = 1024 * 1024,
+};
+
+typedef void (*StreamCopy)(uint8_t * dst, const uint8_t * src, size_t size);
+
+#if defined(_M_X64) || defined(_M_IX86)
+// Each kernel copies up to its vector alignment of dst the plain way, then streams whole vectors
+
+static void streamCopySse2(uint8_t * dst, const uint8_t * src, size_t size)
+{
+	const size_t align = (16 - ((uintptr_t)dst & 15)) & 15;
+	const size_t head = align < size ? align : size;
+
+	memcpy(dst, src, head);
+	dst += head, src += head, size -= head;
+
+	for (; size >= 64; dst += 64, src += 64, size -= 64)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i *)src);
+		const __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+		const __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+		_mm_stream_si128((__m128i *)dst, a);
+		_mm_stream_si128((__m128i *)(dst + 16), b);
+		_mm_stream_si128((__m128i *)(dst + 32), c);
+		_mm_stream_si128((__m128i *)(dst + 48), d);
+	}
+
+	_mm_sfence();
+	memcpy(dst, src, size);
+}
+
+static void streamCopyAvx2(uint8_t * dst, const uint8_t * src, size_t size)
+{
+	const size_t align = (32 - ((uintptr_t)dst & 31)) & 31;
+	const size_t head = align < size ? align : size;
+
+	memcpy(dst, src, head);
+	dst += head, src += head, size -= head;
+
+	for (; size >= 128; dst += 128, src += 128, size -= 128)
+	{
+		const __m256i a = _mm256_loadu_si256((const __m256i *)src);
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		const __m256i c = _mm256_loadu_si256((const __m256i *)(src + 64));
+		const __m256i d = _mm256_loadu_si256((const __m256i *)(src + 96));
+		_mm256_stream_si256((__m256i *)dst, a);
+		_mm256_stream_si256((__m256i *)(dst + 32), b);
+		_mm256_stream_si256((__m256i *)(dst + 64), c);
+		_mm256_stream_si256((__m256i *)(dst + 96), d);
+	}
+
+	_mm_sfence();
+	_mm256_zeroupper();
+	memcpy(dst, src, size);
+}
+
+static void streamCopyAvx512(uint8_t * dst, const uint8_t * src, size_t size)
+{
+	const size_t align = (64 - ((uintptr_t)dst & 63)) & 63;
+	const size_t head = align < size ? align : size;
+
+	memcpy(dst, src, head);
+	dst += head, src += head, size -= head;
+
+	for (; size >= 256; dst += 256, src += 256, size -= 256)
+	{
+		const __m512i a = _mm512_loadu_si512(src);
+		const __m512i b = _mm512_loadu_si512(src + 64);
+		const __m512i c = _mm512_loadu_si512(src + 128);
+		const __m512i d = _mm512_loadu_si512(src + 192);
+		_mm512_stream_si512((__m512i *)dst, a);
+		_mm512_stream_si512((__m512i *)(dst + 64), b);
+		_mm512_stream_si512((__m512i *)(dst + 128), c);
+		_mm512_stream_si512((__m512i *)(dst + 192), d);
+	}
+
+	_mm_sfence();
+	_mm256_zeroupper();
+	memcpy(dst, src, size);
+}
+
+/* The widest kernel both the processor and the OS, which has to save the registers, support */
+static StreamCopy streamCopySelect()
+{
+	int info[4];
+	bool avx2 = false;
+	bool avx512 = false;
+
+	::__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	::__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+
+	if (osxsave && avx && maxLeaf >= 7)
+	{
+		const uint64_t xcr0 = ::_xgetbv(0);
+
+		::__cpuidex(info, 7, 0);
+		avx2 = (xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5)) != 0;
+		avx512 = (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) != 0;
+	}
+
+	return avx512 ? streamCopyAvx512 : avx2 ? streamCopyAvx2 : streamCopySse2;
+}
+#else
+static void streamCopyPlain(uint8_t * dst, const uint8_t * src, size_t size) { memcpy(dst, src, size); }
+static StreamCopy streamCopySelect() { return streamCopyPlain; }
+#endif
+
+END_NAMESPACE_ANONYMOUS
+
 EXTERN_C void * rt_memset(void *mem, const int val, const uint32_t size) { return memset(mem, val, size); }
 EXTERN_C uint32_t rt_cmpXchg32(volatile uint32_t *dest, uint32_t exchg, uint32_t comp) { return (uint32_t)::InterlockedCompareExchange((volatile LONG *)dest, (LONG)exchg, (LONG)comp); }
+EXTERN_C uint64_t rt_cmpXchg64(volatile uint64_t *dest, uint64_t exchg, uint64_t comp) { return (uint64_t)::InterlockedCompareExchange64((volatile LONG64 *)dest, (LONG64)exchg, (LONG64)comp); }
+EXTERN_C uint64_t rt_add64(volatile uint64_t *dest, uint64_t val) { return (uint64_t)::InterlockedExchangeAdd64((volatile LONG64 *)dest, (LONG64)val); }
+EXTERN_C uint32_t rt_bitScan32(const uint32_t val) { unsigned long index; ::_BitScanForward(&index, val); return index; }
+EXTERN_C uint32_t rt_bitScanReverse32(const uint32_t val) { unsigned long index; ::_BitScanReverse(&index, val); return index; }
+EXTERN_C uint32_t rt_numaNode(void)
+{
+	// Threads that care are pinned, so the node is looked up once per thread
+	static __declspec(thread) uint32_t node = ~0U;
+
+	if (node == ~0U)
+	{
+		PROCESSOR_NUMBER processor;
+		USHORT nodeNumber;
+
+		::GetCurrentProcessorNumberEx(&processor);
+		node = ::GetNumaProcessorNodeEx(&processor, &nodeNumber) ? nodeNumber : 0;
+	}
+
+	return node;
+}
+
+EXTERN_C void rt_numaTouch(void * mem, const uint32_t size, const uint32_t node)
+{
+	const HANDLE thread = ::GetCurrentThread();
+	GROUP_AFFINITY affinity = { 0 };
+	GROUP_AFFINITY previous = { 0 };
+	SYSTEM_INFO info;
+
+	::GetSystemInfo(&info);
+
+	// An unknown node, say on a single node box, just touches from where we are
+	const bool pinned = ::GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0
+		&& ::SetThreadGroupAffinity(thread, &affinity, &previous);
+	if (pinned)
+		::SwitchToThread();
+
+	for (uint32_t offset = 0; offset < size; offset += info.dwPageSize)
+		((volatile uint8_t *)mem)[offset] = 0;
+
+	if (pinned)
+		::SetThreadGroupAffinity(thread, &previous, NULL);
+}
+
 EXTERN_C void * rt_cmpXchgPtr(void * volatile * dest, void * exchg, void * comp) { return ::InterlockedCompareExchangePointer(dest, exchg, comp); }
+EXTERN_C uint32_t rt_cmpXchgPtr2(void * volatile * dest, void * exchg, const uintptr_t exchgTag, void * comp, const uintptr_t compTag)
+{
+#if defined(_WIN64)
+	LONG64 comparand[2] = { (LONG64)comp, (LONG64)compTag };
+	return ::InterlockedCompareExchange128((volatile LONG64 *)dest, (LONG64)exchgTag, (LONG64)exchg, comparand);
+#else
+	const LONG64 exchange = (LONG64)((uint64_t)(uintptr_t)exchg | ((uint64_t)exchgTag << 32));
+	const LONG64 comparand = (LONG64)((uint64_t)(uintptr_t)comp | ((uint64_t)compTag << 32));
+	return ::InterlockedCompareExchange64((volatile LONG64 *)dest, exchange, comparand) == comparand;
+#endif
+}
+
+EXTERN_C void * rt_memcpy(void * dst, const void * src, const uint32_t size)
+{
+	if (size < kStreamCopyThreshold)
+		return memcpy(dst, src, size);
+
+	static const StreamCopy streamCopy = streamCopySelect();
+	streamCopy((uint8_t *)dst, (const uint8_t *)src, size);
+	return dst;
+}
 
-EXTERN_C void * rt_memcpy(void * dst, const void * src, const uint32_t size) { return memcpy(dst, src, size); }
+EXTERN_C uint32_t rt_xchg32(volatile uint32_t * dest, uint32_t exchg) { return (uint32_t)::InterlockedExchange((volatile LONG *)dest, (LONG)exchg); }
+EXTERN_C void rt_prefetch(const void * mem) { ::PreFetchCacheLine(PF_TEMPORAL_LEVEL_1, mem); }
+EXTERN_C void rt_pause(void) { ::YieldProcessor(); }
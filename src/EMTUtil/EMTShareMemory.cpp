@@ -11,26 +11,40 @@ class EMTShareMemory : public IEMTShareMemory
 	EMTIMPL_IEMTUNKNOWN;
 
 public:
-	explicit EMTShareMemory(const wchar_t * name);
+	explicit EMTShareMemory(const wchar_t * name, const uint32_t options);
 	virtual ~EMTShareMemory();
 
 protected: // IEMTShareMemory
 	virtual uint32_t length();
 	virtual void * address();
 
+	virtual uint32_t options();
+
 	virtual void * open(const uint32_t length);
 	virtual void close();
 
+	virtual IEMTShareMemory * segment(const uint32_t index);
+
+private:
+	bool openLargePage(const uint32_t length);
+	void prefault();
+
+	static bool enableLockMemoryPrivilege();
+
 private:
 	wchar_t * mName;
 	uint32_t mLength;
+	uint32_t mRequested;
+	uint32_t mObtained;
 	void * mAddress;
 	HANDLE mShareMemory;
 };
 
-EMTShareMemory::EMTShareMemory(const wchar_t * name)
+EMTShareMemory::EMTShareMemory(const wchar_t * name, const uint32_t options)
 	: mName(_wcsdup(name))
 	, mLength(0)
+	, mRequested(options)
+	, mObtained(kEMTShareMemoryDefault)
 	, mAddress(NULL)
 	, mShareMemory(NULL)
 {
@@ -54,6 +68,11 @@ void * EMTShareMemory::address()
 	return mAddress;
 }
 
+uint32_t EMTShareMemory::options()
+{
+	return mObtained;
+}
+
 void * EMTShareMemory::open(const uint32_t length)
 {
 	do
@@ -61,19 +80,48 @@ void * EMTShareMemory::open(const uint32_t length)
 		if (mShareMemory != NULL)
 			break;
 
-		mShareMemory = ::CreateFileMappingW(INVALID_HANDLE_VALUE,
-			NULL,
-			PAGE_READWRITE,
-			0,
-			length,
-			mName);
+		mObtained = kEMTShareMemoryDefault;
 
-		if (mShareMemory == NULL)
-			break;
+		// Fall back to normal pages when large pages are not granted
+		if ((mRequested & kEMTShareMemoryLargePage) && openLargePage(length))
+		{
+			mObtained |= kEMTShareMemoryLargePage;
+		}
+		else
+		{
+			mShareMemory = ::CreateFileMappingW(INVALID_HANDLE_VALUE,
+				NULL,
+				PAGE_READWRITE,
+				0,
+				length,
+				mName);
 
-		mAddress = ::MapViewOfFile(mShareMemory, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+			if (mShareMemory == NULL)
+				break;
+
+			mAddress = ::MapViewOfFile(mShareMemory, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		}
 
 		mLength = length;
+
+		if (mAddress == NULL)
+			break;
+
+		if (mRequested & kEMTShareMemoryLock)
+		{
+			SIZE_T minSize, maxSize;
+			::GetProcessWorkingSetSize(::GetCurrentProcess(), &minSize, &maxSize);
+			::SetProcessWorkingSetSize(::GetCurrentProcess(), minSize + length, maxSize + length);
+
+			if (::VirtualLock(mAddress, length))
+				mObtained |= kEMTShareMemoryLock;
+		}
+
+		if (mRequested & kEMTShareMemoryPrefault)
+		{
+			prefault();
+			mObtained |= kEMTShareMemoryPrefault;
+		}
 	} while (false);
 
 	return mAddress;
@@ -84,16 +132,95 @@ void EMTShareMemory::close()
 	if (mShareMemory == NULL)
 		return;
 
+	if (mObtained & kEMTShareMemoryLock)
+		::VirtualUnlock(mAddress, mLength);
+
 	::UnmapViewOfFile(mAddress);
 	::CloseHandle(mShareMemory);
 
 	mAddress = NULL;
 	mShareMemory = NULL;
+	mObtained = kEMTShareMemoryDefault;
+}
+
+IEMTShareMemory * EMTShareMemory::segment(const uint32_t index)
+{
+	wchar_t name[MAX_PATH];
+	swprintf_s(name, L"%s.%u", mName, index);
+
+	return new EMTShareMemory(name, mRequested);
+}
+
+bool EMTShareMemory::openLargePage(const uint32_t length)
+{
+	const SIZE_T largePage = ::GetLargePageMinimum();
+	if (largePage == 0 || !enableLockMemoryPrivilege())
+		return false;
+
+	// Both the section and the view have to be whole large pages
+	const uint64_t largeLength = ((uint64_t)length + largePage - 1) & ~((uint64_t)largePage - 1);
+
+	mShareMemory = ::CreateFileMappingW(INVALID_HANDLE_VALUE,
+		NULL,
+		PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES,
+		(DWORD)(largeLength >> 32),
+		(DWORD)largeLength,
+		mName);
+
+	if (mShareMemory == NULL)
+		return false;
+
+	mAddress = ::MapViewOfFile(mShareMemory, FILE_MAP_ALL_ACCESS | FILE_MAP_LARGE_PAGES, 0, 0, (SIZE_T)largeLength);
+	if (mAddress == NULL)
+	{
+		::CloseHandle(mShareMemory);
+		mShareMemory = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void EMTShareMemory::prefault()
+{
+	typedef BOOL (WINAPI * PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+	static const PrefetchVirtualMemoryFn prefetchVirtualMemory =
+		(PrefetchVirtualMemoryFn)::GetProcAddress(::GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+
+	SYSTEM_INFO info;
+	::GetSystemInfo(&info);
+
+	if (prefetchVirtualMemory)
+	{
+		WIN32_MEMORY_RANGE_ENTRY range = { mAddress, mLength };
+		prefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0);
+	}
+
+	// Reading is enough to map every page, and never races with the peer's writes
+	for (uint32_t offset = 0; offset < mLength; offset += info.dwPageSize)
+		(void)*((volatile uint8_t *)mAddress + offset);
+}
+
+bool EMTShareMemory::enableLockMemoryPrivilege()
+{
+	HANDLE token;
+	if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		return false;
+
+	TOKEN_PRIVILEGES privileges = { 1 };
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	const bool ret = ::LookupPrivilegeValueW(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& ::AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+		&& ::GetLastError() == ERROR_SUCCESS;
+
+	::CloseHandle(token);
+	return ret;
 }
 
 END_NAMESPACE_ANONYMOUS
 
-IEMTShareMemory * createEMTShareMemory(const wchar_t * name)
+IEMTShareMemory * createEMTShareMemory(const wchar_t * name, const uint32_t options)
 {
-	return new EMTShareMemory(name);
+	return new EMTShareMemory(name, options);
 }
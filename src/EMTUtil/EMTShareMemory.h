@@ -7,15 +7,29 @@
 
 #include <EMTCommon.h>
 
+enum
+{
+	kEMTShareMemoryDefault = 0,
+	kEMTShareMemoryLargePage = 1 << 0,	/* SEC_LARGE_PAGES, needs SeLockMemoryPrivilege */
+	kEMTShareMemoryPrefault = 1 << 1,	/* fault every page in at open */
+	kEMTShareMemoryLock = 1 << 2,		/* VirtualLock the view */
+};
+
 struct DECLSPEC_NOVTABLE IEMTShareMemory : public IEMTUnknown
 {
 	virtual uint32_t length() = 0;
 	virtual void * address() = 0;
 
+	/* Options actually obtained by the last open, a subset of the requested ones */
+	virtual uint32_t options() = 0;
+
 	virtual void * open(const uint32_t length) = 0;
 	virtual void close() = 0;
+
+	/* A sibling share memory named after this one and the index, with the same options */
+	virtual IEMTShareMemory * segment(const uint32_t index) = 0;
 };
 
-IEMTShareMemory * createEMTShareMemory(const wchar_t * name);
+IEMTShareMemory * createEMTShareMemory(const wchar_t * name, const uint32_t options = kEMTShareMemoryDefault);
 
 #endif // __EMTSHAREMEMORY_H__
@@ -67,7 +67,7 @@ private:
 	bool mRunning;
 	uint32_t mStartPoint;
 
-	EMTLINKLISTNODE2 mQueued;
+	EMTLINKLISTHEAD2 mQueued;
 };
 
 EMTWorkThread::EMTWorkThread()
@@ -79,7 +79,7 @@ EMTWorkThread::EMTWorkThread()
 
 	mRegisteredWaitable.reserve(MAXIMUM_WAIT_OBJECTS);
 
-	EMTLinkList2_init(&mQueued);
+	EMTLinkList2_initHead(&mQueued);
 }
 
 EMTWorkThread::~EMTWorkThread()